@@ -1118,6 +1118,36 @@ static void imemcache_list_free(imemcache_t *cache, void *ptr)
 /*====================================================================*/
 /* IMEMECACHE INTERFACE                                               */
 /*====================================================================*/
+#ifndef IMEM_THREAD_LOCAL
+#if defined(_MSC_VER) || defined(__BORLANDC__)
+#define IMEM_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__) || defined(__clang__)
+#define IMEM_THREAD_LOCAL __thread
+#endif
+#endif
+
+/* each thread sticks to one lru array, assigned in round robin, so 
+   threads only share a magazine when there are more threads than
+   IMCACHE_LRU_COUNT, and the list_lock is only taken for batches */
+static int imemcache_array_index(void)
+{
+#ifdef IMEM_THREAD_LOCAL
+	static IMEM_THREAD_LOCAL int array_index = -1;
+	static volatile int array_next = 0;
+	if (array_index < 0) {
+	#if defined(__GNUC__) || defined(__clang__)
+		array_index = __sync_fetch_and_add(&array_next, 1);
+	#else
+		array_index = array_next++;
+	#endif
+		array_index &= (IMCACHE_LRU_COUNT - 1);
+	}
+	return array_index;
+#else
+	return 0;
+#endif
+}
+
 static int imemcache_fill_batch(imemcache_t *cache, int array_index)
 {
 	imemlru_t *array = &cache->array[array_index];
@@ -1148,8 +1178,7 @@ static void *imemcache_alloc(imemcache_t *cache)
 	void *ptr = NULL;
 	void **head;
 
-	array_index = 0;
-	array_index &= (IMCACHE_LRU_COUNT - 1);
+	array_index = imemcache_array_index();
 
 	array = &cache->array[array_index];
 
@@ -1182,8 +1211,7 @@ static void *imemcache_free(imemcache_t *cache, void *ptr)
 	int array_index = 0;
 	int invalidptr, count;
 
-	array_index = 0;
-	array_index &= (IMCACHE_LRU_COUNT - 1);
+	array_index = imemcache_array_index();
 	
 	head = (void**)(lptr - sizeof(void*));
 	linear = (size_t)head[0];
@@ -1243,21 +1271,22 @@ static void imemcache_shrink(imemcache_t *cache)
 	imemlru_t *array;
 	int array_index = 0;
 
-	array_index = 0;
-	array_index &= (IMCACHE_LRU_COUNT - 1);
+	for (array_index = 0; array_index < IMCACHE_LRU_COUNT; array_index++) {
+		array = &cache->array[array_index];
 
-	array = &cache->array[array_index];
+		imutex_lock(&array->lock);
+		imutex_lock(&cache->list_lock);
 
-	imutex_lock(&array->lock);
-	imutex_lock(&cache->list_lock);
+		for (; array->avial > 0; ) 
+			imemcache_list_free(cache, array->entry[--array->avial]);
 
-	for (; array->avial > 0; ) 
-		imemcache_list_free(cache, array->entry[--array->avial]);
+		imutex_unlock(&cache->list_lock);
+		imutex_unlock(&array->lock);
+	}
 
+	imutex_lock(&cache->list_lock);
 	imemcache_drain_list(cache, 0, -1);
-
 	imutex_unlock(&cache->list_lock);
-	imutex_unlock(&array->lock);
 }
 
 
@@ -1405,8 +1434,10 @@ static int ikmem_append(size_t size, struct IMEMGFP *gfp)
 	cache = imemcache_create(name, size, gfp);
 	
 	#ifdef IKMEM_MINWASTE
-	cache->array[0].limit = 2;
-	cache->array[0].batchcount = 1;
+	for (k = 0; k < IMCACHE_LRU_COUNT; k++) {
+		cache->array[k].limit = 2;
+		cache->array[k].batchcount = 1;
+	}
 	cache->free_limit = 1;
 	#endif
 
@@ -361,7 +361,7 @@ typedef struct IMEMGFP imemgfp_t;
 #endif
 
 #ifndef IMCACHE_LRU_SHIFT
-#define IMCACHE_LRU_SHIFT	2
+#define IMCACHE_LRU_SHIFT	3
 #endif
 
 #define IMCACHE_LRU_COUNT	(1 << IMCACHE_LRU_SHIFT)
@@ -1134,6 +1134,292 @@ ilong ims_flat(const struct IMSTREAM *s, void **pointer)
 	return s->pos_write - s->pos_read;
 }
 
+/* get ptr and size of each page chunk in [offset, offset + size) 
+   without copy, stops after count entries and returns how many were
+   filled. if vecptr is NULL, returns the chunk count of the range */
+int ims_vector(const struct IMSTREAM *s, ilong offset, ilong size,
+	const void *vecptr[], long veclen[], int count)
+{
+	const struct IQUEUEHEAD *head;
+	struct IMSPAGE *current;
+	ilong posread, canread;
+	int index = 0;
+
+	if (offset < 0 || offset >= s->size) return 0;
+	if (size > s->size - offset) size = s->size - offset;
+
+	posread = s->pos_read;
+
+	for (head = s->head.next; head != &s->head && size > 0; ) {
+		if (vecptr != NULL && index >= count) break;
+		current = iqueue_entry(head, struct IMSPAGE, head);
+		head = head->next;
+		if (head == &s->head) canread = s->pos_write - posread;
+		else canread = current->size - posread;
+		if (offset >= canread) {
+			offset -= canread;
+			posread = 0;
+			continue;
+		}
+		posread += offset;
+		canread -= offset;
+		offset = 0;
+		if (canread > size) canread = size;
+		if (vecptr != NULL) {
+			vecptr[index] = current->data + posread;
+			veclen[index] = (long)canread;
+		}
+		index++;
+		size -= canread;
+		posread = 0;
+	}
+
+	return index;
+}
+
+/* move data from src to dst page by page, returns moved size */
+ilong ims_move(struct IMSTREAM *dst, struct IMSTREAM *src, ilong size)
+{
+	ilong total = 0;
+	void *ptr;
+	while (size > 0) {
+		ilong canread = ims_flat(src, &ptr);
+		if (canread <= 0) break;
+		if (canread > size) canread = size;
+		ims_write(dst, ptr, canread);
+		ims_drop(src, canread);
+		total += canread;
+		size -= canread;
+	}
+	return total;
+}
+
+
+/**********************************************************************
+ * ITIMER: hierarchical timing wheel
+ **********************************************************************/
+#define ITIMER_INDEX(j, n) \
+	(((j) >> (ITIMER_TVR_BITS + (n) * ITIMER_TVN_BITS)) & ITIMER_TVN_MASK)
+
+static void itimer_internal_add(itimer_wheel *wheel, itimer_node *node)
+{
+	IUINT32 expires = node->expires;
+	IUINT32 idx = expires - wheel->jiffies;
+	struct IQUEUEHEAD *vec;
+
+	if ((IINT32)idx < 0) {
+		vec = wheel->tv1 + (wheel->jiffies & ITIMER_TVR_MASK);
+	}
+	else if (idx < ITIMER_TVR_SIZE) {
+		vec = wheel->tv1 + (expires & ITIMER_TVR_MASK);
+	}
+	else if (idx < (1ul << (ITIMER_TVR_BITS + ITIMER_TVN_BITS))) {
+		vec = wheel->tv2 + ITIMER_INDEX(expires, 0);
+	}
+	else if (idx < (1ul << (ITIMER_TVR_BITS + 2 * ITIMER_TVN_BITS))) {
+		vec = wheel->tv3 + ITIMER_INDEX(expires, 1);
+	}
+	else if (idx < (1ul << (ITIMER_TVR_BITS + 3 * ITIMER_TVN_BITS))) {
+		vec = wheel->tv4 + ITIMER_INDEX(expires, 2);
+	}
+	else {
+		vec = wheel->tv5 + ITIMER_INDEX(expires, 3);
+	}
+
+	iqueue_add_tail(&node->head, vec);
+}
+
+/* move nodes of a higher level slot down to lower levels */
+static int itimer_cascade(itimer_wheel *wheel, struct IQUEUEHEAD *tv,
+	int index)
+{
+	struct IQUEUEHEAD queue;
+	iqueue_init(&queue);
+	iqueue_splice_init(tv + index, &queue);
+	while (!iqueue_is_empty(&queue)) {
+		itimer_node *node = iqueue_entry(queue.next, itimer_node, head);
+		iqueue_del(&node->head);
+		itimer_internal_add(wheel, node);
+	}
+	return index;
+}
+
+void itimer_wheel_init(itimer_wheel *wheel, IUINT32 current)
+{
+	int i;
+	for (i = 0; i < ITIMER_TVR_SIZE; i++) {
+		iqueue_init(&wheel->tv1[i]);
+	}
+	for (i = 0; i < ITIMER_TVN_SIZE; i++) {
+		iqueue_init(&wheel->tv2[i]);
+		iqueue_init(&wheel->tv3[i]);
+		iqueue_init(&wheel->tv4[i]);
+		iqueue_init(&wheel->tv5[i]);
+	}
+	wheel->jiffies = current;
+	wheel->count = 0;
+}
+
+static void itimer_clear_vec(struct IQUEUEHEAD *vec, int size)
+{
+	int i;
+	for (i = 0; i < size; i++) {
+		while (!iqueue_is_empty(&vec[i])) {
+			itimer_node *node = iqueue_entry(vec[i].next, itimer_node, head);
+			iqueue_del_init(&node->head);
+		}
+	}
+}
+
+void itimer_wheel_destroy(itimer_wheel *wheel)
+{
+	itimer_clear_vec(wheel->tv1, ITIMER_TVR_SIZE);
+	itimer_clear_vec(wheel->tv2, ITIMER_TVN_SIZE);
+	itimer_clear_vec(wheel->tv3, ITIMER_TVN_SIZE);
+	itimer_clear_vec(wheel->tv4, ITIMER_TVN_SIZE);
+	itimer_clear_vec(wheel->tv5, ITIMER_TVN_SIZE);
+	wheel->count = 0;
+}
+
+void itimer_wheel_run(itimer_wheel *wheel, IUINT32 current)
+{
+	struct IQUEUEHEAD queue;
+
+	if (wheel->count == 0) {
+		/* nothing to cascade, jump over idle ticks */
+		if (itimediff(current, wheel->jiffies) >= 0) {
+			wheel->jiffies = current + 1;
+		}
+		return;
+	}
+
+	while (itimediff(current, wheel->jiffies) >= 0) {
+		int index = (int)(wheel->jiffies & ITIMER_TVR_MASK);
+		if (index == 0 &&
+			itimer_cascade(wheel, wheel->tv2, 
+				ITIMER_INDEX(wheel->jiffies, 0)) == 0 &&
+			itimer_cascade(wheel, wheel->tv3, 
+				ITIMER_INDEX(wheel->jiffies, 1)) == 0 &&
+			itimer_cascade(wheel, wheel->tv4, 
+				ITIMER_INDEX(wheel->jiffies, 2)) == 0) {
+			itimer_cascade(wheel, wheel->tv5, 
+				ITIMER_INDEX(wheel->jiffies, 3));
+		}
+		wheel->jiffies++;
+		iqueue_init(&queue);
+		iqueue_splice_init(wheel->tv1 + index, &queue);
+		while (!iqueue_is_empty(&queue)) {
+			itimer_node *node = iqueue_entry(queue.next, itimer_node, head);
+			iqueue_del_init(&node->head);
+			wheel->count--;
+			if (node->callback) {
+				node->callback(node->data, node->user);
+			}
+		}
+		if (wheel->count == 0) {
+			if (itimediff(current, wheel->jiffies) >= 0) {
+				wheel->jiffies = current + 1;
+			}
+			break;
+		}
+	}
+}
+
+/* earliest expiration in the first non-empty slot after index */
+static int itimer_scan_vec(const struct IQUEUEHEAD *vec, int size, 
+	int index, IUINT32 *expires)
+{
+	int i;
+	for (i = 0; i < size; i++) {
+		const struct IQUEUEHEAD *slot = vec + ((index + i) & (size - 1));
+		const struct IQUEUEHEAD *p;
+		int found = 0;
+		for (p = slot->next; p != slot; p = p->next) {
+			const itimer_node *node = iqueue_entry(p, const itimer_node, 
+				head);
+			if (found == 0 || itimediff(node->expires, expires[0]) < 0) {
+				expires[0] = node->expires;
+				found = 1;
+			}
+		}
+		if (found) return 1;
+	}
+	return 0;
+}
+
+/* the slot at current index of level n still waits for cascading at 
+   a block boundary, otherwise it holds the latest nodes of that level */
+static int itimer_scan_start(IUINT32 jiffies, int n)
+{
+	IUINT32 mask = (1ul << (ITIMER_TVR_BITS + n * ITIMER_TVN_BITS)) - 1;
+	int index = ITIMER_INDEX(jiffies, n);
+	return ((jiffies & mask) == 0)? index : index + 1;
+}
+
+long itimer_wheel_next(const itimer_wheel *wheel, IUINT32 current)
+{
+	IUINT32 jiffies = wheel->jiffies;
+	IUINT32 expires = 0, x;
+	long diff;
+	int found = 0;
+
+	if (wheel->count == 0) return -1;
+
+	if (itimer_scan_vec(wheel->tv1, ITIMER_TVR_SIZE, 
+		(int)(jiffies & ITIMER_TVR_MASK), &x)) {
+		expires = x, found = 1;
+	}
+	if (itimer_scan_vec(wheel->tv2, ITIMER_TVN_SIZE, 
+		itimer_scan_start(jiffies, 0), &x)) {
+		if (!found || itimediff(x, expires) < 0) expires = x, found = 1;
+	}
+	if (itimer_scan_vec(wheel->tv3, ITIMER_TVN_SIZE, 
+		itimer_scan_start(jiffies, 1), &x)) {
+		if (!found || itimediff(x, expires) < 0) expires = x, found = 1;
+	}
+	if (itimer_scan_vec(wheel->tv4, ITIMER_TVN_SIZE, 
+		itimer_scan_start(jiffies, 2), &x)) {
+		if (!found || itimediff(x, expires) < 0) expires = x, found = 1;
+	}
+	if (itimer_scan_vec(wheel->tv5, ITIMER_TVN_SIZE, 
+		itimer_scan_start(jiffies, 3), &x)) {
+		if (!found || itimediff(x, expires) < 0) expires = x, found = 1;
+	}
+
+	diff = itimediff(expires, current);
+	return (diff < 0)? 0 : diff;
+}
+
+void itimer_node_init(itimer_node *node, void (*callback)(void*, void*),
+	void *data, void *user)
+{
+	iqueue_init(&node->head);
+	node->expires = 0;
+	node->callback = callback;
+	node->data = data;
+	node->user = user;
+}
+
+void itimer_node_add(itimer_wheel *wheel, itimer_node *node, 
+	IUINT32 expires)
+{
+	if (itimer_node_pending(node)) {
+		iqueue_del(&node->head);
+		wheel->count--;
+	}
+	node->expires = expires;
+	itimer_internal_add(wheel, node);
+	wheel->count++;
+}
+
+void itimer_node_del(itimer_wheel *wheel, itimer_node *node)
+{
+	if (itimer_node_pending(node)) {
+		iqueue_del_init(&node->head);
+		wheel->count--;
+	}
+}
+
 
 /**********************************************************************
  * common string operation
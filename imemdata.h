@@ -1450,6 +1450,14 @@ void ims_clear(struct IMSTREAM *s);
 /* get flat ptr and size */
 ilong ims_flat(const struct IMSTREAM *s, void **pointer);
 
+/* get ptr and size of each page chunk in [offset, offset + size),
+   at most count, or only count them all if vecptr is NULL */
+int ims_vector(const struct IMSTREAM *s, ilong offset, ilong size,
+	const void *vecptr[], long veclen[], int count);
+
+/* move data from src to dst page by page, returns moved size */
+ilong ims_move(struct IMSTREAM *dst, struct IMSTREAM *src, ilong size);
+
 
 
 /**********************************************************************
@@ -1473,6 +1481,66 @@ static inline long itimediff(IUINT32 later, IUINT32 earlier)
 }
 
 
+/**********************************************************************
+ * ITIMER: hierarchical timing wheel (1 millisec per tick)
+ **********************************************************************/
+#define ITIMER_TVR_BITS		8
+#define ITIMER_TVN_BITS		6
+#define ITIMER_TVR_SIZE		(1 << ITIMER_TVR_BITS)
+#define ITIMER_TVN_SIZE		(1 << ITIMER_TVN_BITS)
+#define ITIMER_TVR_MASK		(ITIMER_TVR_SIZE - 1)
+#define ITIMER_TVN_MASK		(ITIMER_TVN_SIZE - 1)
+
+struct ITIMER_NODE
+{
+	struct IQUEUEHEAD head;
+	IUINT32 expires;
+	void (*callback)(void *data, void *user);
+	void *data;
+	void *user;
+};
+
+struct ITIMER_WHEEL
+{
+	struct IQUEUEHEAD tv1[ITIMER_TVR_SIZE];
+	struct IQUEUEHEAD tv2[ITIMER_TVN_SIZE];
+	struct IQUEUEHEAD tv3[ITIMER_TVN_SIZE];
+	struct IQUEUEHEAD tv4[ITIMER_TVN_SIZE];
+	struct IQUEUEHEAD tv5[ITIMER_TVN_SIZE];
+	IUINT32 jiffies;
+	ilong count;
+};
+
+typedef struct ITIMER_NODE itimer_node;
+typedef struct ITIMER_WHEEL itimer_wheel;
+
+/* init timing wheel, current is the time in millisec */
+void itimer_wheel_init(itimer_wheel *wheel, IUINT32 current);
+
+/* detach every pending node */
+void itimer_wheel_destroy(itimer_wheel *wheel);
+
+/* run callbacks of nodes expired at or before current */
+void itimer_wheel_run(itimer_wheel *wheel, IUINT32 current);
+
+/* millisec from current to the earliest expiration, -1 for none */
+long itimer_wheel_next(const itimer_wheel *wheel, IUINT32 current);
+
+/* init timer node */
+void itimer_node_init(itimer_node *node, void (*callback)(void*, void*),
+	void *data, void *user);
+
+/* (re)schedule node at expires, fires at next run if already passed */
+void itimer_node_add(itimer_wheel *wheel, itimer_node *node, 
+	IUINT32 expires);
+
+/* cancel node */
+void itimer_node_del(itimer_wheel *wheel, itimer_node *node);
+
+/* returns 1 if node is scheduled */
+#define itimer_node_pending(node) (!iqueue_is_empty(&((node)->head)))
+
+
 /**********************************************************************
  * misc operation
  **********************************************************************/
@@ -27,6 +27,7 @@
 #include <unistd.h>
 #include <netinet/in.h>
 #include <sys/select.h>
+#include <sys/uio.h>
 
 #ifndef __AVM3__
 #include <poll.h>
@@ -589,6 +590,41 @@ long isend(int sock, const void *buf, long size, int mode)
 	return (long)send(sock, (char*)buf, size, mode);
 }
 
+/* send vector in one call, at most ISENDV_MAX buffers are sent */
+long isendv(int sock, const void * const vecptr[], const long veclen[],
+	int count, int mode)
+{
+#if defined(__unix) && (!defined(__AVM3__))
+	struct iovec iov[ISENDV_MAX];
+	struct msghdr msg;
+	int i;
+	if (count > ISENDV_MAX) count = ISENDV_MAX;
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = (void*)vecptr[i];
+		iov[i].iov_len = (size_t)veclen[i];
+	}
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+	return (long)sendmsg(sock, &msg, mode);
+#elif defined(_WIN32) && (!defined(_XBOX))
+	WSABUF bufs[ISENDV_MAX];
+	DWORD sent = 0;
+	int i;
+	if (count > ISENDV_MAX) count = ISENDV_MAX;
+	for (i = 0; i < count; i++) {
+		bufs[i].buf = (char*)vecptr[i];
+		bufs[i].len = (u_long)veclen[i];
+	}
+	if (WSASend(sock, bufs, count, &sent, (DWORD)mode, NULL, NULL) != 0)
+		return -1;
+	return (long)sent;
+#else
+	if (count <= 0) return 0;
+	return isend(sock, vecptr[0], veclen[0], mode);
+#endif
+}
+
 /* receive data */
 long irecv(int sock, void *buf, long size, int mode)
 {
@@ -1636,6 +1672,12 @@ int inet_tcp_estab(int sock)
 #endif
 #if defined(__linux__)
 #define IHAVE_EPOLL
+#define IHAVE_EPOLLET
+#endif
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define IHAVE_URING
+#endif
 #endif
 #if defined(__sun) || defined(__sun__)
 #define IHAVE_DEVPOLL
@@ -1670,6 +1712,11 @@ struct IPOLL_DRIVER
 	int (*poll_set)(ipolld ipd, int fd, int mask);		
 	int (*poll_wait)(ipolld ipd, int timeval);			
 	int (*poll_event)(ipolld ipd, int *fd, int *event, void **udata);
+	int (*poll_batch)(ipolld ipd, IPOLLEVENT *events, int count);
+	int (*poll_recv)(ipolld ipd, int fd);
+	long (*poll_data)(ipolld ipd, int fd, void **ptr);
+	int (*poll_send)(ipolld ipd, int fd, const void * const vecptr[],
+		const long veclen[], int count);
 };
 
 /* current poll device */
@@ -1720,6 +1767,12 @@ extern struct IPOLL_DRIVER IPOLL_KEVENT;
 #ifdef IHAVE_EPOLL
 extern struct IPOLL_DRIVER IPOLL_EPOLL;
 #endif
+#ifdef IHAVE_EPOLLET
+extern struct IPOLL_DRIVER IPOLL_EPOLLET;
+#endif
+#ifdef IHAVE_URING
+extern struct IPOLL_DRIVER IPOLL_URING;
+#endif
 #ifdef IHAVE_DEVPOLL
 extern struct IPOLL_DRIVER IPOLL_DEVPOLL;
 #endif
@@ -1746,6 +1799,12 @@ static struct IPOLL_DRIVER *ipoll_list[] = {
 #ifdef IHAVE_EPOLL
 	&IPOLL_EPOLL,
 #endif
+#ifdef IHAVE_EPOLLET
+	&IPOLL_EPOLLET,
+#endif
+#ifdef IHAVE_URING
+	&IPOLL_URING,
+#endif
 #ifdef IHAVE_DEVPOLL
 	&IPOLL_DEVPOLL,
 #endif
@@ -1773,8 +1832,9 @@ IMUTEX_TYPE ipoll_mutex;
 /* poll initialize */
 int ipoll_init(int device)
 {
+	unsigned long tried = 0;
 	int besti, bestv;
-	int retval, i;
+	int retval = -1, i;
 
 	if (ipoll_inited) return 1;
 	
@@ -1784,21 +1844,28 @@ int ipoll_init(int device)
 		if (ipoll_list[i] == NULL) 
 			return -1;
 		IPOLLDRV = *ipoll_list[i];
-	}	else {
-		besti = 0;
+		retval = IPOLLDRV.startup();
+		/* io_uring may be unsupported or disabled by the kernel */
+		if (retval != 0 && device != IDEVICE_URING) return -2;
+		tried |= 1ul << i;
+	}
+
+	/* choose the best device which can startup */
+	while (retval != 0) {
+		besti = -1;
 		bestv = -1;
 		for (i = 0; ipoll_list[i]; i++) {
+			if (tried & (1ul << i)) continue;
 			if (ipoll_list[i]->performance > bestv) {
 				bestv = ipoll_list[i]->performance;
 				besti = i;
 			}
 		}
+		if (besti < 0) return -2;
+		tried |= 1ul << besti;
 		IPOLLDRV = *ipoll_list[besti];
+		retval = IPOLLDRV.startup();
 	}
-	
-	retval = IPOLLDRV.startup();
-
-	if (retval != 0) return -2;
 
 	IMUTEX_INIT(&ipoll_mutex);
 	ipoll_inited = 1;
@@ -1898,6 +1965,44 @@ int ipoll_event(ipolld ipd, int *fd, int *event, void **udata)
 	return retval;
 }
 
+/* get events in batch */
+int ipoll_event_batch(ipolld ipd, IPOLLEVENT *events, int count)
+{
+	int n = 0;
+	if (IPOLLDRV.poll_batch) {
+		return IPOLLDRV.poll_batch(ipd, events, count);
+	}
+	while (n < count) {
+		IPOLLEVENT *e = &events[n];
+		if (IPOLLDRV.poll_event(ipd, &e->fd, &e->event, &e->udata) != 0) 
+			break;
+		if (e->event != 0) n++;
+	}
+	return n;
+}
+
+/* turn fd to completion recv */
+int ipoll_recv(ipolld ipd, int fd)
+{
+	if (IPOLLDRV.poll_recv == NULL) return -1;
+	return (IPOLLDRV.poll_recv(ipd, fd) == 0)? 0 : -1;
+}
+
+/* fetch next chunk received */
+long ipoll_recv_data(ipolld ipd, int fd, void **ptr)
+{
+	if (IPOLLDRV.poll_data == NULL) return -1;
+	return IPOLLDRV.poll_data(ipd, fd, ptr);
+}
+
+/* queue a send */
+int ipoll_send(ipolld ipd, int fd, const void * const vecptr[],
+	const long veclen[], int count)
+{
+	if (IPOLLDRV.poll_send == NULL) return -1;
+	return IPOLLDRV.poll_send(ipd, fd, vecptr, veclen, count);
+}
+
 /* vector init */
 static void ipv_init(struct IPVECTOR *vec)
 {
@@ -2843,6 +2948,7 @@ static int ipe_poll_del(ipolld ipd, int fd);
 static int ipe_poll_set(ipolld ipd, int fd, int mask);
 static int ipe_poll_wait(ipolld ipd, int timeval);
 static int ipe_poll_event(ipolld ipd, int *fd, int *event, void **user);
+static int ipe_poll_batch(ipolld ipd, IPOLLEVENT *events, int count);
 
 /* epoll device structure */
 typedef struct
@@ -2872,7 +2978,8 @@ struct IPOLL_DRIVER IPOLL_EPOLL = {
 	ipe_poll_del,
 	ipe_poll_set,
 	ipe_poll_wait,
-	ipe_poll_event
+	ipe_poll_event,
+	ipe_poll_batch
 };
 
 
@@ -3090,24 +3197,253 @@ static int ipe_poll_event(ipolld ipd, int *fd, int *event, void **user)
 }
 
 
+/* epoll query events in batch */
+static int ipe_poll_batch(ipolld ipd, IPOLLEVENT *events, int count)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	int n = 0;
+	while (n < count && ps->cur_res < ps->results) {
+		IPOLLEVENT *e = &events[n];
+		ipe_poll_event(ipd, &e->fd, &e->event, &e->udata);
+		if (e->event != 0) n++;
+	}
+	return n;
+}
+
+
+/*-------------------------------------------------------------------*/
+/* POLL DRIVER - EPOLLET                                             */
+/*-------------------------------------------------------------------*/
+/* edge-triggered variant of the epoll driver, sharing IPD_EPOLL     */
+/* with the level-triggered one. an fd will not be reported again    */
+/* until its state changes, so read/write/accept must be repeated    */
+/* until EAGAIN before waiting again.                                */
+/*-------------------------------------------------------------------*/
+#ifdef IHAVE_EPOLLET
+
+static int ipet_poll_add(ipolld ipd, int fd, int mask, void *user);
+static int ipet_poll_set(ipolld ipd, int fd, int mask);
+static int ipet_poll_event(ipolld ipd, int *fd, int *event, void **user);
+static int ipet_poll_batch(ipolld ipd, IPOLLEVENT *events, int count);
+
+/* epollet poll descriptor */
+struct IPOLL_DRIVER IPOLL_EPOLLET = {
+	sizeof (IPD_EPOLL),	
+	IDEVICE_EPOLLET,
+	90,
+	"EPOLLET",
+	ipe_startup,
+	ipe_shutdown,
+	ipe_init_pd,
+	ipe_destroy_pd,
+	ipet_poll_add,
+	ipe_poll_del,
+	ipet_poll_set,
+	ipe_poll_wait,
+	ipet_poll_event,
+	ipet_poll_batch
+};
+
+/* convert ipoll mask to edge-triggered epoll events */
+static unsigned int ipet_events(int mask, int exclusive)
+{
+	unsigned int events = EPOLLET;
+	if (mask & IPOLL_IN) events |= EPOLLIN;
+	if (mask & IPOLL_OUT) events |= EPOLLOUT;
+	if (mask & IPOLL_ERR) events |= EPOLLERR | EPOLLHUP;
+#ifdef EPOLLEXCLUSIVE
+	if (exclusive) events |= EPOLLEXCLUSIVE;
+#endif
+	return events;
+}
+
+/* epollet add file */
+static int ipet_poll_add(ipolld ipd, int fd, int mask, void *user)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	int usr_nlen, i;
+	struct epoll_event ee;
+
+	if (ps->num_fd >= ps->max_fd) {
+		i = (ps->max_fd <= 0)? 4 : ps->max_fd * 2;
+		if (ipv_resize(&ps->vresult, i * sizeof(struct epoll_event) * 2))
+			return -1;
+		ps->mresult = (struct epoll_event*)ps->vresult.data;
+		ps->max_fd = i;
+	}
+	if (fd >= ps->usr_len) {
+		usr_nlen = fd + 128;
+		ipoll_fvresize(&ps->fv, usr_nlen);
+		for (i = ps->usr_len; i < usr_nlen; i++) {
+			ps->fv.fds[i].fd = -1;
+			ps->fv.fds[i].user = NULL;
+			ps->fv.fds[i].mask = 0;
+		}
+		ps->usr_len = usr_nlen;
+	}
+	if (ps->fv.fds[fd].fd >= 0) {
+		ps->fv.fds[fd].user = user;
+		ipet_poll_set(ipd, fd, mask);
+		return 0;
+	}
+	ps->fv.fds[fd].fd = fd;
+	ps->fv.fds[fd].user = user;
+	ps->fv.fds[fd].mask = mask & (IPOLL_IN | IPOLL_OUT | IPOLL_ERR | 
+		IPOLL_EXCLUSIVE);
+
+	ee.events = ipet_events(mask, mask & IPOLL_EXCLUSIVE);
+	ee.data.fd = fd;
+
+	if (epoll_ctl(ps->epfd, EPOLL_CTL_ADD, fd, &ee)) {
+		ps->fv.fds[fd].fd = -1;
+		ps->fv.fds[fd].user = NULL;
+		ps->fv.fds[fd].mask = 0;
+		return -3;
+	}
+	ps->num_fd++;
+
+	return 0;
+}
+
+/* epollet set event mask: re-arming also reports a pending edge */
+static int ipet_poll_set(ipolld ipd, int fd, int mask)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	struct epoll_event ee;
+	int exclusive, retval;
+
+	if ((unsigned int)fd >= (unsigned int)ps->usr_len) return -1;
+	if (fd < 0) return -1;
+	if (ps->fv.fds[fd].fd < 0) return -2;
+
+	/* exclusive flag is decided in ipoll_add and can not be changed */
+	exclusive = ps->fv.fds[fd].mask & IPOLL_EXCLUSIVE;
+	ps->fv.fds[fd].mask = (mask & (IPOLL_IN | IPOLL_OUT | IPOLL_ERR)) | 
+		exclusive;
+
+	ee.events = ipet_events(mask, exclusive);
+	ee.data.fd = fd;
+
+#ifdef EPOLLEXCLUSIVE
+	/* EPOLL_CTL_MOD is not permitted on exclusive fds */
+	if (exclusive) {
+		epoll_ctl(ps->epfd, EPOLL_CTL_DEL, fd, &ee);
+		retval = epoll_ctl(ps->epfd, EPOLL_CTL_ADD, fd, &ee);
+		if (retval) return -10000 + retval;
+		return 0;
+	}
+#endif
+
+	retval = epoll_ctl(ps->epfd, EPOLL_CTL_MOD, fd, &ee);
+	if (retval) return -10000 + retval;
+
+	return 0;
+}
+
+/* epollet query event */
+static int ipet_poll_event(ipolld ipd, int *fd, int *event, void **user)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	struct epoll_event *ee, uu;
+	int revent = 0, n;
+
+	if (ps->cur_res >= ps->results) return -1;
+
+	ee = &ps->mresult[ps->cur_res++];
+	n = ee->data.fd;
+	if (fd) *fd = n;
+
+	if (ee->events & EPOLLIN) revent |= IPOLL_IN;
+	if (ee->events & EPOLLOUT) revent |= IPOLL_OUT;
+	if (ee->events & (EPOLLERR | EPOLLHUP)) revent |= IPOLL_ERR; 
+
+	if (ps->fv.fds[n].fd < 0) {
+		revent = 0;
+		uu.data.fd = n;
+		uu.events = 0;
+		epoll_ctl(ps->epfd, EPOLL_CTL_DEL, n, &uu);
+	}	else {
+		/* masked events need no re-arm: edges do not repeat */
+		revent &= ps->fv.fds[n].mask & (IPOLL_IN | IPOLL_OUT | IPOLL_ERR);
+	}
+
+	if (event) *event = revent;
+	if (user) *user = ps->fv.fds[n].user;
+
+	return 0;
+}
+
+/* epollet query events in batch */
+static int ipet_poll_batch(ipolld ipd, IPOLLEVENT *events, int count)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	int n = 0;
+	while (n < count && ps->cur_res < ps->results) {
+		IPOLLEVENT *e = &events[n];
+		ipet_poll_event(ipd, &e->fd, &e->event, &e->udata);
+		if (e->event != 0) n++;
+	}
+	return n;
+}
+
 #endif
 
+#endif
 
 /*===================================================================*/
-/* POLL DRIVER - DEVPOLL                                             */
+/* POLL DRIVER - URING                                               */
 /*===================================================================*/
-#ifdef IHAVE_DEVPOLL
+/* one-shot IORING_OP_POLL_ADD requests are re-armed after each      */
+/* completion, which keeps the level-triggered semantics of EPOLL.   */
+/* adds, removes, re-arms and the timeout are queued in the SQ and   */
+/* submitted together with the wait by a single io_uring_enter.      */
+/*                                                                   */
+/* completion io (kernel 6.3+): a fd turned by ipoll_recv gets a     */
+/* multishot recv into the provided buffer ring instead of POLLIN,   */
+/* received chunks stay queued on the fd until ipoll_recv_data hands */
+/* them out. ipoll_send copies data into a request which goes to the */
+/* kernel with the next wait, one request in flight per fd.          */
+/*-------------------------------------------------------------------*/
+#ifdef IHAVE_URING
 
-#include <stdio.h>
-#include <sys/types.h>
-#include <sys/time.h>
-#include <sys/queue.h>
-#include <sys/devpoll.h>
 #include <poll.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#ifdef IORING_RECV_MULTISHOT
+#define IURING_COMPLETION
+#endif
+
+/* kernel 6.3+, used to tell the multishot recv is there */
+#ifndef IORING_FEAT_REG_REG_RING
+#define IORING_FEAT_REG_REG_RING	(1U << 13)
+#endif
+
+#ifndef IURING_ENTRIES
+#define IURING_ENTRIES 1024
+#endif
+
+#ifndef IURING_BUFFERS
+#define IURING_BUFFERS 256		/* provided buffers, power of 2 */
+#endif
+
+#ifndef IURING_BUFSIZE
+#define IURING_BUFSIZE 0x4000	/* size of each provided buffer */
+#endif
+
+#define IURING_ARMED	1		/* poll request is in flight */
+#define IURING_QUEUED	2		/* waiting in re-arm list */
 
+/* user data: type(2) generation(30) fd(32), or type(2) send pointer */
+#define IURING_TYPE_POLL	0
+#define IURING_TYPE_RECV	1
+#define IURING_TYPE_SEND	2
+
+#define IURING_GEN_MASK		0x3fffffff
+
+#define IURING_TAG_TIMEOUT	(~((IUINT64)0))
+#define IURING_TAG_REMOVE	(~((IUINT64)0) - 1)
 
 static int ipu_startup(void);
 static int ipu_shutdown(void);
@@ -3118,34 +3454,112 @@ static int ipu_poll_del(ipolld ipd, int fd);
 static int ipu_poll_set(ipolld ipd, int fd, int mask);
 static int ipu_poll_wait(ipolld ipd, int timeval);
 static int ipu_poll_event(ipolld ipd, int *fd, int *event, void **user);
+static int ipu_poll_recv(ipolld ipd, int fd);
+static long ipu_poll_data(ipolld ipd, int fd, void **ptr);
+static int ipu_poll_send(ipolld ipd, int fd, const void * const vecptr[],
+	const long veclen[], int count);
+
+/* harvested event: poll ones are checked against the generation of */
+/* the poll request, completion (io) ones against the fd serial      */
+struct IPURESULT
+{
+	int fd;
+	int event;
+	int gen;
+	int io;
+};
+
+/* send request, the data follows and is freed on completion */
+struct IPUSEND
+{
+	struct IPUSEND *prev;
+	struct IPUSEND *next;
+	int fd;
+	long size;
+};
 
+/* completion io state of a fd */
+struct IPUFILE
+{
+	int recv;					/* turned by ipoll_recv */
+	int armed;					/* multishot recv is in flight */
+	int gen;					/* generation of the recv request */
+	int serial;					/* changed when fd is added or deleted */
+	int head;					/* queued chunks (buffer ids) */
+	int tail;
+	int eof;
+	int error;					/* errno of a failed recv or send */
+	unsigned int round;			/* last wait which reported it */
+	struct IPUSEND *sending;	/* send request in flight */
+};
 
-/* devpoll descriptor */
+/* timespec passed to IORING_OP_TIMEOUT */
+struct IPUTIMESPEC
+{
+	long long tv_sec;
+	long long tv_nsec;
+};
+
+/* io_uring device structure */
 typedef struct
 {
 	struct IPOLLFV fv;
-	int dpfd;
+	int ring_fd;
 	int num_fd;
-	int num_chg;
-	int max_fd;
-	int max_chg;
+	int usr_len;
+	unsigned int features;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int sq_entries;
+	unsigned int sq_local;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_size;
+	size_t cq_size;
+	size_t sqe_size;
+	int num_pending;
+	int max_pending;
+	int *pending;
 	int results;
 	int cur_res;
-	int usr_len;
-	int limit;
-	struct pollfd *mresult;
-	struct pollfd *mchange;
+	int max_res;
+	struct IPURESULT *mresult;
+	struct IPUFILE *files;
+	int num_unread;
+	int max_unread;
+	int *unread;
+	unsigned int round;
+	struct IPVECTOR vpending;
 	struct IPVECTOR vresult;
-	struct IPVECTOR vchange;
-}	IPD_DEVPOLL;
-
-
-/* devpoll driver */
-struct IPOLL_DRIVER IPOLL_DEVPOLL = {
-	sizeof (IPD_DEVPOLL),	
-	IDEVICE_DEVPOLL,
-	100,
-	"DEVPOLL",
+	struct IPVECTOR vfiles;
+	struct IPVECTOR vunread;
+	struct IPUTIMESPEC ts;
+	int cio;					/* completion io is available */
+	int inflight;				/* recv and send requests in flight */
+	struct IPUSEND sends;		/* send requests in flight */
+#ifdef IURING_COMPLETION
+	struct io_uring_buf_ring *br;
+	unsigned short br_tail;
+	int last;					/* chunk returned by ipoll_recv_data */
+	char *bufs;
+	int next[IURING_BUFFERS];	/* next chunk of the same fd */
+	int size[IURING_BUFFERS];	/* bytes in the chunk */
+#endif
+}	IPD_URING;
+
+/* io_uring poll descriptor */
+struct IPOLL_DRIVER IPOLL_URING = {
+	sizeof (IPD_URING),	
+	IDEVICE_URING,
+	80,
+	"URING",
 	ipu_startup,
 	ipu_shutdown,
 	ipu_init_pd,
@@ -3154,7 +3568,11 @@ struct IPOLL_DRIVER IPOLL_DEVPOLL = {
 	ipu_poll_del,
 	ipu_poll_set,
 	ipu_poll_wait,
-	ipu_poll_event
+	ipu_poll_event,
+	NULL,
+	ipu_poll_recv,
+	ipu_poll_data,
+	ipu_poll_send
 };
 
 
@@ -3162,55 +3580,1098 @@ struct IPOLL_DRIVER IPOLL_DEVPOLL = {
 #undef PSTRUCT
 #endif
 
-#define PSTRUCT IPD_DEVPOLL
-
+#define PSTRUCT IPD_URING
 
-/* grow events */
-static int ipu_grow(PSTRUCT *ps, int size_fd, int size_chg)
+/* io_uring system calls */
+static int ipu_setup(unsigned int entries, struct io_uring_params *p)
 {
-	int r;
-	if (size_fd >= 0) {
-		r = ipv_resize(&ps->vresult, size_fd * sizeof(struct pollfd) * 2);
-		ps->mresult = (struct pollfd*)ps->vresult.data;
-		ps->max_fd = size_fd;
-		if (r) return -1;
-	}
-	if (size_chg >= 0) {
-		r = ipv_resize(&ps->vchange, size_chg * sizeof(struct pollfd));
-		ps->mchange = (struct pollfd*)ps->vchange.data;
-		ps->max_chg= size_chg;
-		if (r) return -2;
-	}
-	return 0;
+	return (int)syscall(__NR_io_uring_setup, entries, p);
 }
 
-/* startup devpoll driver */
-static int ipu_startup(void)
+static int ipu_enter(int fd, unsigned int submit, unsigned int wait, 
+	unsigned int flags)
 {
-	int fd, flags = O_RDWR;
-#ifdef O_CLOEXEC
-	flags |= O_CLOEXEC;
-#endif
-	fd = open("/dev/poll", flags);
-	if (fd < 0) return -1;
-#if (!defined(O_CLOEXEC)) && defined(FD_CLOEXEC)
-	if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
-		close(fd);
-		return -2;
-	}
-#endif
-	close(fd);
-	return 0;
+	return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, 
+		NULL, 0);
 }
 
-/* shutdown device */
-static int ipu_shutdown(void)
+/* map rings */
+static int ipu_ring_init(PSTRUCT *ps, unsigned int entries)
 {
-	return 0;
-}
+	struct io_uring_params p;
+	char *sq, *cq;
 
-/* initialize devpoll obj */
-static int ipu_init_pd(ipolld ipd, int param)
+	memset(&p, 0, sizeof(p));
+	ps->sq_ptr = MAP_FAILED;
+	ps->cq_ptr = MAP_FAILED;
+	ps->sqes = (struct io_uring_sqe*)MAP_FAILED;
+
+	ps->ring_fd = ipu_setup(entries, &p);
+	if (ps->ring_fd < 0) return -1000 - errno;
+
+	/* overflowed completions must not be dropped, or fds get lost */
+	if ((p.features & IORING_FEAT_NODROP) == 0) {
+		close(ps->ring_fd);
+		ps->ring_fd = -1;
+		return -1;
+	}
+
+	ps->features = p.features;
+	ps->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ps->cq_size = p.cq_off.cqes + p.cq_entries * 
+		sizeof(struct io_uring_cqe);
+	ps->sqe_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ps->sq_ptr = mmap(NULL, ps->sq_size, PROT_READ | PROT_WRITE, 
+		MAP_SHARED | MAP_POPULATE, ps->ring_fd, IORING_OFF_SQ_RING);
+	ps->cq_ptr = mmap(NULL, ps->cq_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ps->ring_fd, IORING_OFF_CQ_RING);
+	ps->sqes = (struct io_uring_sqe*)mmap(NULL, ps->sqe_size, 
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, 
+		ps->ring_fd, IORING_OFF_SQES);
+
+	if (ps->sq_ptr == MAP_FAILED || ps->cq_ptr == MAP_FAILED ||
+		(void*)ps->sqes == MAP_FAILED) {
+		return -2;
+	}
+
+	sq = (char*)ps->sq_ptr;
+	cq = (char*)ps->cq_ptr;
+
+	ps->sq_head = (unsigned int*)(sq + p.sq_off.head);
+	ps->sq_tail = (unsigned int*)(sq + p.sq_off.tail);
+	ps->sq_mask = (unsigned int*)(sq + p.sq_off.ring_mask);
+	ps->sq_array = (unsigned int*)(sq + p.sq_off.array);
+	ps->sq_entries = p.sq_entries;
+	ps->sq_local = *ps->sq_tail;
+	ps->cq_head = (unsigned int*)(cq + p.cq_off.head);
+	ps->cq_tail = (unsigned int*)(cq + p.cq_off.tail);
+	ps->cq_mask = (unsigned int*)(cq + p.cq_off.ring_mask);
+	ps->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+	return 0;
+}
+
+/* unmap rings */
+static void ipu_ring_destroy(PSTRUCT *ps)
+{
+	if ((void*)ps->sqes != MAP_FAILED) munmap(ps->sqes, ps->sqe_size);
+	if (ps->cq_ptr != MAP_FAILED) munmap(ps->cq_ptr, ps->cq_size);
+	if (ps->sq_ptr != MAP_FAILED) munmap(ps->sq_ptr, ps->sq_size);
+	if (ps->ring_fd >= 0) close(ps->ring_fd);
+	ps->sqes = (struct io_uring_sqe*)MAP_FAILED;
+	ps->cq_ptr = MAP_FAILED;
+	ps->sq_ptr = MAP_FAILED;
+	ps->ring_fd = -1;
+}
+
+/* publish queued sqes and enter kernel */
+static int ipu_submit(PSTRUCT *ps, unsigned int wait, unsigned int flags)
+{
+	unsigned int submit;
+	int retval;
+	__sync_synchronize();
+	*ps->sq_tail = ps->sq_local;
+	__sync_synchronize();
+	submit = ps->sq_local - *ps->sq_head;
+	if (submit == 0 && wait == 0 && flags == 0) return 0;
+	retval = ipu_enter(ps->ring_fd, submit, wait, flags);
+	if (retval < 0) return -1000 - errno;
+	return retval;
+}
+
+/* get a free sqe, submit pending ones when sq is full */
+static struct io_uring_sqe *ipu_get_sqe(PSTRUCT *ps)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int index;
+	__sync_synchronize();
+	if (ps->sq_local - *ps->sq_head >= ps->sq_entries) {
+		ipu_submit(ps, 0, 0);
+		__sync_synchronize();
+		if (ps->sq_local - *ps->sq_head >= ps->sq_entries) 
+			return NULL;
+	}
+	index = ps->sq_local & *ps->sq_mask;
+	sqe = &ps->sqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ps->sq_array[index] = index;
+	ps->sq_local++;
+	return sqe;
+}
+
+/* poll request user data: generation and fd */
+static IUINT64 ipu_tag(PSTRUCT *ps, int fd)
+{
+	IUINT64 gen = (IUINT64)(ps->fv.fds[fd].index & IURING_GEN_MASK);
+	return (gen << 32) | (IUINT64)((unsigned int)fd);
+}
+
+/* recv request user data: type, generation and fd */
+static IUINT64 ipu_tag_recv(PSTRUCT *ps, int fd)
+{
+	IUINT64 gen = (IUINT64)(ps->files[fd].gen & IURING_GEN_MASK);
+	return (((IUINT64)IURING_TYPE_RECV) << 62) | (gen << 32) |
+		(IUINT64)((unsigned int)fd);
+}
+
+/* cancel the in-flight poll request and invalidate its completion */
+static int ipu_cancel(PSTRUCT *ps, int fd)
+{
+	struct IPOLLFD *pfd = &ps->fv.fds[fd];
+	if (pfd->event & IURING_ARMED) {
+		struct io_uring_sqe *sqe = ipu_get_sqe(ps);
+		if (sqe == NULL) return -1;
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = ipu_tag(ps, fd);
+		sqe->user_data = IURING_TAG_REMOVE;
+		pfd->event &= ~IURING_ARMED;
+	}
+	pfd->index = (pfd->index + 1) & IURING_GEN_MASK;
+	return 0;
+}
+
+/* cancel the multishot recv, chunks already queued are kept */
+static int ipu_cancel_recv(PSTRUCT *ps, int fd)
+{
+	struct IPUFILE *file = &ps->files[fd];
+	if (file->armed) {
+		struct io_uring_sqe *sqe = ipu_get_sqe(ps);
+		if (sqe == NULL) return -1;
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = ipu_tag_recv(ps, fd);
+		sqe->user_data = IURING_TAG_REMOVE;
+		file->armed = 0;
+	}
+	file->gen = (file->gen + 1) & IURING_GEN_MASK;
+	return 0;
+}
+
+/* put fd into re-arm list */
+static int ipu_queue(PSTRUCT *ps, int fd)
+{
+	if (ps->fv.fds[fd].event & IURING_QUEUED) return 0;
+	if (ps->num_pending >= ps->max_pending) {
+		int newsize = (ps->max_pending <= 0)? 16 : ps->max_pending * 2;
+		if (ipv_resize(&ps->vpending, newsize * sizeof(int)))
+			return -1;
+		ps->pending = (int*)ps->vpending.data;
+		ps->max_pending = newsize;
+	}
+	ps->pending[ps->num_pending++] = fd;
+	ps->fv.fds[fd].event |= IURING_QUEUED;
+	return 0;
+}
+
+/* append a harvested event */
+static int ipu_result(PSTRUCT *ps, int fd, int event, int gen, int io)
+{
+	struct IPURESULT *res;
+	if (ps->results >= ps->max_res) {
+		int newsize = (ps->max_res <= 0)? 64 : ps->max_res * 2;
+		if (ipv_resize(&ps->vresult, newsize * sizeof(struct IPURESULT)))
+			return -1;
+		ps->mresult = (struct IPURESULT*)ps->vresult.data;
+		ps->max_res = newsize;
+	}
+	res = &ps->mresult[ps->results++];
+	res->fd = fd;
+	res->event = event;
+	res->gen = gen;
+	res->io = io;
+	return 0;
+}
+
+/* report IPOLL_IN once per wait for a fd which has something to read */
+static void ipu_report(PSTRUCT *ps, int fd)
+{
+	struct IPUFILE *file = &ps->files[fd];
+	if (file->round == ps->round) return;
+	if (ipu_result(ps, fd, IPOLL_IN, file->serial, 1) == 0)
+		file->round = ps->round;
+}
+
+/* check if a completion fd has chunks, eof or error to read */
+static int ipu_readable(PSTRUCT *ps, int fd)
+{
+	struct IPUFILE *file = &ps->files[fd];
+	return (file->head >= 0 || file->eof || file->error)? 1 : 0;
+}
+
+/* remember a readable fd to report it again in this wait */
+static void ipu_unread(PSTRUCT *ps, int fd)
+{
+	if (ps->files[fd].recv == 0 || ipu_readable(ps, fd) == 0) return;
+	if ((ps->fv.fds[fd].mask & IPOLL_IN) == 0) return;
+	if (ps->num_unread >= ps->max_unread) {
+		int newsize = (ps->max_unread <= 0)? 16 : ps->max_unread * 2;
+		if (ipv_resize(&ps->vunread, newsize * sizeof(int))) return;
+		ps->unread = (int*)ps->vunread.data;
+		ps->max_unread = newsize;
+	}
+	ps->unread[ps->num_unread++] = fd;
+}
+
+/* poll events of a fd, POLLIN and errors come from the recv request */
+static unsigned int ipu_events(PSTRUCT *ps, int fd)
+{
+	int mask = ps->fv.fds[fd].mask;
+	unsigned int events = 0;
+	if (ps->files[fd].recv && (mask & IPOLL_IN)) {
+		mask &= ~(IPOLL_IN | IPOLL_ERR);
+	}
+	if (mask & IPOLL_IN) events |= POLLIN;
+	if (mask & IPOLL_OUT) events |= POLLOUT;
+	if (mask & IPOLL_ERR) events |= POLLERR | POLLHUP;
+	return events;
+}
+
+/* arm the poll request of fd, returns -1 if sq is full */
+static int ipu_arm_poll(PSTRUCT *ps, int fd)
+{
+	struct IPOLLFD *pfd = &ps->fv.fds[fd];
+	struct io_uring_sqe *sqe;
+	unsigned int events;
+	if (pfd->event & IURING_ARMED) return 0;
+	events = ipu_events(ps, fd);
+	if (events == 0) return 0;
+	sqe = ipu_get_sqe(ps);
+	if (sqe == NULL) return -1;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll_events = (unsigned short)events;
+	sqe->user_data = ipu_tag(ps, fd);
+	pfd->event |= IURING_ARMED;
+	return 0;
+}
+
+/* arm the multishot recv of fd, returns -1 if sq is full */
+static int ipu_arm_recv(PSTRUCT *ps, int fd)
+{
+#ifdef IURING_COMPLETION
+	struct IPUFILE *file = &ps->files[fd];
+	struct io_uring_sqe *sqe;
+	if (file->recv == 0 || file->armed || file->eof || file->error)
+		return 0;
+	if ((ps->fv.fds[fd].mask & IPOLL_IN) == 0) return 0;
+	sqe = ipu_get_sqe(ps);
+	if (sqe == NULL) return -1;
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->user_data = ipu_tag_recv(ps, fd);
+	file->armed = 1;
+	ps->inflight++;
+#endif
+	return 0;
+}
+
+#ifdef IURING_COMPLETION
+/* io_uring_register */
+static int ipu_register(int fd, unsigned int opcode, void *arg,
+	unsigned int n)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, n);
+}
+
+/* give a buffer back to the provided buffer ring */
+static void ipu_recycle(PSTRUCT *ps, int bid)
+{
+	struct io_uring_buf *buf;
+	buf = &ps->br->bufs[ps->br_tail & (IURING_BUFFERS - 1)];
+	buf->addr = (unsigned long)(ps->bufs + (size_t)bid * IURING_BUFSIZE);
+	buf->len = IURING_BUFSIZE;
+	buf->bid = (unsigned short)bid;
+	ps->br_tail++;
+	__sync_synchronize();
+	ps->br->tail = ps->br_tail;
+}
+
+/* recycle the chunks queued on fd */
+static void ipu_discard(PSTRUCT *ps, int fd)
+{
+	struct IPUFILE *file = &ps->files[fd];
+	while (file->head >= 0) {
+		int bid = file->head;
+		file->head = ps->next[bid];
+		ipu_recycle(ps, bid);
+	}
+	file->tail = -1;
+}
+
+/* setup provided buffer ring (group 0), needs kernel 6.3+ for the */
+/* multishot recv as well, which can't be probed on its own        */
+static int ipu_buffers_init(PSTRUCT *ps)
+{
+	struct io_uring_buf_reg reg;
+	size_t size = IURING_BUFFERS * sizeof(struct io_uring_buf);
+	int i;
+
+	ps->br = NULL;
+	ps->bufs = NULL;
+	ps->last = -1;
+
+	if ((ps->features & IORING_FEAT_REG_REG_RING) == 0) return -1;
+
+	/* mapped, so late writes of the kernel never hit the heap */
+	ps->br = (struct io_uring_buf_ring*)mmap(NULL, size,
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	ps->bufs = (char*)mmap(NULL, (size_t)IURING_BUFFERS * IURING_BUFSIZE,
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if ((void*)ps->br == MAP_FAILED) ps->br = NULL;
+	if ((void*)ps->bufs == MAP_FAILED) ps->bufs = NULL;
+	if (ps->br == NULL || ps->bufs == NULL) return -2;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long)ps->br;
+	reg.ring_entries = IURING_BUFFERS;
+	reg.bgid = 0;
+
+	if (ipu_register(ps->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1))
+		return -3;
+
+	ps->br_tail = 0;
+	for (i = 0; i < IURING_BUFFERS; i++) ipu_recycle(ps, i);
+
+	return 0;
+}
+
+/* unmap provided buffers, the ring must be closed already */
+static void ipu_buffers_destroy(PSTRUCT *ps)
+{
+	if (ps->br) {
+		munmap(ps->br, IURING_BUFFERS * sizeof(struct io_uring_buf));
+	}
+	if (ps->bufs) {
+		munmap(ps->bufs, (size_t)IURING_BUFFERS * IURING_BUFSIZE);
+	}
+	ps->br = NULL;
+	ps->bufs = NULL;
+}
+
+/* recv completion: queue the chunk on its fd */
+static void ipu_on_recv(PSTRUCT *ps, const struct io_uring_cqe *cqe)
+{
+	int fd = (int)(cqe->user_data & 0xffffffff);
+	int gen = (int)((cqe->user_data >> 32) & IURING_GEN_MASK);
+	int more = (cqe->flags & IORING_CQE_F_MORE)? 1 : 0;
+	int bid = -1;
+	struct IPUFILE *file;
+
+	if (cqe->flags & IORING_CQE_F_BUFFER)
+		bid = (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+	if (more == 0) ps->inflight--;
+
+	if (fd < 0 || fd >= ps->usr_len || ps->fv.fds[fd].fd < 0 ||
+		ps->files[fd].gen != gen) {
+		/* cancelled, or the fd is gone */
+		if (bid >= 0) ipu_recycle(ps, bid);
+		return;
+	}
+
+	file = &ps->files[fd];
+	if (more == 0) file->armed = 0;
+
+	if (cqe->res > 0 && bid >= 0) {
+		ps->next[bid] = -1;
+		ps->size[bid] = cqe->res;
+		if (file->tail >= 0) ps->next[file->tail] = bid;
+		else file->head = bid;
+		file->tail = bid;
+	}
+	else {
+		if (bid >= 0) ipu_recycle(ps, bid);
+		if (cqe->res == 0) file->eof = 1;
+		/* out of buffers: re-armed after the chunks are read */
+		else if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+			file->error = -cqe->res;
+	}
+
+	if (more == 0) ipu_queue(ps, fd);
+	if (ipu_readable(ps, fd)) ipu_report(ps, fd);
+}
+
+/* send completion: IPOLL_OUT, or IPOLL_IN with the error to read */
+static void ipu_on_send(PSTRUCT *ps, const struct io_uring_cqe *cqe)
+{
+	IUINT64 ptr = cqe->user_data & ~(((IUINT64)3) << 62);
+	struct IPUSEND *s = (struct IPUSEND*)((size_t)ptr);
+	int fd = s->fd;
+
+	ps->inflight--;
+
+	if (fd >= 0 && fd < ps->usr_len && ps->fv.fds[fd].fd >= 0 &&
+		ps->files[fd].sending == s) {
+		struct IPUFILE *file = &ps->files[fd];
+		file->sending = NULL;
+		if ((long)cqe->res != s->size) {
+			file->error = (cqe->res < 0)? -cqe->res : EPIPE;
+			ipu_report(ps, fd);
+		}
+		ipu_result(ps, fd, IPOLL_OUT, file->serial, 1);
+	}
+
+	s->prev->next = s->next;
+	s->next->prev = s->prev;
+	ikfree(s);
+}
+
+/* cancel everything and wait until the kernel is done with buffers */
+static void ipu_drain(PSTRUCT *ps)
+{
+	struct io_uring_sqe *sqe;
+	int retry;
+	if (ps->inflight <= 0) return;
+	sqe = ipu_get_sqe(ps);
+	if (sqe == NULL) return;
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+	sqe->user_data = IURING_TAG_REMOVE;
+	for (retry = 0; ps->inflight > 0 && retry < 1000; retry++) {
+		unsigned int head, tail;
+		if (ipu_submit(ps, 1, IORING_ENTER_GETEVENTS) < 0) {
+			if (errno != EINTR) break;
+		}
+		__sync_synchronize();
+		head = *ps->cq_head;
+		tail = *ps->cq_tail;
+		for (; head != tail; head++) {
+			struct io_uring_cqe *cqe = &ps->cqes[head & *ps->cq_mask];
+			int type = (int)(cqe->user_data >> 62);
+			if (cqe->user_data == IURING_TAG_TIMEOUT ||
+				cqe->user_data == IURING_TAG_REMOVE)
+				continue;
+			if (type == IURING_TYPE_RECV) {
+				if ((cqe->flags & IORING_CQE_F_MORE) == 0) ps->inflight--;
+			}
+			else if (type == IURING_TYPE_SEND) {
+				ipu_on_send(ps, cqe);
+			}
+		}
+		__sync_synchronize();
+		*ps->cq_head = head;
+	}
+}
+#endif
+
+/* io_uring startup */
+static int ipu_startup(void)
+{
+	PSTRUCT ps;
+	int retval = ipu_ring_init(&ps, 4);
+	if (ps.ring_fd >= 0) ipu_ring_destroy(&ps);
+	return retval;
+}
+
+/* io_uring shutdown */
+static int ipu_shutdown(void)
+{
+	return 0;
+}
+
+/* io_uring init poll descriptor */
+static int ipu_init_pd(ipolld ipd, int param)
+{
+	PSTRUCT *ps = PDESC(ipd);
+
+	if (ipu_ring_init(ps, IURING_ENTRIES) != 0) {
+		if (ps->ring_fd >= 0) ipu_ring_destroy(ps);
+		return -1;
+	}
+
+#ifdef FD_CLOEXEC
+	fcntl(ps->ring_fd, F_SETFD, FD_CLOEXEC);
+#endif
+
+	ipv_init(&ps->vpending);
+	ipv_init(&ps->vresult);
+	ipv_init(&ps->vfiles);
+	ipv_init(&ps->vunread);
+	ipoll_fvinit(&ps->fv);
+
+	ps->num_fd = 0;
+	ps->usr_len = 0;
+	ps->num_pending = 0;
+	ps->max_pending = 0;
+	ps->pending = NULL;
+	ps->results = 0;
+	ps->cur_res = 0;
+	ps->max_res = 0;
+	ps->mresult = NULL;
+	ps->files = NULL;
+	ps->num_unread = 0;
+	ps->max_unread = 0;
+	ps->unread = NULL;
+	ps->round = 0;
+	ps->cio = 0;
+	ps->inflight = 0;
+	ps->sends.prev = &ps->sends;
+	ps->sends.next = &ps->sends;
+
+#ifdef IURING_COMPLETION
+	/* without it the device still works as a poll device */
+	if (ipu_buffers_init(ps) == 0) ps->cio = 1;
+#endif
+
+	return 0;
+}
+
+/* io_uring destroy descriptor */
+static int ipu_destroy_pd(ipolld ipd)
+{
+	PSTRUCT *ps = PDESC(ipd);
+#ifdef IURING_COMPLETION
+	ipu_drain(ps);
+#endif
+	ipv_destroy(&ps->vpending);
+	ipv_destroy(&ps->vresult);
+	ipv_destroy(&ps->vfiles);
+	ipv_destroy(&ps->vunread);
+	ipoll_fvdestroy(&ps->fv);
+	ipu_ring_destroy(ps);
+	while (ps->sends.next != &ps->sends) {
+		struct IPUSEND *s = ps->sends.next;
+		ps->sends.next = s->next;
+		ikfree(s);
+	}
+#ifdef IURING_COMPLETION
+	ipu_buffers_destroy(ps);
+#endif
+	return 0;
+}
+
+/* io_uring add file */
+static int ipu_poll_add(ipolld ipd, int fd, int mask, void *user)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	struct IPUFILE *file;
+	int usr_nlen, i;
+
+	if (fd < 0) return -1;
+	if (fd >= ps->usr_len) {
+		usr_nlen = fd + 128;
+		if (ipoll_fvresize(&ps->fv, usr_nlen)) return -1;
+		if (ipv_resize(&ps->vfiles, usr_nlen * sizeof(struct IPUFILE)))
+			return -1;
+		ps->files = (struct IPUFILE*)ps->vfiles.data;
+		for (i = ps->usr_len; i < usr_nlen; i++) {
+			ps->fv.fds[i].fd = -1;
+			ps->fv.fds[i].user = NULL;
+			ps->fv.fds[i].mask = 0;
+			ps->fv.fds[i].event = 0;
+			ps->fv.fds[i].index = 0;
+			memset(&ps->files[i], 0, sizeof(struct IPUFILE));
+			ps->files[i].head = -1;
+			ps->files[i].tail = -1;
+		}
+		ps->usr_len = usr_nlen;
+	}
+	if (ps->fv.fds[fd].fd >= 0) {
+		ps->fv.fds[fd].user = user;
+		ipu_poll_set(ipd, fd, mask);
+		return 0;
+	}
+	ps->fv.fds[fd].fd = fd;
+	ps->fv.fds[fd].user = user;
+	ps->fv.fds[fd].mask = mask & (IPOLL_IN | IPOLL_OUT | IPOLL_ERR);
+	ps->fv.fds[fd].event &= IURING_QUEUED;
+
+	file = &ps->files[fd];
+	file->recv = 0;
+	file->armed = 0;
+	file->eof = 0;
+	file->error = 0;
+	file->sending = NULL;
+	file->serial++;
+
+	if (ipu_queue(ps, fd)) {
+		ps->fv.fds[fd].fd = -1;
+		ps->fv.fds[fd].user = NULL;
+		ps->fv.fds[fd].mask = 0;
+		return -3;
+	}
+	ps->num_fd++;
+
+	return 0;
+}
+
+/* io_uring delete file */
+static int ipu_poll_del(ipolld ipd, int fd)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	struct IPUFILE *file;
+
+	if (ps->num_fd <= 0) return -1;
+	if ((unsigned int)fd >= (unsigned int)ps->usr_len) return -2;
+	if (ps->fv.fds[fd].fd < 0) return -2;
+
+	ipu_cancel(ps, fd);
+	ipu_cancel_recv(ps, fd);
+	ps->num_fd--;
+	ps->fv.fds[fd].fd = -1;
+	ps->fv.fds[fd].user = NULL;
+	ps->fv.fds[fd].mask = 0;
+
+	/* the caller closes fd next: a queued send must reach the kernel */
+	/* before that, it is freed by its completion later.              */
+	file = &ps->files[fd];
+	if (file->sending) ipu_submit(ps, 0, 0);
+#ifdef IURING_COMPLETION
+	ipu_discard(ps, fd);
+#endif
+	file->recv = 0;
+	file->eof = 0;
+	file->error = 0;
+	file->sending = NULL;
+	file->serial++;
+
+	return 0;
+}
+
+/* io_uring set event mask */
+static int ipu_poll_set(ipolld ipd, int fd, int mask)
+{
+	PSTRUCT *ps = PDESC(ipd);
+
+	if ((unsigned int)fd >= (unsigned int)ps->usr_len) return -1;
+	if (fd < 0) return -1;
+	if (ps->fv.fds[fd].fd < 0) return -2;
+
+	mask &= IPOLL_IN | IPOLL_OUT | IPOLL_ERR;
+
+	if (ps->fv.fds[fd].mask == mask && 
+		(ps->fv.fds[fd].event & (IURING_ARMED | IURING_QUEUED)))
+		return 0;
+
+	if (ipu_cancel(ps, fd)) return -3;
+	if ((mask & IPOLL_IN) == 0 && ipu_cancel_recv(ps, fd)) return -3;
+	ps->fv.fds[fd].mask = mask;
+	if (ipu_queue(ps, fd)) return -4;
+
+	return 0;
+}
+
+/* io_uring wait */
+static int ipu_poll_wait(ipolld ipd, int timeval)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	struct io_uring_sqe *sqe;
+	unsigned int head, tail, wait;
+	int i, remain = 0, retval;
+
+#ifdef IURING_COMPLETION
+	if (ps->last >= 0) {
+		ipu_recycle(ps, ps->last);
+		ps->last = -1;
+	}
+#endif
+
+	/* completion fds reported last time and still not read */
+	ps->num_unread = 0;
+	for (i = 0; i < ps->results; i++) {
+		struct IPURESULT *res = &ps->mresult[i];
+		int fd = res->fd;
+		if (res->io == 0 || ps->fv.fds[fd].fd < 0) continue;
+		if (ps->files[fd].serial != res->gen) continue;
+		ipu_unread(ps, fd);
+	}
+
+	/* arm poll and recv requests */
+	for (i = 0; i < ps->num_pending; i++) {
+		int fd = ps->pending[i];
+		struct IPOLLFD *pfd = &ps->fv.fds[fd];
+		pfd->event &= ~IURING_QUEUED;
+		if (pfd->fd < 0) continue;
+		ipu_unread(ps, fd);
+		if (ipu_arm_recv(ps, fd) != 0 || ipu_arm_poll(ps, fd) != 0) {
+			/* sq is full, keep the rest for the next time */
+			remain = ps->num_pending - i;
+			memmove(ps->pending, ps->pending + i, remain * sizeof(int));
+			pfd->event |= IURING_QUEUED;
+			break;
+		}
+	}
+
+	ps->num_pending = remain;
+
+	__sync_synchronize();
+	wait = (*ps->cq_head != *ps->cq_tail || timeval == 0)? 0 : 1;
+	if (ps->num_unread > 0) wait = 0;
+
+	if (wait && timeval > 0) {
+		sqe = ipu_get_sqe(ps);
+		if (sqe != NULL) {
+			ps->ts.tv_sec = timeval / 1000;
+			ps->ts.tv_nsec = (timeval % 1000) * 1000000;
+			sqe->opcode = IORING_OP_TIMEOUT;
+			sqe->fd = -1;
+			sqe->addr = (unsigned long)&ps->ts;
+			sqe->len = 1;
+			sqe->off = 1;
+			sqe->user_data = IURING_TAG_TIMEOUT;
+		}	else {
+			wait = 0;
+		}
+	}
+
+	retval = ipu_submit(ps, wait, IORING_ENTER_GETEVENTS);
+	if (retval < 0 && retval != -1000 - EINTR && 
+		retval != -1000 - ETIME && retval != -1000 - EBUSY) {
+		ps->results = 0;
+		ps->cur_res = 0;
+		return -1;
+	}
+
+	/* harvest completions */
+	ps->results = 0;
+	ps->cur_res = 0;
+	ps->round++;
+
+	for (i = 0; i < ps->num_unread; i++) {
+		ipu_report(ps, ps->unread[i]);
+	}
+
+	__sync_synchronize();
+	head = *ps->cq_head;
+	tail = *ps->cq_tail;
+
+	for (; head != tail; head++) {
+		struct io_uring_cqe *cqe = &ps->cqes[head & *ps->cq_mask];
+		IUINT64 tag = cqe->user_data;
+		struct IPOLLFD *pfd;
+		int revent = 0, fd, gen;
+		if (tag == IURING_TAG_TIMEOUT || tag == IURING_TAG_REMOVE)
+			continue;
+	#ifdef IURING_COMPLETION
+		if ((int)(tag >> 62) == IURING_TYPE_RECV) {
+			ipu_on_recv(ps, cqe);
+			continue;
+		}
+		if ((int)(tag >> 62) == IURING_TYPE_SEND) {
+			ipu_on_send(ps, cqe);
+			continue;
+		}
+	#endif
+		fd = (int)(tag & 0xffffffff);
+		gen = (int)((tag >> 32) & IURING_GEN_MASK);
+		if (fd < 0 || fd >= ps->usr_len) continue;
+		pfd = &ps->fv.fds[fd];
+		if (pfd->fd < 0 || pfd->index != gen) continue;
+		pfd->event &= ~IURING_ARMED;
+		if (cqe->res < 0) {
+			if (cqe->res == -ECANCELED) continue;
+			revent = IPOLL_ERR;
+		}	else {
+			if (cqe->res & POLLIN) revent |= IPOLL_IN;
+			if (cqe->res & POLLOUT) revent |= IPOLL_OUT;
+			if (cqe->res & (POLLERR | POLLHUP | POLLNVAL)) 
+				revent |= IPOLL_ERR;
+		}
+		if (ipu_result(ps, fd, revent, gen, 0) != 0) break;
+		ipu_queue(ps, fd);
+	}
+
+	__sync_synchronize();
+	*ps->cq_head = head;
+
+	return ps->results;
+}
+
+/* io_uring query event */
+static int ipu_poll_event(ipolld ipd, int *fd, int *event, void **user)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	struct IPURESULT *res;
+	int revent, n;
+
+	if (ps->cur_res >= ps->results) return -1;
+
+	res = &ps->mresult[ps->cur_res++];
+	n = res->fd;
+	if (fd) *fd = n;
+
+	revent = res->event;
+
+	if (ps->fv.fds[n].fd < 0) {
+		revent = 0;
+	}
+	else if (res->io) {
+		/* send completions are reported whatever the mask is */
+		if (ps->files[n].serial != res->gen) revent = 0;
+		else if ((ps->fv.fds[n].mask & IPOLL_IN) == 0) revent &= ~IPOLL_IN;
+	}
+	else if (ps->fv.fds[n].index != res->gen) {
+		revent = 0;
+	}	else {
+		revent &= ps->fv.fds[n].mask;
+	}
+
+	if (event) *event = revent;
+	if (user) *user = ps->fv.fds[n].user;
+
+	return 0;
+}
+
+/* io_uring: turn fd to completion recv */
+static int ipu_poll_recv(ipolld ipd, int fd)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	struct IPUFILE *file;
+
+	if (ps->cio == 0) return -1;
+	if ((unsigned int)fd >= (unsigned int)ps->usr_len) return -2;
+	if (ps->fv.fds[fd].fd < 0) return -2;
+
+	file = &ps->files[fd];
+	if (file->recv) return 0;
+
+	/* the armed poll request may still wait for POLLIN */
+	if (ipu_cancel(ps, fd)) return -3;
+	file->recv = 1;
+	if (ipu_queue(ps, fd)) return -3;
+
+	return 0;
+}
+
+/* io_uring: next chunk received on fd */
+static long ipu_poll_data(ipolld ipd, int fd, void **ptr)
+{
+#ifdef IURING_COMPLETION
+	PSTRUCT *ps = PDESC(ipd);
+	struct IPUFILE *file;
+
+	if (ps->last >= 0) {
+		ipu_recycle(ps, ps->last);
+		ps->last = -1;
+	}
+
+	if ((unsigned int)fd >= (unsigned int)ps->usr_len) return -1;
+	if (ps->fv.fds[fd].fd < 0 || ps->cio == 0) return -1;
+
+	file = &ps->files[fd];
+
+	if (file->head >= 0) {
+		int bid = file->head;
+		file->head = ps->next[bid];
+		if (file->head < 0) file->tail = -1;
+		ps->last = bid;
+		ptr[0] = ps->bufs + (size_t)bid * IURING_BUFSIZE;
+		return ps->size[bid];
+	}
+
+	if (file->error) {
+		errno = file->error;
+		return -2;
+	}
+
+	if (file->eof) return 0;
+#endif
+	return -1;
+}
+
+/* io_uring: queue a send of fd */
+static int ipu_poll_send(ipolld ipd, int fd, const void * const vecptr[],
+	const long veclen[], int count)
+{
+#ifdef IURING_COMPLETION
+	PSTRUCT *ps = PDESC(ipd);
+	struct io_uring_sqe *sqe;
+	struct IPUFILE *file;
+	struct IPUSEND *s;
+	long size = 0;
+	char *data;
+	int i;
+
+	if (ps->cio == 0) return -1;
+	if ((unsigned int)fd >= (unsigned int)ps->usr_len ||
+		ps->fv.fds[fd].fd < 0) {
+		errno = EBADF;
+		return -3;
+	}
+
+	file = &ps->files[fd];
+	if (file->sending) return -2;
+
+	if (file->error) {
+		errno = file->error;
+		return -3;
+	}
+
+	for (i = 0; i < count; i++) size += veclen[i];
+
+	s = (struct IPUSEND*)ikmalloc(sizeof(struct IPUSEND) + size);
+	if (s == NULL) {
+		errno = ENOMEM;
+		return -3;
+	}
+
+	sqe = ipu_get_sqe(ps);
+	if (sqe == NULL) {
+		ikfree(s);
+		errno = EAGAIN;
+		return -3;
+	}
+
+	data = (char*)(s + 1);
+	for (i = 0; i < count; i++) {
+		memcpy(data, vecptr[i], veclen[i]);
+		data += veclen[i];
+	}
+
+	s->fd = fd;
+	s->size = size;
+	s->next = &ps->sends;
+	s->prev = ps->sends.prev;
+	ps->sends.prev->next = s;
+	ps->sends.prev = s;
+
+	/* waitall: a short send only comes with an error */
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)(s + 1);
+	sqe->len = (unsigned int)size;
+	sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+	sqe->user_data = (((IUINT64)IURING_TYPE_SEND) << 62) |
+		(IUINT64)((size_t)s);
+
+	file->sending = s;
+	ps->inflight++;
+
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+
+#endif
+
+
+/*===================================================================*/
+/* POLL DRIVER - DEVPOLL                                             */
+/*===================================================================*/
+#ifdef IHAVE_DEVPOLL
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/queue.h>
+#include <sys/devpoll.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+
+static int ipu_startup(void);
+static int ipu_shutdown(void);
+static int ipu_init_pd(ipolld ipd, int param);
+static int ipu_destroy_pd(ipolld ipd);
+static int ipu_poll_add(ipolld ipd, int fd, int mask, void *user);
+static int ipu_poll_del(ipolld ipd, int fd);
+static int ipu_poll_set(ipolld ipd, int fd, int mask);
+static int ipu_poll_wait(ipolld ipd, int timeval);
+static int ipu_poll_event(ipolld ipd, int *fd, int *event, void **user);
+
+
+/* devpoll descriptor */
+typedef struct
+{
+	struct IPOLLFV fv;
+	int dpfd;
+	int num_fd;
+	int num_chg;
+	int max_fd;
+	int max_chg;
+	int results;
+	int cur_res;
+	int usr_len;
+	int limit;
+	struct pollfd *mresult;
+	struct pollfd *mchange;
+	struct IPVECTOR vresult;
+	struct IPVECTOR vchange;
+}	IPD_DEVPOLL;
+
+
+/* devpoll driver */
+struct IPOLL_DRIVER IPOLL_DEVPOLL = {
+	sizeof (IPD_DEVPOLL),	
+	IDEVICE_DEVPOLL,
+	100,
+	"DEVPOLL",
+	ipu_startup,
+	ipu_shutdown,
+	ipu_init_pd,
+	ipu_destroy_pd,
+	ipu_poll_add,
+	ipu_poll_del,
+	ipu_poll_set,
+	ipu_poll_wait,
+	ipu_poll_event
+};
+
+
+#ifdef PSTRUCT
+#undef PSTRUCT
+#endif
+
+#define PSTRUCT IPD_DEVPOLL
+
+
+/* grow events */
+static int ipu_grow(PSTRUCT *ps, int size_fd, int size_chg)
+{
+	int r;
+	if (size_fd >= 0) {
+		r = ipv_resize(&ps->vresult, size_fd * sizeof(struct pollfd) * 2);
+		ps->mresult = (struct pollfd*)ps->vresult.data;
+		ps->max_fd = size_fd;
+		if (r) return -1;
+	}
+	if (size_chg >= 0) {
+		r = ipv_resize(&ps->vchange, size_chg * sizeof(struct pollfd));
+		ps->mchange = (struct pollfd*)ps->vchange.data;
+		ps->max_chg= size_chg;
+		if (r) return -2;
+	}
+	return 0;
+}
+
+/* startup devpoll driver */
+static int ipu_startup(void)
+{
+	int fd, flags = O_RDWR;
+#ifdef O_CLOEXEC
+	flags |= O_CLOEXEC;
+#endif
+	fd = open("/dev/poll", flags);
+	if (fd < 0) return -1;
+#if (!defined(O_CLOEXEC)) && defined(FD_CLOEXEC)
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+		close(fd);
+		return -2;
+	}
+#endif
+	close(fd);
+	return 0;
+}
+
+/* shutdown device */
+static int ipu_shutdown(void)
+{
+	return 0;
+}
+
+/* initialize devpoll obj */
+static int ipu_init_pd(ipolld ipd, int param)
 {
 	PSTRUCT *ps = PDESC(ipd);
 	int flags = O_RDWR;
@@ -5291,6 +6752,38 @@ int iposix_thread_affinity(iPosixThread *thread, unsigned int cpumask)
 }
 
 
+/* pin thread to one cpu by index */
+int iposix_thread_cpu(iPosixThread *thread, int cpu)
+{
+	int retval = 0;
+	if (thread == NULL || cpu < 0) return -1;
+	IMUTEX_LOCK(&thread->lock);
+	if (thread->state == IPOSIX_THREAD_STATE_STARTED) {
+	#if defined(_WIN32)
+		if (cpu >= (int)(sizeof(DWORD_PTR) * 8)) retval = -2;
+		else if (SetThreadAffinityMask(thread->th, 
+			((DWORD_PTR)1) << cpu) == 0) retval = -2;
+	#elif defined(__CYGWIN__) || defined(__AVM3__)
+		retval = -3;
+	#elif defined(__linux__) && (!defined(__ANDROID__))
+		cpu_set_t mask;
+		if (cpu >= CPU_SETSIZE) {
+			retval = -2;
+		}	else {
+			CPU_ZERO(&mask);
+			CPU_SET(cpu, &mask);
+			retval = sched_setaffinity(thread->ptid, sizeof(mask), &mask);
+			if (retval != 0) retval = -2;
+		}
+	#else
+		retval = -4;
+	#endif
+	}
+	IMUTEX_UNLOCK(&thread->lock);
+	return retval;
+}
+
+
 /* set signal: if thread is NULL, current thread object is used */
 void iposix_thread_set_signal(iPosixThread *thread, int sig)
 {
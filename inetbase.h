@@ -572,6 +572,12 @@ int ierrno(void);
 /* send */
 long isend(int sock, const void *buf, long size, int mode);
 
+#define ISENDV_MAX	64
+
+/* send vector (writev/WSASend), returns bytes sent */
+long isendv(int sock, const void * const vecptr[], const long veclen[],
+	int count, int mode);
+
 /* receive */
 long irecv(int sock, void *buf, long size, int mode);
 
@@ -733,6 +739,11 @@ int inet_tcp_estab(int sock);
 /*===================================================================*/
 /* Cross-Platform Poll Interface                                     */
 /*===================================================================*/
+/* IDEVICE_EPOLLET is edge triggered: fds must be read/accepted until
+   EAGAIN after each event. ipoll_init is process wide, so CAsyncCore
+   checks ipoll_name() and drains recv and accept to EAGAIN itself.
+   IDEVICE_URING must be picked explicitly, it can also do completion
+   io on fds turned by ipoll_recv (see below) on linux 6.3+. */
 #define IDEVICE_AUTO		0
 #define IDEVICE_SELECT		1
 #define IDEVICE_POLL		2
@@ -742,6 +753,8 @@ int inet_tcp_estab(int sock);
 #define IDEVICE_POLLSET		6
 #define IDEVICE_RTSIG		7
 #define IDEVICE_WINCP		8
+#define IDEVICE_EPOLLET		9
+#define IDEVICE_URING		10
 
 #ifndef IPOLL_IN
 #define IPOLL_IN	1
@@ -755,8 +768,23 @@ int inet_tcp_estab(int sock);
 #define IPOLL_ERR	4
 #endif
 
+/* only used in ipoll_add with EPOLLET: wake one waiter (EPOLLEXCLUSIVE) */
+#ifndef IPOLL_EXCLUSIVE
+#define IPOLL_EXCLUSIVE	8
+#endif
+
 typedef void * ipolld;
 
+/* event entry returned by ipoll_event_batch */
+struct IPOLLEVENT
+{
+	int fd;
+	int event;
+	void *udata;
+};
+
+typedef struct IPOLLEVENT IPOLLEVENT;
+
 /* init poll device */
 int ipoll_init(int device);
 
@@ -787,6 +815,28 @@ int ipoll_wait(ipolld ipd, int millisecond);
 /* query one event: loop call it until it returns non-zero */
 int ipoll_event(ipolld ipd, int *fd, int *event, void **udata);
 
+/* query up to count events at once, returns number of events fetched,
+   zero means no more events. note: events of the same batch may refer
+   to fds which have been deleted while processing previous ones. */
+int ipoll_event_batch(ipolld ipd, IPOLLEVENT *events, int count);
+
+/* completion io (IDEVICE_URING): the kernel receives into buffers of
+   the device instead of reporting IPOLL_IN, returns 0 for ok, -1 for
+   not supported. IPOLL_IN is reported when there is data to fetch. */
+int ipoll_recv(ipolld ipd, int fd);
+
+/* fetch next chunk received on a fd turned by ipoll_recv, the data is
+   valid until the next ipoll_recv_data/ipoll_wait. returns size, 0 for
+   eof, -1 for no more data, -2 for error (errno is set) */
+long ipoll_recv_data(ipolld ipd, int fd, void **ptr);
+
+/* copy data and send it with the next ipoll_wait, IPOLL_OUT will be
+   reported (whatever the mask is) when done. returns 0 for ok, -1 for
+   not supported, -2 if the previous send is still in flight, -3 for
+   error (errno is set) */
+int ipoll_send(ipolld ipd, int fd, const void * const vecptr[],
+	const long veclen[], int count);
+
 
 
 /*===================================================================*/
@@ -889,6 +939,9 @@ void iposix_thread_set_notalive(iPosixThread *thread);
 /* returns 1 for running, 0 for not running */
 int iposix_thread_is_running(const iPosixThread *thread);
 
+/* get current thread object, NULL if not created by iposix_thread_new */
+iPosixThread *iposix_thread_current(void);
+
 
 #define IPOSIX_THREAD_PRIO_LOW			0
 #define IPOSIX_THREAD_PRIO_NORMAL		1
@@ -905,6 +958,10 @@ int iposix_thread_set_stack(iPosixThread *thread, int stacksize);
 /* set cpu mask affinity, the thread must be started (supports win/linux)*/
 int iposix_thread_affinity(iPosixThread *thread, unsigned int cpumask);
 
+/* pin thread to one cpu by index (from 0), not limited to 32 cpus like
+   iposix_thread_affinity, the thread must be started (win/linux) */
+int iposix_thread_cpu(iPosixThread *thread, int cpu);
+
 
 /* set signal: if thread is NULL, current thread object is used */
 void iposix_thread_set_signal(iPosixThread *thread, int sig);
@@ -20,6 +20,11 @@
 #include <netinet/tcp.h>
 #endif
 
+#if defined(__linux__) && (!defined(IDISABLE_EVENTFD))
+#include <sys/eventfd.h>
+#define ASYNC_CORE_EVENTFD
+#endif
+
 #elif (defined(_WIN32) || defined(WIN32))
 #if ((!defined(_M_PPC)) && (!defined(_M_PPC_BE)) && (!defined(_XBOX)))
 #include <mmsystem.h>
@@ -214,7 +219,12 @@ void async_sock_init(CAsyncSock *asyncsock, struct IMEMNODE *nodes)
 	asyncsock->mask = 0;
 	asyncsock->error = 0;
 	asyncsock->flags = 0;
-	iqueue_init(&asyncsock->node);
+	asyncsock->pfd = NULL;
+	asyncsock->time_send = 0;
+	asyncsock->timeout_idle = 0;
+	asyncsock->timeout_connect = 0;
+	asyncsock->timeout_stall = 0;
+	itimer_node_init(&asyncsock->timer, NULL, asyncsock, NULL);
 	ims_init(&asyncsock->linemsg, nodes, 0, 0);
 	ims_init(&asyncsock->sendmsg, nodes, 0, 0);
 	ims_init(&asyncsock->recvmsg, nodes, 0, 0);
@@ -242,6 +252,7 @@ void async_sock_destroy(CAsyncSock *asyncsock)
 	asyncsock->tag = -1;
 	asyncsock->error = 0;
 	asyncsock->buffer = NULL;
+	asyncsock->pfd = NULL;
 	asyncsock->state = ASYNC_SOCK_STATE_CLOSED;
 	ims_destroy(&asyncsock->linemsg);
 	ims_destroy(&asyncsock->sendmsg);
@@ -366,6 +377,7 @@ void async_sock_close(CAsyncSock *asyncsock)
 {
 	if (asyncsock->fd >= 0) iclose(asyncsock->fd);
 	asyncsock->fd = -1;
+	asyncsock->pfd = NULL;
 	asyncsock->state = ASYNC_SOCK_STATE_CLOSED;
 	asyncsock->rc4_send_x = -1;
 	asyncsock->rc4_send_y = -1;
@@ -394,35 +406,99 @@ static int async_sock_try_connect(CAsyncSock *asyncsock)
 	return 0;
 }
 
+/* completion io: a send is in flight in the poll device */
+#define ASYNC_SOCK_FLAG_INFLIGHT	0x20000
+
 /* try send */
 static int async_sock_try_send(CAsyncSock *asyncsock)
 {
-	void *ptr;
-	char *flat;
-	long size;
-	int retval;
+	const void *vecptr[ISENDV_MAX];
+	long veclen[ISENDV_MAX];
+	long size, retval;
+	int count, i;
 
 	if (asyncsock->state != ASYNC_SOCK_STATE_ESTAB) return 0;
 
+	/* completion io: the device copies the data, one send in flight */
+	if (asyncsock->pfd != NULL) {
+		if (asyncsock->flags & ASYNC_SOCK_FLAG_INFLIGHT) return 0;
+		count = ims_vector(&asyncsock->sendmsg, 0, 
+			(ilong)asyncsock->sendmsg.size, vecptr, veclen, ISENDV_MAX);
+		if (count <= 0) return 0;
+		for (i = 0, size = 0; i < count; i++) size += veclen[i];
+		retval = ipoll_send(asyncsock->pfd, asyncsock->fd, vecptr, veclen,
+			count);
+		if (retval == -2) return 0;
+		if (retval != 0) {
+			asyncsock->error = ierrno();
+			return -1;
+		}
+		ims_drop(&asyncsock->sendmsg, size);
+		asyncsock->flags |= ASYNC_SOCK_FLAG_INFLIGHT;
+		return 0;
+	}
+
 	while (1) {
-		size = ims_flat(&asyncsock->sendmsg, &ptr);
-		if (size <= 0) break;
-		flat = (char*)ptr;
-		retval = isend(asyncsock->fd, flat, size, 0);
+		/* gather the first pages of sendmsg into one writev */
+		count = ims_vector(&asyncsock->sendmsg, 0, 
+			(ilong)asyncsock->sendmsg.size, vecptr, veclen, ISENDV_MAX);
+		if (count <= 0) break;
+		for (i = 0, size = 0; i < count; i++) size += veclen[i];
+		retval = isendv(asyncsock->fd, vecptr, veclen, count, 0);
 		if (retval == 0) break;
 		else if (retval < 0) {
 			retval = ierrno();
 			if (retval == IEAGAIN || retval == 0) break;
 			else {
-				asyncsock->error = retval;
+				asyncsock->error = (int)retval;
 				return -1;
 			}
 		}
 		ims_drop(&asyncsock->sendmsg, retval);
+		if (retval < size) break;	/* kernel buffer is full */
 	}
 	return 0;
 }
 
+/* recv until EAGAIN, set by CAsyncCore for edge triggered polls */
+#define ASYNC_SOCK_FLAG_DRAIN	0x10000
+
+/* decrypt received data and append it to recvmsg */
+static void async_sock_feed(CAsyncSock *asyncsock, unsigned char *buffer,
+	long size)
+{
+	if (asyncsock->rc4_recv_x >= 0 && asyncsock->rc4_recv_y >= 0) {
+		icrypt_rc4_crypt(asyncsock->rc4_recv_box, &asyncsock->rc4_recv_x,
+			&asyncsock->rc4_recv_y, buffer, buffer, size);
+	}
+	if (asyncsock->header != ITMH_LINESPLIT) {
+		ims_write(&asyncsock->recvmsg, buffer, size);
+	}	else {
+		long start = 0, pos = 0;
+		char head[4];
+		for (start = 0, pos = 0; pos < size; pos++) {
+			if (buffer[pos] == '\n') {
+				long x = pos - start + 1;
+				long y = asyncsock->linemsg.size;
+				iencode32u_lsb(head, x + y + 4);
+				ims_write(&asyncsock->recvmsg, head, 4);
+				while (asyncsock->linemsg.size > 0) {
+					ilong csize;
+					void *ptr;
+					csize = ims_flat(&asyncsock->linemsg, &ptr);
+					ims_write(&asyncsock->recvmsg, ptr, csize);
+					ims_drop(&asyncsock->linemsg, csize);
+				}
+				ims_write(&asyncsock->recvmsg, &buffer[start], x);
+				start = pos + 1;
+			}
+		}
+		if (pos > start) {
+			ims_write(&asyncsock->linemsg, &buffer[start], pos - start);
+		}
+	}
+}
+
 /* try receive */
 static int async_sock_try_recv(CAsyncSock *asyncsock)
 {
@@ -430,6 +506,21 @@ static int async_sock_try_recv(CAsyncSock *asyncsock)
 	long bufsize = asyncsock->bufsize;
 	int retval;
 	if (asyncsock->state == ASYNC_SOCK_STATE_CLOSED) return 0;
+	/* completion io: take the chunks the kernel has received */
+	while (asyncsock->pfd != NULL) {
+		void *ptr;
+		long size = ipoll_recv_data(asyncsock->pfd, asyncsock->fd, &ptr);
+		if (size == -1) return 0;
+		if (size == -2) {
+			asyncsock->error = ierrno();
+			return -2;
+		}
+		if (size == 0) {
+			asyncsock->error = 0;
+			return -1;
+		}
+		async_sock_feed(asyncsock, (unsigned char*)ptr, size);
+	}
 	while (1) {
 		retval = irecv(asyncsock->fd, buffer, bufsize, 0);
 		if (retval < 0) {
@@ -444,37 +535,10 @@ static int async_sock_try_recv(CAsyncSock *asyncsock)
 			asyncsock->error = 0;
 			return -1;
 		}
-		if (asyncsock->rc4_recv_x >= 0 && asyncsock->rc4_recv_y >= 0) {
-			icrypt_rc4_crypt(asyncsock->rc4_recv_box, &asyncsock->rc4_recv_x,
-				&asyncsock->rc4_recv_y, buffer, buffer, retval);
-		}
-		if (asyncsock->header != ITMH_LINESPLIT) {
-			ims_write(&asyncsock->recvmsg, buffer, retval);
-		}	else {
-			long start = 0, pos = 0;
-			char head[4];
-			for (start = 0, pos = 0; pos < retval; pos++) {
-				if (buffer[pos] == '\n') {
-					long x = pos - start + 1;
-					long y = asyncsock->linemsg.size;
-					iencode32u_lsb(head, x + y + 4);
-					ims_write(&asyncsock->recvmsg, head, 4);
-					while (asyncsock->linemsg.size > 0) {
-						ilong csize;
-						void *ptr;
-						csize = ims_flat(&asyncsock->linemsg, &ptr);
-						ims_write(&asyncsock->recvmsg, ptr, csize);
-						ims_drop(&asyncsock->linemsg, csize);
-					}
-					ims_write(&asyncsock->recvmsg, &buffer[start], x);
-					start = pos + 1;
-				}
-			}
-			if (pos > start) {
-				ims_write(&asyncsock->linemsg, &buffer[start], pos - start);
-			}
-		}
-		if (retval < bufsize) break;
+		async_sock_feed(asyncsock, buffer, retval);
+		/* edge triggered: a short read doesn't mean it's drained */
+		if (retval < bufsize && !(asyncsock->flags & ASYNC_SOCK_FLAG_DRAIN))
+			break;
 	}
 	return 0;
 }
@@ -842,12 +906,13 @@ int async_sock_keepalive(CAsyncSock *asyncsock, int keepcnt, int keepidle,
 /*===================================================================*/
 /* CAsyncCore                                                        */
 /*===================================================================*/
+#define ASYNC_CORE_BATCH	256		/* events harvested per ipoll call */
+
 struct CAsyncCore
 {
 	struct IMEMNODE *nodes;
 	struct IMEMNODE *cache;
 	struct IMSTREAM msgs;
-	struct IQUEUEHEAD head;
 	struct IVECTOR *vector;
 	ipolld pfd;
 	long bufsize;
@@ -857,17 +922,30 @@ struct CAsyncCore
 	char *data;
 	void *user;
 	long msgcnt;
+	long viewsize;
 	long count;
 	long index;
 	int xfd[3];
 	int nolock;
+	IUINT32 signals;
 	IMUTEX_TYPE lock;
 	IMUTEX_TYPE xmtx;
 	IMUTEX_TYPE xmsg;
 	IUINT32 current;
-	IUINT32 lastsec;
 	IUINT32 timeout;
+	IUINT32 timeout_connect;
+	IUINT32 timeout_stall;
+	itimer_wheel wheel;
 	CAsyncValidator validator;
+	int shard;
+	int shardbits;
+	struct CAsyncShard *owner;
+	int edge;
+	int completion;
+	int nevent;
+	int ievent;
+	struct IMSTREAM sends;
+	IPOLLEVENT events[ASYNC_CORE_BATCH];
 };
 
 
@@ -880,6 +958,9 @@ struct CAsyncCore
 
 #define ASYNC_CORE_FLAG_PROGRESS	1
 
+/* completion io: hid is in core->sends, flushed before ipoll_wait */
+#define ASYNC_SOCK_FLAG_QUEUED		0x40000
+
 /* used to monitor self-pipe trick */
 static unsigned int async_core_monitor = 0; 
 
@@ -943,25 +1024,38 @@ CAsyncCore* async_core_new(int flags)
 	}
 
 	ims_init(&core->msgs, core->cache, 0, 0);
-	iqueue_init(&core->head);
+	ims_init(&core->sends, core->cache, 0, 0);
+
+	/* edge triggered: sockets are drained to EAGAIN on each event */
+	core->edge = (strcmp(ipoll_name(), "EPOLLET") == 0)? 1 : 0;
+	core->completion = ((flags & 4) == 0)? 0 : 1;
 
 	core->data = NULL;
 	core->msgcnt = 0;
+	core->viewsize = 0;
 	core->count = 0;
 	core->timeout = 0;
+	core->timeout_connect = 0;
+	core->timeout_stall = 0;
 	core->index = 1;
 	core->validator = NULL;
 	core->user = NULL;
 	core->data = (char*)core->vector->data;
 	core->buffer = core->data + core->bufsize + 64;
 	core->current = iclock();
-	core->lastsec = 0;
+	itimer_wheel_init(&core->wheel, core->current);
 	core->maxsize = ASYNC_SOCK_MAXSIZE;
 	core->limited = 0;
+	core->shard = 0;
+	core->shardbits = 0;
+	core->owner = NULL;
+	core->nevent = 0;
+	core->ievent = 0;
 
 	core->xfd[0] = -1;
 	core->xfd[1] = -1;
 	core->xfd[2] = 0;
+	core->signals = 0;
 
 	IMUTEX_INIT(&core->lock);
 	IMUTEX_INIT(&core->xmtx);
@@ -971,7 +1065,11 @@ CAsyncCore* async_core_new(int flags)
 
 	/* self-pipe trick */
 	if ((flags & 2) == 0) {
-	#ifdef __unix
+	#if defined(ASYNC_CORE_EVENTFD)
+		/* one eventfd for both ends */
+		core->xfd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		core->xfd[1] = core->xfd[0];
+	#elif defined(__unix)
 		#ifndef __AVM2__
 		pipe(core->xfd);
 		ienable(core->xfd[0], ISOCK_NOBLOCK);
@@ -1022,8 +1120,8 @@ void async_core_delete(CAsyncCore *core)
 		if (hid < 0) break;
 		async_core_node_delete(core, hid);
 	}
-	if (!iqueue_is_empty(&core->head)) {
-		assert(iqueue_is_empty(&core->head));
+	if (core->wheel.count != 0) {
+		assert(core->wheel.count == 0);
 		abort();
 	}
 	if (core->count != 0) {
@@ -1037,6 +1135,7 @@ void async_core_delete(CAsyncCore *core)
 	IMUTEX_LOCK(&core->xmsg);
 	ims_destroy(&core->msgs);
 	IMUTEX_UNLOCK(&core->xmsg);
+	ims_destroy(&core->sends);
 	if (core->vector) iv_delete(core->vector);
 	if (core->nodes) imnode_delete(core->nodes);
 	if (core->cache) imnode_delete(core->cache);
@@ -1044,11 +1143,12 @@ void async_core_delete(CAsyncCore *core)
 	core->nodes = NULL;
 	core->cache = NULL;
 	core->data = NULL;
-	iqueue_init(&core->head);
+	itimer_wheel_destroy(&core->wheel);
 #ifdef __unix
 	#ifndef __AVM2__
 	if (core->xfd[0] >= 0) close(core->xfd[0]);
-	if (core->xfd[1] >= 0) close(core->xfd[1]);
+	if (core->xfd[1] >= 0 && core->xfd[1] != core->xfd[0]) 
+		close(core->xfd[1]);
 	#endif
 #else
 	if (core->xfd[0] >= 0) iclose(core->xfd[0]);
@@ -1066,6 +1166,70 @@ void async_core_delete(CAsyncCore *core)
 }
 
 
+/*-------------------------------------------------------------------*/
+/* timeouts: each node keeps one timer at its earliest deadline,     */
+/* activity only updates timestamps and the deadline is re-checked   */
+/* lazily when the timer fires.                                      */
+/*-------------------------------------------------------------------*/
+static void async_core_event_close(CAsyncCore *core, 
+	CAsyncSock *sock, int code);
+
+static int async_core_node_deadline(const CAsyncSock *sock, 
+	IUINT32 *deadline, int *code)
+{
+	int found = 0;
+	if (sock->timeout_idle > 0) {
+		deadline[0] = sock->time + (IUINT32)sock->timeout_idle;
+		code[0] = 2006;
+		found = 1;
+	}
+	if (sock->timeout_connect > 0 && 
+		sock->state == ASYNC_SOCK_STATE_CONNECTING) {
+		IUINT32 x = sock->time + (IUINT32)sock->timeout_connect;
+		if (found == 0 || itimediff(x, deadline[0]) < 0) {
+			deadline[0] = x;
+			code[0] = 2007;
+			found = 1;
+		}
+	}
+	if (sock->timeout_stall > 0 && sock->sendmsg.size > 0 &&
+		sock->state == ASYNC_SOCK_STATE_ESTAB) {
+		IUINT32 x = sock->time_send + (IUINT32)sock->timeout_stall;
+		if (found == 0 || itimediff(x, deadline[0]) < 0) {
+			deadline[0] = x;
+			code[0] = 2008;
+			found = 1;
+		}
+	}
+	return found;
+}
+
+static void async_core_node_schedule(CAsyncCore *core, CAsyncSock *sock)
+{
+	IUINT32 deadline;
+	int code;
+	if (async_core_node_deadline(sock, &deadline, &code)) {
+		itimer_node_add(&core->wheel, &sock->timer, deadline);
+	}	else {
+		itimer_node_del(&core->wheel, &sock->timer);
+	}
+}
+
+static void async_core_node_timer(void *data, void *user)
+{
+	CAsyncSock *sock = (CAsyncSock*)data;
+	CAsyncCore *core = (CAsyncCore*)user;
+	IUINT32 deadline;
+	int code;
+	if (async_core_node_deadline(sock, &deadline, &code) == 0) return;
+	if (itimediff(core->current, deadline) >= 0) {
+		async_core_event_close(core, sock, code);
+	}	else {
+		itimer_node_add(&core->wheel, &sock->timer, deadline);
+	}
+}
+
+
 /*-------------------------------------------------------------------*/
 /* new node                                                          */
 /*-------------------------------------------------------------------*/
@@ -1083,9 +1247,11 @@ static long async_core_node_new(CAsyncCore *core)
 		abort();
 	}
 
-	id = (index & 0xffff) | (core->index << 16);
+	/* low bits of the serial part are shard index inside a group */
+	id = ((core->index << core->shardbits) | core->shard) << 16;
+	id |= index & 0xffff;
 	core->index++;
-	if (core->index >= 0x7fff) core->index = 1;
+	if (core->index >= (0x7fff >> core->shardbits)) core->index = 1;
 
 	sock = (CAsyncSock*)IMNODE_DATA(core->nodes, index);
 	if (sock == NULL) {
@@ -1099,10 +1265,15 @@ static long async_core_node_new(CAsyncCore *core)
 	sock->buffer = core->buffer;
 	sock->bufsize = core->bufsize;
 	sock->time = core->current;
+	sock->time_send = core->current;
 	sock->maxsize = core->maxsize;
 	sock->limited = core->limited;
-	sock->flags = 0;
-	iqueue_add_tail(&sock->node, &core->head);
+	sock->flags = (core->edge)? ASYNC_SOCK_FLAG_DRAIN : 0;
+	sock->timeout_idle = core->timeout;
+	sock->timeout_connect = core->timeout_connect;
+	sock->timeout_stall = core->timeout_stall;
+	itimer_node_init(&sock->timer, async_core_node_timer, sock, core);
+	async_core_node_schedule(core, sock);
 
 	core->count++;
 
@@ -1151,11 +1322,13 @@ async_core_node_get_const(const CAsyncCore *core, long hid)
 static long async_core_node_delete(CAsyncCore *core, long hid)
 {
 	CAsyncSock *sock = async_core_node_get(core, hid);
+	int i;
 	if (sock == NULL) return -1;
-	if (!iqueue_is_empty(&sock->node)) {
-		iqueue_del(&sock->node);
-		iqueue_init(&sock->node);
+	/* the slot may be reused: drop its events left in current batch */
+	for (i = core->ievent + 1; i < core->nevent; i++) {
+		if (core->events[i].udata == sock) core->events[i].event = 0;
 	}
+	itimer_node_del(&core->wheel, &sock->timer);
 	async_sock_destroy(sock);
 	imnode_del(core->nodes, hid & 0xffff);
 	core->count--;
@@ -1171,8 +1344,6 @@ static int async_core_node_active(CAsyncCore *core, long hid)
 	CAsyncSock *sock = async_core_node_get(core, hid);
 	if (sock == NULL) return -1;
 	sock->time = core->current;
-	iqueue_del(&sock->node);
-	iqueue_add_tail(&sock->node, &core->head);
 	return 0;
 }
 
@@ -1279,6 +1450,24 @@ static int async_core_msg_push(CAsyncCore *core, int event, long wparam,
 	return 0;
 }
 
+/* post message by moving size bytes out of src without a staging copy */
+static int async_core_msg_move(CAsyncCore *core, int event, long wparam,
+	long lparam, struct IMSTREAM *src, long size)
+{
+	char head[14];
+	size = size < 0 ? 0 : size;
+	iencode32u_lsb(head, (long)(size + 14));
+	iencode16u_lsb(head + 4, (unsigned short)event);
+	iencode32i_lsb(head + 6, wparam);
+	iencode32i_lsb(head + 10, lparam);
+	if (core->nolock == 0) IMUTEX_LOCK(&core->xmsg);
+	ims_write(&core->msgs, head, 14);
+	ims_move(&core->msgs, src, size);
+	core->msgcnt++;
+	if (core->nolock == 0) IMUTEX_UNLOCK(&core->xmsg);
+	return 0;
+}
+
 
 /*-------------------------------------------------------------------*/
 /* get message                                                       */
@@ -1296,6 +1485,12 @@ static long async_core_msg_read(CAsyncCore *core, int *event, long *wparam,
 	if (core->nolock == 0) {
 		IMUTEX_LOCK(&core->xmsg);
 	}
+	if (core->viewsize > 0) {
+		if (core->nolock == 0) {
+			IMUTEX_UNLOCK(&core->xmsg);
+		}
+		return -3;
+	}
 	if (ims_peek(&core->msgs, head, 4) < 4) {
 		if (core->nolock == 0) {
 			IMUTEX_UNLOCK(&core->xmsg);
@@ -1335,34 +1530,104 @@ static long async_core_msg_read(CAsyncCore *core, int *event, long *wparam,
 
 
 /*-------------------------------------------------------------------*/
-/* resize buffer                                                     */
+/* view message: map the pages of the head message without copy      */
 /*-------------------------------------------------------------------*/
-static int async_core_buffer_resize(CAsyncCore *core, long newsize)
+static int async_core_msg_vector(CAsyncCore *core, long offset, long size,
+	const void *vecptr[], long veclen[], int count)
 {
-	long hid, xsize;
-	if (newsize < core->bufsize) return 0;
-	for (xsize = core->bufsize; xsize < newsize; ) {
-		if (xsize <= 0x800000) xsize += 0x100000;
-		else xsize = xsize + (xsize >> 1);
+	int n = ims_vector(&core->msgs, offset, size, NULL, NULL, 0);
+	if (n <= count) {
+		ims_vector(&core->msgs, offset, size, vecptr, veclen, count);
 	}
-	newsize = xsize;
-	if (iv_resize(core->vector, (newsize + 64) * 2) != 0) return -1;
-	core->data = (char*)core->vector->data;
-	core->buffer = core->data + newsize + 64;
-	core->bufsize = newsize;
+	return n;
+}
 
-	hid = _async_core_node_head(core);
+static long async_core_msg_view(CAsyncCore *core, int *event, long *wparam,
+	long *lparam, const void *vecptr[], long veclen[], int *count)
+{
+	char head[14];
+	IUINT32 length;
+	IINT32 x;
+	IUINT16 y;
+	long hr;
+	int n;
+	if (core->nolock == 0) IMUTEX_LOCK(&core->xmsg);
+	if (core->viewsize > 0) {
+		hr = -3;
+	}
+	else if (ims_peek(&core->msgs, head, 14) < 14) {
+		hr = -1;
+	}
+	else {
+		idecode32u_lsb(head, &length);
+		length -= 14;
+		n = async_core_msg_vector(core, 14, (long)length, vecptr, veclen,
+			count[0]);
+		if (n > count[0]) {
+			hr = -2;
+		}	else {
+			idecode16u_lsb(head + 4, &y);
+			if (event) event[0] = y;
+			idecode32i_lsb(head + 6, &x);
+			if (wparam) wparam[0] = x;
+			idecode32i_lsb(head + 10, &x);
+			if (lparam) lparam[0] = x;
+			core->viewsize = (long)length + 14;
+			hr = (long)length;
+		}
+		count[0] = n;
+	}
+	if (core->nolock == 0) IMUTEX_UNLOCK(&core->xmsg);
+	return hr;
+}
 
-	while (hid >= 0) {
-		CAsyncSock *sock = async_core_node_get(core, hid);
-		assert(sock);
-		sock->external = core->buffer;
-		sock->buffer = core->buffer;
-		sock->bufsize = core->bufsize;
-		hid = _async_core_node_next(core, hid);
+static int async_core_msg_batch(CAsyncCore *core, CAsyncEvent *events,
+	int count, char *buffer, long size)
+{
+	char head[14];
+	IUINT32 length;
+	IINT32 x;
+	IUINT16 y;
+	int n = 0;
+	if (core->nolock == 0) IMUTEX_LOCK(&core->xmsg);
+	if (core->viewsize > 0) {
+		if (core->nolock == 0) IMUTEX_UNLOCK(&core->xmsg);
+		return -3;
 	}
+	while (n < count) {
+		if (ims_peek(&core->msgs, head, 14) < 14) break;
+		idecode32u_lsb(head, &length);
+		length -= 14;
+		if ((long)length > size) {
+			if (n == 0) n = -2;
+			break;
+		}
+		ims_drop(&core->msgs, 14);
+		ims_read(&core->msgs, buffer, length);
+		idecode16u_lsb(head + 4, &y);
+		events[n].event = y;
+		idecode32i_lsb(head + 6, &x);
+		events[n].wparam = x;
+		idecode32i_lsb(head + 10, &x);
+		events[n].lparam = x;
+		events[n].data = buffer;
+		events[n].size = (long)length;
+		buffer += length;
+		size -= (long)length;
+		n++;
+	}
+	if (core->nolock == 0) IMUTEX_UNLOCK(&core->xmsg);
+	return n;
+}
 
-	return 0;
+static void async_core_msg_release(CAsyncCore *core)
+{
+	if (core->nolock == 0) IMUTEX_LOCK(&core->xmsg);
+	if (core->viewsize > 0) {
+		ims_drop(&core->msgs, core->viewsize);
+		core->viewsize = 0;
+	}
+	if (core->nolock == 0) IMUTEX_UNLOCK(&core->xmsg);
 }
 
 /*-------------------------------------------------------------------*/
@@ -1381,6 +1646,21 @@ static int async_core_node_mask(CAsyncCore *core, CAsyncSock *sock,
 	return ipoll_set(core->pfd, sock->fd, sock->mask);
 }
 
+/*-------------------------------------------------------------------*/
+/* established socket: let the poll device do recv and send if the   */
+/* core is created with flags 4 and the device supports it.          */
+/*-------------------------------------------------------------------*/
+static void async_core_node_completion(CAsyncCore *core, CAsyncSock *sock)
+{
+	if (core->completion == 0 || sock->pfd != NULL) return;
+	if (ipoll_recv(core->pfd, sock->fd) != 0) return;
+	sock->pfd = core->pfd;
+	/* IPOLL_OUT now only comes with finished sends */
+	if (sock->mask & IPOLL_OUT) {
+		async_core_node_mask(core, sock, 0, IPOLL_OUT);
+	}
+}
+
 /*-------------------------------------------------------------------*/
 /* new accept                                                        */
 /*-------------------------------------------------------------------*/
@@ -1460,6 +1740,7 @@ static long async_core_accept(CAsyncCore *core, long listen_hid)
 	}
 
 	async_core_node_mask(core, sock, IPOLL_IN | IPOLL_ERR, 0);
+	async_core_node_completion(core, sock);
 
 	async_core_msg_push(core, ASYNC_CORE_EVT_NEW, hid, 
 		listen_hid, remote, addrlen);
@@ -1502,7 +1783,8 @@ static long _async_core_new_connect(CAsyncCore *core,
 
 	async_core_node_mask(core, sock, IPOLL_OUT | IPOLL_IN | IPOLL_ERR, 0);
 	sock->mode = ASYNC_CORE_NODE_OUT;
-	sock->flags = 0;
+	sock->flags &= ASYNC_SOCK_FLAG_DRAIN;
+	async_core_node_schedule(core, sock);
 
 	async_core_msg_push(core, ASYNC_CORE_EVT_NEW, hid, 
 		0, addr, addrlen);
@@ -1576,6 +1858,10 @@ static long _async_core_new_assign(CAsyncCore *core, int fd,
 	async_core_node_mask(core, sock, IPOLL_OUT | IPOLL_IN | IPOLL_ERR, 0);
 	sock->mode = ASYNC_CORE_NODE_ASSIGN;
 
+	if (estab) {
+		async_core_node_completion(core, sock);
+	}
+
 	if (ipeername(fd, (struct sockaddr*)(name + 64), &size) == 0) {
 		memcpy(name, name + 64, 64);
 	}
@@ -1673,10 +1959,11 @@ static long _async_core_new_listen(CAsyncCore *core,
 	async_core_node_mask(core, sock, IPOLL_IN | IPOLL_ERR, 0);
 	sock->mode = ipv6? ASYNC_CORE_NODE_LISTEN6 : ASYNC_CORE_NODE_LISTEN4;
 
-	if (!iqueue_is_empty(&sock->node)) {
-		iqueue_del(&sock->node);
-		iqueue_init(&sock->node);
-	}
+	/* listeners never time out */
+	sock->timeout_idle = 0;
+	sock->timeout_connect = 0;
+	sock->timeout_stall = 0;
+	itimer_node_del(&core->wheel, &sock->timer);
 
 	sock->header = header & 0xff;
 
@@ -1744,151 +2031,207 @@ static void async_core_event_close(CAsyncCore *core,
 }
 
 /*-------------------------------------------------------------------*/
-/* wait for events for millisec ms. and process events,              */
-/* if millisec equals zero, no wait.                                 */
+/* dispatch one event of ipoll                                       */
 /*-------------------------------------------------------------------*/
-static void async_core_process_events(CAsyncCore *core, IUINT32 millisec)
+static void async_core_dispatch(CAsyncCore *core, int fd, int event,
+	void *udata)
 {
-	int fd, event, x, count, xf, code = 2010;
-	void *udata;
-	IUINT64 ts;
-	IUINT32 now;
-
-	count = ipoll_wait(core->pfd, millisec);
-
-	ts = iclock64();
-	core->current = (IUINT32)(ts & 0xfffffffful);
-	now = (IUINT32)((ts / 1000) & 0xfffffffful);
-
-	xf = core->xfd[ASYNC_CORE_PIPE_READ];
-
-	for (x = count * 2; x > 0; x--) {
-		CAsyncSock *sock;
-		int needclose = 0;
-		if (ipoll_event(core->pfd, &fd, &event, &udata) != 0) {
-			break;
-		}
-		if (fd == xf && fd >= 0) {
-			if ((event & IPOLL_IN) || (event & IPOLL_ERR)) {
-				char dummy[10];
-				async_core_monitor++;
-				IMUTEX_LOCK(&core->xmtx);
-			#ifdef __unix
-				read(fd, dummy, 8);
-			#else
-				irecv(fd, dummy, 8, 0);
-			#endif
-				core->xfd[ASYNC_CORE_PIPE_FLAG] = 0;
-				IMUTEX_UNLOCK(&core->xmtx);
-				async_core_monitor--;
-			}
-			continue;
-		}
-		sock = (CAsyncSock*)udata;
-		if (sock == NULL || fd != sock->fd) {
-			assert(sock && fd == sock->fd);
-			abort();
-		}
+	CAsyncSock *sock;
+	int needclose = 0, code = 2010;
+	if (fd == core->xfd[ASYNC_CORE_PIPE_READ] && fd >= 0) {
 		if ((event & IPOLL_IN) || (event & IPOLL_ERR)) {
-			if (sock->mode == ASYNC_CORE_NODE_LISTEN4 ||
-				sock->mode == ASYNC_CORE_NODE_LISTEN6) {
+			char dummy[10];
+			async_core_monitor++;
+			IMUTEX_LOCK(&core->xmtx);
+		#if defined(ASYNC_CORE_EVENTFD) || defined(__unix)
+			read(fd, dummy, 8);
+		#else
+			irecv(fd, dummy, 8, 0);
+		#endif
+			core->xfd[ASYNC_CORE_PIPE_FLAG] = 0;
+			IMUTEX_UNLOCK(&core->xmtx);
+			async_core_monitor--;
+		}
+		return;
+	}
+	sock = (CAsyncSock*)udata;
+	if (sock == NULL || fd != sock->fd) {
+		assert(sock && fd == sock->fd);
+		abort();
+	}
+	if ((event & IPOLL_IN) || (event & IPOLL_ERR)) {
+		if (sock->mode == ASYNC_CORE_NODE_LISTEN4 ||
+			sock->mode == ASYNC_CORE_NODE_LISTEN6) {
+			if (core->edge == 0) {
 				async_core_accept(core, sock->hid);
-			}	
-			else {
-				if (async_sock_update(sock, 1) != 0) {
-					needclose = 1;
-					code = 2000;
-				}
-				if (sock->mode == ASYNC_CORE_NODE_OUT) {
-					if (sock->state == ASYNC_SOCK_STATE_CONNECTING) {
-						if ((event & IPOLL_ERR) && needclose == 0) {
-							needclose = 1;
-							code = 2001;
-						}
-					}
-				}
-				if (needclose == 0) {
-					async_core_node_active(core, sock->hid);
-				}
-				while (needclose == 0) {
-					long size = async_sock_recv(sock, NULL, 0);
-					if (size < 0) {	/* not enough data or size error */
-						if (size == -3 || size == -4) {	/* size error */
-							needclose = 1;
-							code = 2002;
-						}
-						break;
-					}
-					else if (size > core->bufsize) {	/* buffer resize */
-						if (async_core_buffer_resize(core, size) != 0) {
-							needclose = 1;
-							code = 2003;
-							break;
-						}
-					}
-					size = async_sock_recv(sock, core->buffer,
-						core->bufsize);
-					async_core_msg_push(core, ASYNC_CORE_EVT_DATA,
-						sock->hid, sock->tag, core->buffer, size);
+			}	else {
+				/* edge triggered: accept until EAGAIN (-4) or full, 
+				   rejected (-5) or failed (-6/-7) ones go on */
+				long hr = 0;
+				while (hr >= 0 || hr < -4) {
+					hr = async_core_accept(core, sock->hid);
 				}
 			}
-		}
-		if ((event & IPOLL_OUT) && needclose == 0) {
+		}	
+		else {
+			if (async_sock_update(sock, 1) != 0) {
+				needclose = 1;
+				code = 2000;
+			}
 			if (sock->mode == ASYNC_CORE_NODE_OUT) {
 				if (sock->state == ASYNC_SOCK_STATE_CONNECTING) {
-					int hr = 0, done = 0;
-					int error = 0, len = sizeof(int);
-					hr = igetsockopt(sock->fd, SOL_SOCKET, SO_ERROR, 
-						(char*)&error, &len);
-					if (hr < 0 || (hr == 0 && error != 0)) {
-						done = 0;
-					}	else {
-						done = 1;
+					if ((event & IPOLL_ERR) && needclose == 0) {
+						needclose = 1;
+						code = 2001;
 					}
-					if (done) {
-						sock->state = ASYNC_SOCK_STATE_ESTAB;
-						async_core_msg_push(core, ASYNC_CORE_EVT_ESTAB, 
-							sock->hid, sock->tag, "", 0);
-						async_core_node_mask(core, sock, 
-							IPOLL_IN | IPOLL_ERR, 0);
-					}	else {
+				}
+			}
+			if (needclose == 0) {
+				async_core_node_active(core, sock->hid);
+			}
+			while (needclose == 0) {
+				long size = async_sock_recv(sock, NULL, 0);
+				if (size < 0) {	/* not enough data or size error */
+					if (size == -3 || size == -4) {	/* size error */
 						needclose = 1;
-						code = 2004;
+						code = 2002;
 					}
+					break;
+				}
+				ims_drop(&sock->recvmsg, 
+					async_sock_head_len[sock->header]);
+				async_core_msg_move(core, ASYNC_CORE_EVT_DATA,
+					sock->hid, sock->tag, &sock->recvmsg, size);
+			}
+		}
+	}
+	if ((event & IPOLL_OUT) && needclose == 0) {
+		if (sock->mode == ASYNC_CORE_NODE_OUT) {
+			if (sock->state == ASYNC_SOCK_STATE_CONNECTING) {
+				int hr = 0, done = 0;
+				int error = 0, len = sizeof(int);
+				hr = igetsockopt(sock->fd, SOL_SOCKET, SO_ERROR, 
+					(char*)&error, &len);
+				if (hr < 0 || (hr == 0 && error != 0)) {
+					done = 0;
+				}	else {
+					done = 1;
+				}
+				if (done) {
+					sock->state = ASYNC_SOCK_STATE_ESTAB;
+					sock->time_send = core->current;
+					async_core_node_schedule(core, sock);
+					async_core_msg_push(core, ASYNC_CORE_EVT_ESTAB, 
+						sock->hid, sock->tag, "", 0);
+					async_core_node_mask(core, sock, 
+						IPOLL_IN | IPOLL_ERR, 0);
+					async_core_node_completion(core, sock);
+				}	else {
+					needclose = 1;
+					code = 2004;
 				}
 			}
-			if (sock->sendmsg.size > 0 && needclose == 0) {
+		}
+		if (sock->pfd != NULL && needclose == 0) {
+			/* completion io: the send in flight is finished */
+			sock->flags &= ~ASYNC_SOCK_FLAG_INFLIGHT;
+			sock->time_send = core->current;
+			if (sock->sendmsg.size > 0) {
 				if (async_sock_update(sock, 2) != 0) {
 					needclose = 1;
 					code = 2005;
 				}
 			}
-			if (sock->sendmsg.size == 0 && sock->fd >= 0 && !needclose) {
-				if (sock->mask & IPOLL_OUT) {
-					async_core_node_mask(core, sock, 0, IPOLL_OUT);
-					if (sock->flags & ASYNC_CORE_FLAG_PROGRESS) {
-						async_core_msg_push(core, ASYNC_CORE_EVT_PROGRESS,
-							sock->hid, sock->tag, core->buffer, 0);
-					}
-				}
+			else if (sock->flags & ASYNC_CORE_FLAG_PROGRESS) {
+				async_core_msg_push(core, ASYNC_CORE_EVT_PROGRESS,
+					sock->hid, sock->tag, core->buffer, 0);
+			}
+		}
+		else if (sock->sendmsg.size > 0 && needclose == 0) {
+			iulong size = sock->sendmsg.size;
+			if (async_sock_update(sock, 2) != 0) {
+				needclose = 1;
+				code = 2005;
+			}
+			if (sock->sendmsg.size < size) {
+				sock->time_send = core->current;
 			}
 		}
-		if (sock->state == ASYNC_SOCK_STATE_CLOSED || needclose) {
-			async_core_event_close(core, sock, code);
+		if (sock->sendmsg.size == 0 && sock->fd >= 0 && !needclose &&
+			sock->pfd == NULL) {
+			if (sock->mask & IPOLL_OUT) {
+				async_core_node_mask(core, sock, 0, IPOLL_OUT);
+				if (sock->flags & ASYNC_CORE_FLAG_PROGRESS) {
+					async_core_msg_push(core, ASYNC_CORE_EVT_PROGRESS,
+						sock->hid, sock->tag, core->buffer, 0);
+				}
+			}
 		}
 	}
+	if (sock->state == ASYNC_SOCK_STATE_CLOSED || needclose) {
+		async_core_event_close(core, sock, code);
+	}
+}
+
+
+/*-------------------------------------------------------------------*/
+/* wait for events for millisec ms. and process events,              */
+/* if millisec equals zero, no wait.                                 */
+/*-------------------------------------------------------------------*/
+static void async_core_process_events(CAsyncCore *core, IUINT32 millisec)
+{
+	int x, count;
+	IUINT64 ts;
 
-	if (now != core->lastsec && core->timeout > 0) {
+	/* completion io: sends of this pass go with the same syscall */
+	while (core->sends.size > 0) {
 		CAsyncSock *sock;
-		core->lastsec = now;
-		while (!iqueue_is_empty(&core->head)) {
-			IINT32 timeout;
-			sock = iqueue_entry(core->head.next, CAsyncSock, node);
-			timeout = itimediff(core->current, sock->time + core->timeout);
-			if (timeout < 0) break;
-			async_core_event_close(core, sock, 2006);
+		long hid;
+		ims_read(&core->sends, &hid, sizeof(long));
+		sock = async_core_node_get(core, hid);
+		if (sock == NULL) continue;
+		sock->flags &= ~ASYNC_SOCK_FLAG_QUEUED;
+		if (async_sock_update(sock, 2) != 0) {
+			async_core_event_close(core, sock, 2005);
+		}
+	}
+
+	count = ipoll_wait(core->pfd, millisec);
+
+	ts = iclock64();
+	core->current = (IUINT32)(ts & 0xfffffffful);
+
+	for (x = count * 2; x > 0; ) {
+		int n = ipoll_event_batch(core->pfd, core->events, 
+			(x < ASYNC_CORE_BATCH)? x : ASYNC_CORE_BATCH);
+		if (n <= 0) break;
+		x -= n;
+		core->nevent = n;
+		for (core->ievent = 0; core->ievent < n; core->ievent++) {
+			IPOLLEVENT *e = &core->events[core->ievent];
+			if (e->event != 0) {
+				async_core_dispatch(core, e->fd, e->event, e->udata);
+			}
+		}
+		core->nevent = 0;
+	}
+
+	if (core->signals != 0) {
+		IUINT32 signals;
+		int i;
+		IMUTEX_LOCK(&core->xmtx);
+		signals = core->signals;
+		core->signals = 0;
+		IMUTEX_UNLOCK(&core->xmtx);
+		for (i = 0; i < 32; i++) {
+			if (signals & (((IUINT32)1) << i)) {
+				async_core_msg_push(core, ASYNC_CORE_EVT_SIGNAL, i, 0,
+					core->buffer, 0);
+			}
 		}
 	}
+
+	itimer_wheel_run(&core->wheel, core->current);
 }
 
 
@@ -1906,8 +2249,25 @@ static long _async_core_send_vector(CAsyncCore *core, long hid,
 		async_core_event_close(core, sock, 2005);
 		return -200;
 	}
-	hr = async_sock_send_vector(sock, vecptr, veclen, count, mask);
-	if (sock->sendmsg.size > 0 && sock->fd >= 0) {
+	if (sock->sendmsg.size == 0 && sock->timeout_stall > 0) {
+		/* write stall clock starts with the first pending byte */
+		sock->time_send = core->current;
+		hr = async_sock_send_vector(sock, vecptr, veclen, count, mask);
+		if (!itimer_node_pending(&sock->timer) || itimediff(
+			sock->time_send + (IUINT32)sock->timeout_stall,
+			sock->timer.expires) < 0) {
+			async_core_node_schedule(core, sock);
+		}
+	}	else {
+		hr = async_sock_send_vector(sock, vecptr, veclen, count, mask);
+	}
+	if (sock->sendmsg.size > 0 && sock->pfd != NULL) {
+		if ((sock->flags & ASYNC_SOCK_FLAG_QUEUED) == 0) {
+			ims_write(&core->sends, &hid, sizeof(long));
+			sock->flags |= ASYNC_SOCK_FLAG_QUEUED;
+		}
+	}
+	else if (sock->sendmsg.size > 0 && sock->fd >= 0) {
 		if ((sock->mask & IPOLL_OUT) == 0) {
 			async_core_node_mask(core, sock, 
 				IPOLL_OUT, 0);
@@ -1916,6 +2276,19 @@ static long _async_core_send_vector(CAsyncCore *core, long hid,
 	return hr;
 }
 
+/*-------------------------------------------------------------------*/
+/* shard cores of CAsyncGroup are polled with the core lock held, so */
+/* send/close from other threads are queued to the shard thread.     */
+/*-------------------------------------------------------------------*/
+#define ASYNC_GROUP_CMD_SEND		0
+#define ASYNC_GROUP_CMD_CLOSE		1
+
+static int async_shard_foreign(const CAsyncCore *core);
+
+static long async_shard_command(struct CAsyncShard *shard, long hid, 
+	int cmd, long code, const void * const vecptr[], 
+	const long veclen[], int count);
+
 /*-------------------------------------------------------------------*/
 /* send vector                                                       */
 /*-------------------------------------------------------------------*/
@@ -1924,6 +2297,11 @@ long async_core_send_vector(CAsyncCore *core, long hid,
 	const long veclen[], int count, int mask)
 {
 	long hr = -1;
+	if (async_shard_foreign(core)) {
+		hr = async_shard_command(core->owner, hid, ASYNC_GROUP_CMD_SEND,
+			mask, vecptr, veclen, count);
+		return (hr < 0)? -100 : hr;
+	}
 	ASYNC_CORE_CRITICAL_BEGIN(core);
 	hr = _async_core_send_vector(core, hid, vecptr, veclen, count, mask);
 	ASYNC_CORE_CRITICAL_END(core);
@@ -1940,6 +2318,11 @@ long async_core_send(CAsyncCore *core, long hid, const void *ptr, long len)
 	long hr;
 	vecptr[0] = ptr;
 	veclen[0] = len;
+	if (async_shard_foreign(core)) {
+		hr = async_shard_command(core->owner, hid, ASYNC_GROUP_CMD_SEND,
+			0, vecptr, veclen, 1);
+		return (hr < 0)? -100 : hr;
+	}
 	ASYNC_CORE_CRITICAL_BEGIN(core);
 	hr = _async_core_send_vector(core, hid, vecptr, veclen, 1, 0);
 	ASYNC_CORE_CRITICAL_END(core);
@@ -1953,6 +2336,12 @@ int async_core_close(CAsyncCore *core, long hid, int code)
 {
 	CAsyncSock *sock;
 	int hr = -1;
+	if (async_shard_foreign(core)) {
+		if (async_shard_command(core->owner, hid, ASYNC_GROUP_CMD_CLOSE,
+			code, NULL, NULL, 0) < 0) 
+			return -1;
+		return 0;
+	}
 	ASYNC_CORE_CRITICAL_BEGIN(core);
 	sock = async_core_node_get(core, hid);
 	if (sock != NULL) {
@@ -2003,14 +2392,19 @@ int async_core_notify(CAsyncCore *core)
 	fd = core->xfd[ASYNC_CORE_PIPE_WRITE];
 	if (core->xfd[ASYNC_CORE_PIPE_FLAG] == 0) {
 		if (fd >= 0) {
+		#if defined(ASYNC_CORE_EVENTFD)
+			IUINT64 one = 1;
+			hr = (write(fd, &one, 8) == 8)? 1 : 0;
+		#else
 			char dummy = 1;
-			int hr = 0;
-		#ifdef __unix
+			hr = 0;
+			#ifdef __unix
 			#ifndef __AVM2__
 			hr = write(fd, &dummy, 1);
 			#endif
-		#else
+			#else
 			hr = send(fd, &dummy, 1, 0);
+			#endif
 		#endif
 			if (hr == 1) {
 				core->xfd[ASYNC_CORE_PIPE_FLAG] = 1;
@@ -2025,6 +2419,24 @@ int async_core_notify(CAsyncCore *core)
 }
 
 
+/*-------------------------------------------------------------------*/
+/* raise signal (0-31) from any thread: repeated signals before the  */
+/* next async_core_wait are merged into one ASYNC_CORE_EVT_SIGNAL    */
+/*-------------------------------------------------------------------*/
+int async_core_signal(CAsyncCore *core, int sig)
+{
+	IUINT32 bit, last;
+	if (sig < 0 || sig >= 32) return -1;
+	bit = ((IUINT32)1) << sig;
+	IMUTEX_LOCK(&core->xmtx);
+	last = core->signals;
+	core->signals |= bit;
+	IMUTEX_UNLOCK(&core->xmtx);
+	if (last & bit) return 1;
+	return async_core_notify(core);
+}
+
+
 /*-------------------------------------------------------------------*/
 /* get message                                                       */
 /*-------------------------------------------------------------------*/
@@ -2036,10 +2448,36 @@ long async_core_read(CAsyncCore *core, int *event, long *wparam,
 
 
 /*-------------------------------------------------------------------*/
-/* push message to msg queue                                         */
+/* view message without copy, release it after use                   */
 /*-------------------------------------------------------------------*/
-int async_core_push(CAsyncCore *core, int event, long wparam, long lparam, 
-	const char *data, long size)
+long async_core_read_view(CAsyncCore *core, int *event, long *wparam,
+	long *lparam, const void *vecptr[], long veclen[], int *count)
+{
+	return async_core_msg_view(core, event, wparam, lparam, vecptr, 
+		veclen, count);
+}
+
+void async_core_read_release(CAsyncCore *core)
+{
+	async_core_msg_release(core);
+}
+
+
+/*-------------------------------------------------------------------*/
+/* read many messages under one lock                                 */
+/*-------------------------------------------------------------------*/
+int async_core_read_batch(CAsyncCore *core, CAsyncEvent *events, 
+	int count, void *buffer, long size)
+{
+	return async_core_msg_batch(core, events, count, (char*)buffer, size);
+}
+
+
+/*-------------------------------------------------------------------*/
+/* push message to msg queue                                         */
+/*-------------------------------------------------------------------*/
+int async_core_push(CAsyncCore *core, int event, long wparam, long lparam, 
+	const char *data, long size)
 {
 	async_core_msg_push(core, event, wparam, lparam, data, size);
 	return 0;
@@ -2115,7 +2553,24 @@ static int _async_core_option(CAsyncCore *core, long hid,
 	int opt, long value)
 {
 	int hr = -100;
-	CAsyncSock *sock = async_core_node_get(core, hid);
+	CAsyncSock *sock;
+
+	if (hid < 0) {
+		/* defaults for new connections */
+		switch (opt) {
+		case ASYNC_CORE_OPTION_TIMEOUT_IDLE:
+			core->timeout = (value < 0)? 0 : (IUINT32)value;
+			return 0;
+		case ASYNC_CORE_OPTION_TIMEOUT_CONNECT:
+			core->timeout_connect = (value < 0)? 0 : (IUINT32)value;
+			return 0;
+		case ASYNC_CORE_OPTION_TIMEOUT_STALL:
+			core->timeout_stall = (value < 0)? 0 : (IUINT32)value;
+			return 0;
+		}
+	}
+
+	sock = async_core_node_get(core, hid);
 
 	if (sock == NULL) return -10;
 	if (sock->fd < 0) return -20;
@@ -2180,6 +2635,21 @@ static int _async_core_option(CAsyncCore *core, long hid,
 	case ASYNC_CORE_OPTION_GETFD:
 		hr = sock->fd;
 		break;
+	case ASYNC_CORE_OPTION_TIMEOUT_IDLE:
+		sock->timeout_idle = (value < 0)? 0 : value;
+		async_core_node_schedule(core, sock);
+		hr = 0;
+		break;
+	case ASYNC_CORE_OPTION_TIMEOUT_CONNECT:
+		sock->timeout_connect = (value < 0)? 0 : value;
+		async_core_node_schedule(core, sock);
+		hr = 0;
+		break;
+	case ASYNC_CORE_OPTION_TIMEOUT_STALL:
+		sock->timeout_stall = (value < 0)? 0 : value;
+		async_core_node_schedule(core, sock);
+		hr = 0;
+		break;
 	}
 	return hr;
 }
@@ -2301,11 +2771,21 @@ void async_core_firewall(CAsyncCore *core, CAsyncValidator v, void *user)
 	ASYNC_CORE_CRITICAL_END(core);
 }
 
-/* set timeout */
+/* set idle timeout of every connection and the default of new ones */
 void async_core_timeout(CAsyncCore *core, long seconds)
 {
+	long hid;
 	ASYNC_CORE_CRITICAL_BEGIN(core);
-	core->timeout = seconds * 1000;
+	core->timeout = (seconds > 0)? seconds * 1000 : 0;
+	for (hid = _async_core_node_head(core); hid >= 0; ) {
+		CAsyncSock *sock = async_core_node_get(core, hid);
+		if (sock->mode != ASYNC_CORE_NODE_LISTEN4 &&
+			sock->mode != ASYNC_CORE_NODE_LISTEN6) {
+			sock->timeout_idle = core->timeout;
+			async_core_node_schedule(core, sock);
+		}
+		hid = _async_core_node_next(core, hid);
+	}
 	ASYNC_CORE_CRITICAL_END(core);
 }
 
@@ -2347,164 +2827,1517 @@ long async_core_nfds(const CAsyncCore *core)
 
 
 /*===================================================================*/
-/* Thread Safe Queue                                                 */
+/* CAsyncGroup                                                       */
 /*===================================================================*/
-struct iQueueSafe
+struct CAsyncShard
 {
-	iPosixSemaphore *sem;
-	struct IMSTREAM stream;
-	int stop;
+	CAsyncCore *core;
+	CAsyncGroup *group;
+	iPosixThread *thread;
+	struct IMEMNODE *cache;
+	struct IMSTREAM cmds;
+	struct IVECTOR *vector;
+	IMUTEX_TYPE lock;
+	iEventPosix *resume;
+	volatile int waiting;
+	int index;
+	int pinned;
+};
+
+struct CAsyncGroup
+{
+	struct CAsyncShard *shards;
+	iEventPosix *event;
+	volatile int running;
+	int nshards;
+	int shardbits;
+	int flags;
+	int reader;
+	long next;
 	IMUTEX_TYPE lock;
 };
 
 
-/* new queue */
-iQueueSafe *queue_safe_new(iulong maxsize)
+/*-------------------------------------------------------------------*/
+/* returns 1 if core has messages                                    */
+/*-------------------------------------------------------------------*/
+static int async_group_pending(CAsyncCore *core)
 {
-	iQueueSafe *q = (iQueueSafe*)ikmem_malloc(sizeof(iQueueSafe));
-	if (q == NULL) return NULL;
-	if (maxsize == 0) maxsize = ~maxsize;
-	q->sem = iposix_sem_new(maxsize);
-	if (q->sem == NULL) {
-		ikmem_free(q);
-		return NULL;
+	int pending;
+	IMUTEX_LOCK(&core->xmsg);
+	pending = (core->msgs.size > 0)? 1 : 0;
+	IMUTEX_UNLOCK(&core->xmsg);
+	return pending;
+}
+
+/*-------------------------------------------------------------------*/
+/* execute commands queued by other threads                          */
+/*-------------------------------------------------------------------*/
+static void async_group_dispatch(struct CAsyncShard *shard)
+{
+	char head[14];
+	IUINT32 length;
+	IUINT16 cmd;
+	IINT32 hid, code;
+	while (1) {
+		IMUTEX_LOCK(&shard->lock);
+		if (ims_peek(&shard->cmds, head, 14) < 14) {
+			IMUTEX_UNLOCK(&shard->lock);
+			break;
+		}
+		idecode32u_lsb(head, &length);
+		idecode16u_lsb(head + 4, &cmd);
+		idecode32i_lsb(head + 6, &hid);
+		idecode32i_lsb(head + 10, &code);
+		length -= 14;
+		ims_drop(&shard->cmds, 14);
+		if (shard->vector->size < (size_t)length) {
+			if (iv_resize(shard->vector, length) != 0) {
+				ims_drop(&shard->cmds, length);
+				IMUTEX_UNLOCK(&shard->lock);
+				continue;
+			}
+		}
+		ims_read(&shard->cmds, shard->vector->data, length);
+		IMUTEX_UNLOCK(&shard->lock);
+		if (cmd == ASYNC_GROUP_CMD_SEND) {
+			const void *vecptr[1];
+			long veclen[1];
+			vecptr[0] = shard->vector->data;
+			veclen[0] = (long)length;
+			async_core_send_vector(shard->core, hid, vecptr, veclen, 1,
+				(int)code);
+		}
+		else if (cmd == ASYNC_GROUP_CMD_CLOSE) {
+			async_core_close(shard->core, hid, code);
+		}
 	}
-	q->stop = 0;
-	ims_init(&q->stream, NULL, 4096, 4096);
-	IMUTEX_INIT(&q->lock);
-	return q;
 }
 
-/* delete queue */
-void queue_safe_delete(iQueueSafe *q) 
+/*-------------------------------------------------------------------*/
+/* returns 1 if the caller is not the shard thread of core           */
+/*-------------------------------------------------------------------*/
+static int async_shard_foreign(const CAsyncCore *core)
 {
-	if (q) {
-		if (q->sem) iposix_sem_delete(q->sem);
-		q->sem = NULL;
-		q->stop = 1;
-		ims_destroy(&q->stream);
-		IMUTEX_DESTROY(&q->lock);
-		ikmem_free(q);
+	if (core->owner == NULL || core->owner->thread == NULL) return 0;
+	return (iposix_thread_current() != core->owner->thread)? 1 : 0;
+}
+
+/*-------------------------------------------------------------------*/
+/* queue a command to the shard thread, returns payload size or -1   */
+/* if hid doesn't belong to the shard.                               */
+/*-------------------------------------------------------------------*/
+static long async_shard_command(struct CAsyncShard *shard, long hid, 
+	int cmd, long code, const void * const vecptr[], 
+	const long veclen[], int count)
+{
+	char head[14];
+	long size = 0;
+	int i;
+	if (async_group_shard(shard->group, hid) != shard->index) return -1;
+	for (i = 0; i < count; i++) {
+		if (veclen[i] > 0) size += veclen[i];
+	}
+	iencode32u_lsb(head, (IUINT32)(size + 14));
+	iencode16u_lsb(head + 4, (unsigned short)cmd);
+	iencode32i_lsb(head + 6, hid);
+	iencode32i_lsb(head + 10, code);
+	IMUTEX_LOCK(&shard->lock);
+	ims_write(&shard->cmds, head, 14);
+	for (i = 0; i < count; i++) {
+		if (veclen[i] > 0) ims_write(&shard->cmds, vecptr[i], veclen[i]);
 	}
+	IMUTEX_UNLOCK(&shard->lock);
+	async_core_notify(shard->core);
+	return size;
 }
 
-/* callback args */
-struct iQueueSafeArg
+/*-------------------------------------------------------------------*/
+/* shard thread keeps the core lock while polling, other threads     */
+/* must ask it to step aside before calling into the core.           */
+/*-------------------------------------------------------------------*/
+static void async_group_enter(struct CAsyncShard *shard)
 {
-	iQueueSafe *q;
-	const void *in;
-	void *out;
-};
+	IMUTEX_LOCK(&shard->lock);
+	shard->waiting++;
+	IMUTEX_UNLOCK(&shard->lock);
+	async_core_notify(shard->core);
+}
 
-/* put hook */
-void queue_safe_hook_put(iulong count, void *p)
+static void async_group_leave(struct CAsyncShard *shard)
 {
-	struct iQueueSafeArg *args = (struct iQueueSafeArg*)p;
-	ilong need = (ilong)(sizeof(void*) * count);
-	ilong hr;
-	hr = ims_write(&args->q->stream, args->in, need);
-	if (hr != need) {
-		assert(hr == need);
+	int waiting;
+	IMUTEX_LOCK(&shard->lock);
+	waiting = --shard->waiting;
+	IMUTEX_UNLOCK(&shard->lock);
+	if (waiting == 0) {
+		iposix_event_set(shard->resume);
 	}
 }
 
-/* get hook */
-void queue_safe_hook_get(iulong count, void *p)
+/*-------------------------------------------------------------------*/
+/* millisec until the next timer of core, commands and step-asides   */
+/* wake it by async_core_notify, so no timer means sleep until then. */
+/*-------------------------------------------------------------------*/
+static IUINT32 async_group_timeout(CAsyncCore *core)
 {
-	struct iQueueSafeArg *args = (struct iQueueSafeArg*)p;
-	ilong need = (ilong)(sizeof(void*) * count);
-	ilong hr;
-	hr = ims_read(&args->q->stream, args->out, need);
-	if (hr != need) {
-		assert(hr == need);
+	IUINT32 current = (IUINT32)(iclock64() & 0xfffffffful);
+	long next;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	next = itimer_wheel_next(&core->wheel, current);
+	ASYNC_CORE_CRITICAL_END(core);
+	return (next < 0)? 0x7fffffff : (IUINT32)next;
+}
+
+/*-------------------------------------------------------------------*/
+/* shard thread                                                      */
+/*-------------------------------------------------------------------*/
+static int async_group_worker(void *obj)
+{
+	struct CAsyncShard *shard = (struct CAsyncShard*)obj;
+	CAsyncGroup *group = shard->group;
+	if (group->running == 0) return 0;
+	if (shard->pinned == 0) {
+		if ((group->flags & 1) == 0) {
+			int cpus = 1;
+		#if defined(_WIN32)
+			SYSTEM_INFO info;
+			GetSystemInfo(&info);
+			cpus = (int)info.dwNumberOfProcessors;
+		#elif defined(_SC_NPROCESSORS_ONLN)
+			cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		#endif
+			cpus = (cpus < 1)? 1 : cpus;
+			iposix_thread_cpu(shard->thread, shard->index % cpus);
+		}
+		shard->pinned = 1;
 	}
+	async_group_dispatch(shard);
+	async_core_wait(shard->core, async_group_timeout(shard->core));
+	async_group_dispatch(shard);
+	if (async_group_pending(shard->core)) {
+		iposix_event_set(group->event);
+	}
+	/* step aside: sleep until the last async_group_leave */
+	while (group->running) {
+		int waiting;
+		IMUTEX_LOCK(&shard->lock);
+		waiting = shard->waiting;
+		IMUTEX_UNLOCK(&shard->lock);
+		if (waiting == 0) break;
+		iposix_event_wait(shard->resume, IEVENT_INFINITE);
+	}
+	return 1;
 }
 
-/* peek hook */
-void queue_safe_hook_peek(iulong count, void *p)
+/*-------------------------------------------------------------------*/
+/* delete group                                                      */
+/*-------------------------------------------------------------------*/
+void async_group_delete(CAsyncGroup *group)
 {
-	struct iQueueSafeArg *args = (struct iQueueSafeArg*)p;
-	ilong need = (ilong)(sizeof(void*) * count);
-	ilong hr;
-	hr = ims_peek(&args->q->stream, args->out, need);
-	if (hr != need) {
-		assert(hr == need);
+	int i;
+	if (group == NULL) return;
+	group->running = 0;
+	for (i = 0; i < group->nshards; i++) {
+		struct CAsyncShard *shard = &group->shards[i];
+		if (shard->thread) {
+			if (shard->core) async_core_notify(shard->core);
+			if (shard->resume) iposix_event_set(shard->resume);
+			iposix_thread_join(shard->thread, IEVENT_INFINITE);
+			iposix_thread_delete(shard->thread);
+			shard->thread = NULL;
+		}
+	}
+	for (i = 0; i < group->nshards; i++) {
+		struct CAsyncShard *shard = &group->shards[i];
+		if (shard->core) async_core_delete(shard->core);
+		if (shard->cache) {
+			ims_destroy(&shard->cmds);
+			imnode_delete(shard->cache);
+		}
+		if (shard->vector) iv_delete(shard->vector);
+		if (shard->resume) iposix_event_delete(shard->resume);
+		shard->core = NULL;
+		shard->cache = NULL;
+		shard->vector = NULL;
+		shard->resume = NULL;
+		IMUTEX_DESTROY(&shard->lock);
 	}
+	if (group->event) iposix_event_delete(group->event);
+	IMUTEX_DESTROY(&group->lock);
+	ikmem_free(group->shards);
+	memset(group, 0, sizeof(CAsyncGroup));
+	ikmem_free(group);
 }
 
-/* put many objs into queue, returns how many obj have entered the queue */
-int queue_safe_put_vec(iQueueSafe *q, const void * const vecptr[], 
-	int count, unsigned long millisec)
+/*-------------------------------------------------------------------*/
+/* new group                                                         */
+/*-------------------------------------------------------------------*/
+CAsyncGroup* async_group_new(int nshards, int flags)
 {
-	struct iQueueSafeArg args;
-	int hr;
-	if (q->stop || count <= 0) return 0;
-	args.q = q;
-	args.in = (const void*)vecptr;
-	hr = (int)iposix_sem_post(q->sem, count, millisec, 
-				queue_safe_hook_put, &args);
-	return hr;
+	CAsyncGroup *group;
+	int i;
+
+	if (nshards <= 0 || nshards > ASYNC_GROUP_MAX_SHARDS) return NULL;
+
+	group = (CAsyncGroup*)ikmem_malloc(sizeof(CAsyncGroup));
+	if (group == NULL) return NULL;
+
+	memset(group, 0, sizeof(CAsyncGroup));
+	group->shards = (struct CAsyncShard*)
+		ikmem_malloc(sizeof(struct CAsyncShard) * nshards);
+
+	if (group->shards == NULL) {
+		ikmem_free(group);
+		return NULL;
+	}
+
+	memset(group->shards, 0, sizeof(struct CAsyncShard) * nshards);
+	IMUTEX_INIT(&group->lock);
+
+	for (group->shardbits = 0; (1 << group->shardbits) < nshards; )
+		group->shardbits++;
+
+	group->nshards = nshards;
+	group->flags = flags;
+	group->reader = 0;
+	group->next = 0;
+	group->running = 1;
+
+	for (i = 0; i < nshards; i++) {
+		struct CAsyncShard *shard = &group->shards[i];
+		IMUTEX_INIT(&shard->lock);
+		shard->group = group;
+		shard->index = i;
+		shard->pinned = 0;
+		shard->waiting = 0;
+	}
+
+	group->event = iposix_event_new();
+	if (group->event == NULL) {
+		async_group_delete(group);
+		return NULL;
+	}
+
+	for (i = 0; i < nshards; i++) {
+		struct CAsyncShard *shard = &group->shards[i];
+		shard->core = async_core_new(0);
+		shard->cache = imnode_create(8192, 64);
+		shard->vector = iv_create();
+		shard->resume = iposix_event_new();
+		if (shard->core == NULL || shard->cache == NULL || 
+			shard->vector == NULL || shard->resume == NULL) {
+			if (shard->cache) imnode_delete(shard->cache);
+			shard->cache = NULL;
+			async_group_delete(group);
+			return NULL;
+		}
+		ims_init(&shard->cmds, shard->cache, 0, 0);
+		shard->core->shard = i;
+		shard->core->shardbits = group->shardbits;
+		shard->core->owner = shard;
+		shard->thread = iposix_thread_new(async_group_worker, shard, 
+			"async_group");
+		if (shard->thread == NULL) {
+			async_group_delete(group);
+			return NULL;
+		}
+	}
+
+	for (i = 0; i < nshards; i++) {
+		if (iposix_thread_start(group->shards[i].thread) != 0) {
+			async_group_delete(group);
+			return NULL;
+		}
+	}
+
+	return group;
 }
 
-/* get objs from queue, returns how many obj have been fetched */
-int queue_safe_get_vec(iQueueSafe *q, void *vecptr[], int count,
-	unsigned long millisec)
+/*-------------------------------------------------------------------*/
+/* get shard count                                                   */
+/*-------------------------------------------------------------------*/
+int async_group_count(const CAsyncGroup *group)
 {
-	struct iQueueSafeArg args;
-	int hr;
-	if (q->stop || count <= 0) return 0;
-	args.q = q;
-	args.out = (void*)vecptr;
-	hr = (int)iposix_sem_wait(q->sem, count, millisec, 
-				queue_safe_hook_get, &args);
-	return hr;
+	return group->nshards;
 }
 
-/* peek objs from queue, returns how many obj have been peeken */
-int queue_safe_peek_vec(iQueueSafe *q, void *vecptr[], int count, 
-	unsigned long millisec)
+/*-------------------------------------------------------------------*/
+/* get shard core                                                    */
+/*-------------------------------------------------------------------*/
+CAsyncCore* async_group_core(CAsyncGroup *group, int shard)
 {
-	struct iQueueSafeArg args;
-	int hr;
-	if (q->stop || count <= 0) return 0;
-	args.q = q;
-	args.out = (void*)vecptr;
-	hr = (int)iposix_sem_peek(q->sem, count, millisec, 
-				queue_safe_hook_peek, &args);
-	return hr;
+	if (shard < 0 || shard >= group->nshards) return NULL;
+	return group->shards[shard].core;
 }
 
-/* put obj into queue, returns 1 for success, 0 for full */
-int queue_safe_put(iQueueSafe *q, void *ptr, unsigned long millisec)
+/*-------------------------------------------------------------------*/
+/* step the shard thread aside for direct calls on its core          */
+/*-------------------------------------------------------------------*/
+void async_group_suspend(CAsyncGroup *group, int shard)
 {
-	const void * const vecptr[1] = { ptr };
-	return queue_safe_put_vec(q, vecptr, 1, millisec);
+	if (shard < 0 || shard >= group->nshards) return;
+	async_group_enter(&group->shards[shard]);
 }
 
-/* get obj from queue, returns 1 for success, 0 for empty */
-int queue_safe_get(iQueueSafe *q, void **ptr, unsigned long millisec)
+void async_group_resume(CAsyncGroup *group, int shard)
 {
-	void *vecptr[1];
-	int hr;
-	hr = queue_safe_get_vec(q, vecptr, 1, millisec);
-	if (ptr) ptr[0] = vecptr[0];
-	return hr;
+	if (shard < 0 || shard >= group->nshards) return;
+	async_group_leave(&group->shards[shard]);
 }
 
-/* peek obj from queue, returns 1 for success, 0 for empty */
-int queue_safe_peek(iQueueSafe *q, void **ptr, unsigned long millisec)
+/*-------------------------------------------------------------------*/
+/* get shard index of the hid                                        */
+/*-------------------------------------------------------------------*/
+int async_group_shard(const CAsyncGroup *group, long hid)
 {
-	void *vecptr[1];
-	int hr;
-	hr = queue_safe_peek_vec(q, vecptr, 1, millisec);
-	if (ptr) ptr[0] = vecptr[0];
-	return hr;
+	int shard;
+	if (hid < 0) return -1;
+	shard = (int)((hid >> 16) & ((1 << group->shardbits) - 1));
+	if (shard >= group->nshards) return -1;
+	return shard;
 }
 
-/* get size */
-iulong queue_safe_size(iQueueSafe *q)
+/*-------------------------------------------------------------------*/
+/* wait until any shard has messages                                 */
+/*-------------------------------------------------------------------*/
+void async_group_wait(CAsyncGroup *group, IUINT32 millisec)
 {
-	return iposix_sem_value(q->sem);
+	int i;
+	for (i = 0; i < group->nshards; i++) {
+		if (async_group_pending(group->shards[i].core)) return;
+	}
+	if (millisec > 0) {
+		iposix_event_wait(group->event, millisec);
+	}
+}
+
+/*-------------------------------------------------------------------*/
+/* wake async_group_wait up                                          */
+/*-------------------------------------------------------------------*/
+void async_group_notify(CAsyncGroup *group)
+{
+	iposix_event_set(group->event);
+}
+
+/*-------------------------------------------------------------------*/
+/* read events                                                       */
+/*-------------------------------------------------------------------*/
+long async_group_read(CAsyncGroup *group, int *event, long *wparam,
+	long *lparam, void *data, long size)
+{
+	int i;
+	for (i = 0; i < group->nshards; i++) {
+		int k = (group->reader + i) % group->nshards;
+		CAsyncCore *core = group->shards[k].core;
+		long hr = async_core_read(core, event, wparam, lparam, data, size);
+		if (hr == -1) continue;
+		/* stay on the same shard after a size query */
+		if (data == NULL || hr == -2) group->reader = k;
+		else group->reader = (k + 1) % group->nshards;
+		return hr;
+	}
+	return -1;
+}
+
+/*-------------------------------------------------------------------*/
+/* queue a command to the shard of hid                               */
+/*-------------------------------------------------------------------*/
+static int async_group_command(CAsyncGroup *group, long hid, int cmd,
+	long code, const void *ptr, long size)
+{
+	const void *vecptr[1];
+	long veclen[1];
+	int index = async_group_shard(group, hid);
+	if (index < 0) return -1;
+	vecptr[0] = ptr;
+	veclen[0] = size;
+	if (async_shard_command(&group->shards[index], hid, cmd, code, 
+		vecptr, veclen, (ptr != NULL)? 1 : 0) < 0) 
+		return -1;
+	return 0;
+}
+
+/*-------------------------------------------------------------------*/
+/* send data to given hid                                            */
+/*-------------------------------------------------------------------*/
+long async_group_send(CAsyncGroup *group, long hid, const void *ptr, 
+	long len)
+{
+	if (async_group_command(group, hid, ASYNC_GROUP_CMD_SEND, 0, 
+		ptr, len) != 0) 
+		return -100;
+	return len;
+}
+
+/*-------------------------------------------------------------------*/
+/* close given hid                                                   */
+/*-------------------------------------------------------------------*/
+int async_group_close(CAsyncGroup *group, long hid, int code)
+{
+	return async_group_command(group, hid, ASYNC_GROUP_CMD_CLOSE, code,
+		NULL, 0);
+}
+
+/*-------------------------------------------------------------------*/
+/* new listener in every shard                                       */
+/*-------------------------------------------------------------------*/
+long async_group_new_listen(CAsyncGroup *group, 
+	const struct sockaddr *addr, int addrlen, int header)
+{
+	long hids[ASYNC_GROUP_MAX_SHARDS];
+	int flag = (header >> 8) & 0xff;
+	int count = 1, i;
+#ifdef SO_REUSEPORT
+	count = group->nshards;
+#endif
+	if ((flag & 0x80) == 0) flag = 0x80 | ISOCK_UNIXREUSE;
+	flag |= ISOCK_REUSEPORT;
+	header = (header & 0xff) | (flag << 8);
+	for (i = 0; i < count; i++) {
+		struct CAsyncShard *shard = &group->shards[i];
+		async_group_enter(shard);
+		hids[i] = async_core_new_listen(shard->core, addr, addrlen, header);
+		async_group_leave(shard);
+		if (hids[i] < 0) {
+			long hr = hids[i];
+			for (i--; i >= 0; i--) {
+				async_group_close(group, hids[i], 0);
+			}
+			return hr;
+		}
+	}
+	return hids[0];
+}
+
+/*-------------------------------------------------------------------*/
+/* new connection in the next shard                                  */
+/*-------------------------------------------------------------------*/
+long async_group_new_connect(CAsyncGroup *group, 
+	const struct sockaddr *addr, int addrlen, int header)
+{
+	struct CAsyncShard *shard;
+	long hid;
+	IMUTEX_LOCK(&group->lock);
+	shard = &group->shards[group->next];
+	group->next = (group->next + 1) % group->nshards;
+	IMUTEX_UNLOCK(&group->lock);
+	async_group_enter(shard);
+	hid = async_core_new_connect(shard->core, addr, addrlen, header);
+	async_group_leave(shard);
+	return hid;
+}
+
+
+/*===================================================================*/
+/* Thread Safe Queue                                                 */
+/*===================================================================*/
+#if defined(__clang__) || (defined(__GNUC__) && ((__GNUC__ > 4) || \
+	((__GNUC__ == 4) && (__GNUC_MINOR__ >= 7))))
+	#define IQS_LOAD(p)         __atomic_load_n(p, __ATOMIC_ACQUIRE)
+	#define IQS_STORE(p, v)     __atomic_store_n(p, v, __ATOMIC_RELEASE)
+	#define IQS_CAS(p, o, n)    __sync_bool_compare_and_swap(p, o, n)
+	#define IQS_ADD(p, x)       __sync_fetch_and_add(p, x)
+	#define IQS_FENCE()         __sync_synchronize()
+	#define IQUEUE_SAFE_RING
+#elif defined(_MSC_VER) && (!defined(_M_PPC)) && (!defined(_XBOX))
+	/* msvc volatile accesses have acquire/release semantics */
+	#define IQS_LOAD(p)         (*(p))
+	#define IQS_STORE(p, v)     (*(p) = (v))
+	#define IQS_CAS(p, o, n)    (InterlockedCompareExchangePointer( \
+		(PVOID volatile*)(p), (PVOID)(n), (PVOID)(o)) == (PVOID)(o))
+	#define IQS_ADD(p, x)       InterlockedExchangeAdd((LONG volatile*)(p), x)
+	#define IQS_FENCE()         MemoryBarrier()
+	#define IQUEUE_SAFE_RING
+#endif
+
+#include <limits.h>
+
+#ifdef IQUEUE_SAFE_RING
+
+#if defined(__linux__) && (!defined(IQUEUE_SAFE_NO_FUTEX))
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#define IQUEUE_SAFE_FUTEX
+#endif
+
+#define IQUEUE_SAFE_CACHELINE	64
+#define IQUEUE_SAFE_SPIN		64
+#define IQUEUE_SAFE_DEFAULT		4096
+
+/* Vyukov's bounded ring: cell seq tells whom the cell belongs to,
+   seq == pos: free for producer at pos, seq == pos + 1: ready for
+   consumer at pos, so producers and consumers only contend on their
+   own index and never take a lock on the fast path */
+struct iQueueCell
+{
+	volatile size_t seq;
+	void *data;
+};
+
+/* waiters only pay for the futex/condition when ring is empty/full,
+   wakers skip the syscall if nobody is waiting */
+struct iQueueWait
+{
+	volatile int seq;
+	volatile int waiters;
+#ifndef IQUEUE_SAFE_FUTEX
+	IMUTEX_TYPE lock;
+	iConditionVariable *cond;
+#endif
+};
+
+struct iQueueSafe
+{
+	volatile size_t head;
+	char pad1[IQUEUE_SAFE_CACHELINE - sizeof(size_t)];
+	volatile size_t tail;
+	char pad2[IQUEUE_SAFE_CACHELINE - sizeof(size_t)];
+	struct iQueueCell *cells;
+	size_t mask;
+	int flags;
+	int stop;
+	int unbounded;
+	volatile long overflow;
+	struct iQueueWait not_empty;
+	struct iQueueWait not_full;
+	struct IMSTREAM stream;
+	IMUTEX_TYPE lock;
+};
+
+
+/* init wait object */
+static int queue_wait_init(struct iQueueWait *w)
+{
+	w->seq = 0;
+	w->waiters = 0;
+#ifndef IQUEUE_SAFE_FUTEX
+	w->cond = iposix_cond_new();
+	if (w->cond == NULL) return -1;
+	IMUTEX_INIT(&w->lock);
+#endif
+	return 0;
+}
+
+/* destroy wait object */
+static void queue_wait_destroy(struct iQueueWait *w)
+{
+#ifndef IQUEUE_SAFE_FUTEX
+	if (w->cond) {
+		iposix_cond_delete(w->cond);
+		w->cond = NULL;
+		IMUTEX_DESTROY(&w->lock);
+	}
+#else
+	w->seq = 0;
+#endif
+}
+
+/* register as a waiter, recheck the ring after it */
+static int queue_wait_prepare(struct iQueueWait *w)
+{
+	IQS_ADD(&w->waiters, 1);
+	return IQS_LOAD(&w->seq);
+}
+
+/* unregister without sleeping */
+static void queue_wait_cancel(struct iQueueWait *w)
+{
+	IQS_ADD(&w->waiters, -1);
+}
+
+/* sleep until seq changed or timeout */
+static void queue_wait_sleep(struct iQueueWait *w, int seq,
+	unsigned long millisec)
+{
+#ifdef IQUEUE_SAFE_FUTEX
+	struct timespec ts;
+	struct timespec *pts = NULL;
+	if (millisec != IEVENT_INFINITE) {
+		ts.tv_sec = (time_t)(millisec / 1000);
+		ts.tv_nsec = (long)((millisec % 1000) * 1000000);
+		pts = &ts;
+	}
+	syscall(SYS_futex, &w->seq, FUTEX_WAIT_PRIVATE, seq, pts, NULL, 0);
+#else
+	IMUTEX_LOCK(&w->lock);
+	if (w->seq == seq) {
+		if (millisec == IEVENT_INFINITE) {
+			iposix_cond_sleep_cs(w->cond, &w->lock);
+		}	else {
+			iposix_cond_sleep_cs_time(w->cond, &w->lock, millisec);
+		}
+	}
+	IMUTEX_UNLOCK(&w->lock);
+#endif
+	IQS_ADD(&w->waiters, -1);
+}
+
+/* wake up to count waiters, nothing to do if no one is waiting */
+static void queue_wait_wake(struct iQueueWait *w, int count)
+{
+	IQS_FENCE();
+	if (IQS_LOAD(&w->waiters) <= 0) return;
+#ifdef IQUEUE_SAFE_FUTEX
+	IQS_ADD(&w->seq, 1);
+	syscall(SYS_futex, &w->seq, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+#else
+	IMUTEX_LOCK(&w->lock);
+	w->seq++;
+	if (count == 1) iposix_cond_wake(w->cond);
+	else iposix_cond_wake_all(w->cond);
+	IMUTEX_UNLOCK(&w->lock);
+#endif
+}
+
+
+/* new queue */
+iQueueSafe *queue_safe_new_ex(iulong maxsize, int flags)
+{
+	iQueueSafe *q = (iQueueSafe*)ikmem_malloc(sizeof(iQueueSafe));
+	size_t capacity = 2, i;
+	if (q == NULL) return NULL;
+	q->unbounded = (maxsize == 0)? 1 : 0;
+	if (maxsize == 0) maxsize = IQUEUE_SAFE_DEFAULT;
+	while (capacity < (size_t)maxsize) capacity <<= 1;
+	q->cells = (struct iQueueCell*)
+		ikmem_malloc(sizeof(struct iQueueCell) * capacity);
+	if (q->cells == NULL) {
+		ikmem_free(q);
+		return NULL;
+	}
+	for (i = 0; i < capacity; i++) {
+		q->cells[i].seq = i;
+		q->cells[i].data = NULL;
+	}
+	if (queue_wait_init(&q->not_empty) != 0) {
+		ikmem_free(q->cells);
+		ikmem_free(q);
+		return NULL;
+	}
+	if (queue_wait_init(&q->not_full) != 0) {
+		queue_wait_destroy(&q->not_empty);
+		ikmem_free(q->cells);
+		ikmem_free(q);
+		return NULL;
+	}
+	q->head = 0;
+	q->tail = 0;
+	q->mask = capacity - 1;
+	q->flags = flags;
+	q->stop = 0;
+	q->overflow = 0;
+	ims_init(&q->stream, NULL, 4096, 4096);
+	IMUTEX_INIT(&q->lock);
+	return q;
+}
+
+/* delete queue */
+void queue_safe_delete(iQueueSafe *q)
+{
+	if (q) {
+		q->stop = 1;
+		queue_wait_wake(&q->not_empty, INT_MAX);
+		queue_wait_wake(&q->not_full, INT_MAX);
+		queue_wait_destroy(&q->not_empty);
+		queue_wait_destroy(&q->not_full);
+		ims_destroy(&q->stream);
+		IMUTEX_DESTROY(&q->lock);
+		ikmem_free(q->cells);
+		ikmem_free(q);
+	}
+}
+
+/* push into ring, returns how many objs pushed */
+static int queue_ring_push(iQueueSafe *q, const void * const vecptr[],
+	int count)
+{
+	struct iQueueCell *cell;
+	size_t pos, seq;
+	int i = 0;
+	if (q->flags & QUEUE_SAFE_SP) {
+		for (pos = q->tail; i < count; i++, pos++) {
+			cell = &q->cells[pos & q->mask];
+			if (IQS_LOAD(&cell->seq) != pos) break;
+			cell->data = (void*)vecptr[i];
+			IQS_STORE(&cell->seq, pos + 1);
+		}
+		IQS_STORE(&q->tail, pos);
+		return i;
+	}
+	while (i < count) {
+		pos = IQS_LOAD(&q->tail);
+		cell = &q->cells[pos & q->mask];
+		seq = IQS_LOAD(&cell->seq);
+		if (seq == pos) {
+			if (IQS_CAS(&q->tail, pos, pos + 1)) {
+				cell->data = (void*)vecptr[i++];
+				IQS_STORE(&cell->seq, pos + 1);
+			}
+		}
+		else if ((ilong)(seq - pos) < 0) {
+			break;
+		}
+	}
+	return i;
+}
+
+/* pop from ring, returns how many objs popped */
+static int queue_ring_pop(iQueueSafe *q, void *vecptr[], int count)
+{
+	struct iQueueCell *cell;
+	size_t pos, seq;
+	int i = 0;
+	if (q->flags & QUEUE_SAFE_SC) {
+		for (pos = q->head; i < count; i++, pos++) {
+			cell = &q->cells[pos & q->mask];
+			if (IQS_LOAD(&cell->seq) != pos + 1) break;
+			vecptr[i] = cell->data;
+			IQS_STORE(&cell->seq, pos + q->mask + 1);
+		}
+		IQS_STORE(&q->head, pos);
+		return i;
+	}
+	while (i < count) {
+		pos = IQS_LOAD(&q->head);
+		cell = &q->cells[pos & q->mask];
+		seq = IQS_LOAD(&cell->seq);
+		if (seq == pos + 1) {
+			if (IQS_CAS(&q->head, pos, pos + 1)) {
+				vecptr[i++] = cell->data;
+				IQS_STORE(&cell->seq, pos + q->mask + 1);
+			}
+		}
+		else if ((ilong)(seq - (pos + 1)) < 0) {
+			break;
+		}
+	}
+	return i;
+}
+
+/* copy from ring head without consuming, a cell recycled during
+   the copy ends the peek */
+static int queue_ring_peek(iQueueSafe *q, void *vecptr[], int count)
+{
+	struct iQueueCell *cell;
+	size_t pos = IQS_LOAD(&q->head);
+	void *data;
+	int i;
+	for (i = 0; i < count; i++, pos++) {
+		cell = &q->cells[pos & q->mask];
+		if (IQS_LOAD(&cell->seq) != pos + 1) break;
+		data = cell->data;
+		IQS_FENCE();
+		if (IQS_LOAD(&cell->seq) != pos + 1) break;
+		vecptr[i] = data;
+	}
+	return i;
+}
+
+/* unbounded queue: objs go to the locked stream when ring is full,
+   and keep going there until consumers drained it, so the order of
+   objs from one producer is preserved */
+static int queue_safe_try_put(iQueueSafe *q, const void * const vecptr[],
+	int count)
+{
+	int n = 0;
+	if (q->unbounded == 0 || IQS_LOAD(&q->overflow) == 0) {
+		n = queue_ring_push(q, vecptr, count);
+		if (n == count || q->unbounded == 0) return n;
+	}
+	IMUTEX_LOCK(&q->lock);
+	ims_write(&q->stream, vecptr + n, (ilong)(sizeof(void*) * (count - n)));
+	IQS_ADD(&q->overflow, (long)(count - n));
+	IMUTEX_UNLOCK(&q->lock);
+	return count;
+}
+
+/* pop from ring first, then from the stream */
+static int queue_safe_try_get(iQueueSafe *q, void *vecptr[], int count,
+	int peek)
+{
+	int n, k;
+	if (peek == 0) n = queue_ring_pop(q, vecptr, count);
+	else n = queue_ring_peek(q, vecptr, count);
+	if (n == count || IQS_LOAD(&q->overflow) == 0) return n;
+	IMUTEX_LOCK(&q->lock);
+	k = (int)(ims_dsize(&q->stream) / sizeof(void*));
+	if (k > count - n) k = count - n;
+	if (k > 0) {
+		ilong size = (ilong)(sizeof(void*) * k);
+		if (peek == 0) {
+			ims_read(&q->stream, vecptr + n, size);
+			IQS_ADD(&q->overflow, -((long)k));
+		}	else {
+			ims_peek(&q->stream, vecptr + n, size);
+		}
+		n += k;
+	}
+	IMUTEX_UNLOCK(&q->lock);
+	return n;
+}
+
+/* try operation, spin a little and then sleep on wait object */
+static int queue_safe_operate(iQueueSafe *q, int op, void *vecptr[],
+	int count, unsigned long millisec)
+{
+	struct iQueueWait *w = (op == 0)? &q->not_full : &q->not_empty;
+	IUINT32 ts = 0;
+	int spin, seq, n = 0;
+	for (spin = 0; ; spin++) {
+		if (op == 0) n = queue_safe_try_put(q, (const void * const *)vecptr, count);
+		else n = queue_safe_try_get(q, vecptr, count, op - 1);
+		if (n > 0 || millisec == 0 || q->stop) return n;
+		if (spin < IQUEUE_SAFE_SPIN) continue;
+		if (spin == IQUEUE_SAFE_SPIN) ts = iclock();
+		seq = queue_wait_prepare(w);
+		if (op == 0) n = queue_safe_try_put(q, (const void * const *)vecptr, count);
+		else n = queue_safe_try_get(q, vecptr, count, op - 1);
+		if (n > 0 || q->stop) {
+			queue_wait_cancel(w);
+			return n;
+		}
+		if (millisec != IEVENT_INFINITE) {
+			IUINT32 passed = iclock() - ts;
+			if ((unsigned long)passed >= millisec) {
+				queue_wait_cancel(w);
+				return 0;
+			}
+			queue_wait_sleep(w, seq, millisec - passed);
+		}	else {
+			queue_wait_sleep(w, seq, IEVENT_INFINITE);
+		}
+	}
+	return n;
+}
+
+/* put many objs into queue, returns how many obj have entered the queue */
+int queue_safe_put_vec(iQueueSafe *q, const void * const vecptr[],
+	int count, unsigned long millisec)
+{
+	int hr;
+	if (q->stop || count <= 0) return 0;
+	hr = queue_safe_operate(q, 0, (void**)vecptr, count, millisec);
+	if (hr > 0) queue_wait_wake(&q->not_empty, hr);
+	return hr;
+}
+
+/* get objs from queue, returns how many obj have been fetched */
+int queue_safe_get_vec(iQueueSafe *q, void *vecptr[], int count,
+	unsigned long millisec)
+{
+	int hr;
+	if (q->stop || count <= 0) return 0;
+	hr = queue_safe_operate(q, 1, vecptr, count, millisec);
+	if (hr > 0 && q->unbounded == 0) queue_wait_wake(&q->not_full, hr);
+	return hr;
+}
+
+/* peek objs from queue, returns how many obj have been peeken */
+int queue_safe_peek_vec(iQueueSafe *q, void *vecptr[], int count,
+	unsigned long millisec)
+{
+	if (q->stop || count <= 0) return 0;
+	return queue_safe_operate(q, 2, vecptr, count, millisec);
+}
+
+/* get size */
+iulong queue_safe_size(iQueueSafe *q)
+{
+	size_t head = IQS_LOAD(&q->head);
+	size_t tail = IQS_LOAD(&q->tail);
+	ilong size = (ilong)(tail - head);
+	if (size < 0) size = 0;
+	if (size > (ilong)(q->mask + 1)) size = (ilong)(q->mask + 1);
+	return (iulong)size + (iulong)IQS_LOAD(&q->overflow);
+}
+
+#else
+
+/* no atomic operations available: everything is done under lock */
+struct iQueueWait
+{
+	int seq;
+	int waiters;
+	IMUTEX_TYPE lock;
+	iConditionVariable *cond;
+};
+
+static int queue_wait_init(struct iQueueWait *w)
+{
+	w->seq = 0;
+	w->waiters = 0;
+	w->cond = iposix_cond_new();
+	if (w->cond == NULL) return -1;
+	IMUTEX_INIT(&w->lock);
+	return 0;
+}
+
+static void queue_wait_destroy(struct iQueueWait *w)
+{
+	if (w->cond) {
+		iposix_cond_delete(w->cond);
+		w->cond = NULL;
+		IMUTEX_DESTROY(&w->lock);
+	}
+}
+
+static int queue_wait_prepare(struct iQueueWait *w)
+{
+	int seq;
+	IMUTEX_LOCK(&w->lock);
+	w->waiters++;
+	seq = w->seq;
+	IMUTEX_UNLOCK(&w->lock);
+	return seq;
+}
+
+static void queue_wait_cancel(struct iQueueWait *w)
+{
+	IMUTEX_LOCK(&w->lock);
+	w->waiters--;
+	IMUTEX_UNLOCK(&w->lock);
+}
+
+static void queue_wait_sleep(struct iQueueWait *w, int seq,
+	unsigned long millisec)
+{
+	IMUTEX_LOCK(&w->lock);
+	if (w->seq == seq) {
+		if (millisec == IEVENT_INFINITE) {
+			iposix_cond_sleep_cs(w->cond, &w->lock);
+		}	else {
+			iposix_cond_sleep_cs_time(w->cond, &w->lock, millisec);
+		}
+	}
+	w->waiters--;
+	IMUTEX_UNLOCK(&w->lock);
+}
+
+static void queue_wait_wake(struct iQueueWait *w, int count)
+{
+	IMUTEX_LOCK(&w->lock);
+	if (w->waiters > 0) {
+		w->seq++;
+		if (count == 1) iposix_cond_wake(w->cond);
+		else iposix_cond_wake_all(w->cond);
+	}
+	IMUTEX_UNLOCK(&w->lock);
+}
+
+/* mutex + semaphore around a stream */
+struct iQueueSafe
+{
+	iPosixSemaphore *sem;
+	struct IMSTREAM stream;
+	int stop;
+	IMUTEX_TYPE lock;
+};
+
+
+/* new queue */
+iQueueSafe *queue_safe_new_ex(iulong maxsize, int flags)
+{
+	iQueueSafe *q = (iQueueSafe*)ikmem_malloc(sizeof(iQueueSafe));
+	if (q == NULL) return NULL;
+	if (maxsize == 0) maxsize = ~maxsize;
+	q->sem = iposix_sem_new(maxsize);
+	if (q->sem == NULL) {
+		ikmem_free(q);
+		return NULL;
+	}
+	q->stop = 0;
+	ims_init(&q->stream, NULL, 4096, 4096);
+	IMUTEX_INIT(&q->lock);
+	return q;
+}
+
+/* delete queue */
+void queue_safe_delete(iQueueSafe *q) 
+{
+	if (q) {
+		if (q->sem) iposix_sem_delete(q->sem);
+		q->sem = NULL;
+		q->stop = 1;
+		ims_destroy(&q->stream);
+		IMUTEX_DESTROY(&q->lock);
+		ikmem_free(q);
+	}
+}
+
+/* callback args */
+struct iQueueSafeArg
+{
+	iQueueSafe *q;
+	const void *in;
+	void *out;
+};
+
+/* put hook */
+void queue_safe_hook_put(iulong count, void *p)
+{
+	struct iQueueSafeArg *args = (struct iQueueSafeArg*)p;
+	ilong need = (ilong)(sizeof(void*) * count);
+	ilong hr;
+	hr = ims_write(&args->q->stream, args->in, need);
+	if (hr != need) {
+		assert(hr == need);
+	}
+}
+
+/* get hook */
+void queue_safe_hook_get(iulong count, void *p)
+{
+	struct iQueueSafeArg *args = (struct iQueueSafeArg*)p;
+	ilong need = (ilong)(sizeof(void*) * count);
+	ilong hr;
+	hr = ims_read(&args->q->stream, args->out, need);
+	if (hr != need) {
+		assert(hr == need);
+	}
+}
+
+/* peek hook */
+void queue_safe_hook_peek(iulong count, void *p)
+{
+	struct iQueueSafeArg *args = (struct iQueueSafeArg*)p;
+	ilong need = (ilong)(sizeof(void*) * count);
+	ilong hr;
+	hr = ims_peek(&args->q->stream, args->out, need);
+	if (hr != need) {
+		assert(hr == need);
+	}
+}
+
+/* put many objs into queue, returns how many obj have entered the queue */
+int queue_safe_put_vec(iQueueSafe *q, const void * const vecptr[], 
+	int count, unsigned long millisec)
+{
+	struct iQueueSafeArg args;
+	int hr;
+	if (q->stop || count <= 0) return 0;
+	args.q = q;
+	args.in = (const void*)vecptr;
+	hr = (int)iposix_sem_post(q->sem, count, millisec, 
+				queue_safe_hook_put, &args);
+	return hr;
+}
+
+/* get objs from queue, returns how many obj have been fetched */
+int queue_safe_get_vec(iQueueSafe *q, void *vecptr[], int count,
+	unsigned long millisec)
+{
+	struct iQueueSafeArg args;
+	int hr;
+	if (q->stop || count <= 0) return 0;
+	args.q = q;
+	args.out = (void*)vecptr;
+	hr = (int)iposix_sem_wait(q->sem, count, millisec, 
+				queue_safe_hook_get, &args);
+	return hr;
+}
+
+/* peek objs from queue, returns how many obj have been peeken */
+int queue_safe_peek_vec(iQueueSafe *q, void *vecptr[], int count, 
+	unsigned long millisec)
+{
+	struct iQueueSafeArg args;
+	int hr;
+	if (q->stop || count <= 0) return 0;
+	args.q = q;
+	args.out = (void*)vecptr;
+	hr = (int)iposix_sem_peek(q->sem, count, millisec, 
+				queue_safe_hook_peek, &args);
+	return hr;
+}
+
+/* get size */
+iulong queue_safe_size(iQueueSafe *q)
+{
+	return iposix_sem_value(q->sem);
+}
+
+#endif
+
+
+/* new queue */
+iQueueSafe *queue_safe_new(iulong maxsize)
+{
+	return queue_safe_new_ex(maxsize, 0);
+}
+
+/* put obj into queue, returns 1 for success, 0 for full */
+int queue_safe_put(iQueueSafe *q, void *ptr, unsigned long millisec)
+{
+	const void * const vecptr[1] = { ptr };
+	return queue_safe_put_vec(q, vecptr, 1, millisec);
+}
+
+/* get obj from queue, returns 1 for success, 0 for empty */
+int queue_safe_get(iQueueSafe *q, void **ptr, unsigned long millisec)
+{
+	void *vecptr[1];
+	int hr;
+	hr = queue_safe_get_vec(q, vecptr, 1, millisec);
+	if (ptr) ptr[0] = vecptr[0];
+	return hr;
+}
+
+/* peek obj from queue, returns 1 for success, 0 for empty */
+int queue_safe_peek(iQueueSafe *q, void **ptr, unsigned long millisec)
+{
+	void *vecptr[1];
+	int hr;
+	hr = queue_safe_peek_vec(q, vecptr, 1, millisec);
+	if (ptr) ptr[0] = vecptr[0];
+	return hr;
+}
+
+
+/*===================================================================*/
+/* Work Stealing Scheduler                                           */
+/*===================================================================*/
+#ifdef IQUEUE_SAFE_RING
+
+/* Chase-Lev deque with fixed capacity: the owner pushes and pops
+   at bottom without locking, thieves take from top by CAS */
+struct iStealDeque
+{
+	volatile size_t top;
+	char pad1[IQUEUE_SAFE_CACHELINE - sizeof(size_t)];
+	volatile size_t bottom;
+	char pad2[IQUEUE_SAFE_CACHELINE - sizeof(size_t)];
+	void * volatile *buffer;
+	size_t mask;
+};
+
+#else
+
+/* locked deque, same semantics */
+struct iStealDeque
+{
+	size_t top;
+	size_t bottom;
+	void **buffer;
+	size_t mask;
+	IMUTEX_TYPE lock;
+};
+
+#endif
+
+
+/* new deque, capacity is rounded up to power of 2 */
+iStealDeque *steal_deque_new(iulong capacity)
+{
+	iStealDeque *d = (iStealDeque*)ikmem_malloc(sizeof(iStealDeque));
+	size_t size = 2;
+	if (d == NULL) return NULL;
+	while (size < (size_t)capacity) size <<= 1;
+	d->buffer = (void**)ikmem_malloc(sizeof(void*) * size);
+	if (d->buffer == NULL) {
+		ikmem_free(d);
+		return NULL;
+	}
+	d->top = 0;
+	d->bottom = 0;
+	d->mask = size - 1;
+#ifndef IQUEUE_SAFE_RING
+	IMUTEX_INIT(&d->lock);
+#endif
+	return d;
+}
+
+/* delete deque */
+void steal_deque_delete(iStealDeque *d)
+{
+	if (d) {
+#ifndef IQUEUE_SAFE_RING
+		IMUTEX_DESTROY(&d->lock);
+#endif
+		ikmem_free((void*)d->buffer);
+		ikmem_free(d);
+	}
+}
+
+/* owner only: push at bottom, returns 1 for success, 0 for full */
+int steal_deque_push(iStealDeque *d, void *ptr)
+{
+#ifdef IQUEUE_SAFE_RING
+	size_t b = d->bottom;
+	size_t t = IQS_LOAD(&d->top);
+	if (b - t > d->mask) return 0;
+	d->buffer[b & d->mask] = ptr;
+	IQS_STORE(&d->bottom, b + 1);
+	return 1;
+#else
+	int hr = 0;
+	IMUTEX_LOCK(&d->lock);
+	if (d->bottom - d->top <= d->mask) {
+		d->buffer[d->bottom++ & d->mask] = ptr;
+		hr = 1;
+	}
+	IMUTEX_UNLOCK(&d->lock);
+	return hr;
+#endif
+}
+
+/* owner only: pop from bottom (LIFO), returns 1 for success, 0 for empty */
+int steal_deque_pop(iStealDeque *d, void **ptr)
+{
+#ifdef IQUEUE_SAFE_RING
+	size_t b = d->bottom - 1;
+	size_t t;
+	int hr = 1;
+	IQS_STORE(&d->bottom, b);
+	IQS_FENCE();
+	t = IQS_LOAD(&d->top);
+	if ((ilong)(b - t) < 0) {
+		IQS_STORE(&d->bottom, b + 1);
+		return 0;
+	}
+	ptr[0] = d->buffer[b & d->mask];
+	if (b == t) {
+		/* last one: race with thieves */
+		if (!IQS_CAS(&d->top, t, t + 1)) hr = 0;
+		IQS_STORE(&d->bottom, b + 1);
+	}
+	return hr;
+#else
+	int hr = 0;
+	IMUTEX_LOCK(&d->lock);
+	if (d->bottom != d->top) {
+		ptr[0] = d->buffer[--d->bottom & d->mask];
+		hr = 1;
+	}
+	IMUTEX_UNLOCK(&d->lock);
+	return hr;
+#endif
+}
+
+/* any thread: take from top (FIFO), returns 1 for success, 0 for
+   empty, -1 for losing the race to another thief or the owner */
+int steal_deque_steal(iStealDeque *d, void **ptr)
+{
+#ifdef IQUEUE_SAFE_RING
+	size_t t = IQS_LOAD(&d->top);
+	size_t b;
+	void *p;
+	IQS_FENCE();
+	b = IQS_LOAD(&d->bottom);
+	if ((ilong)(b - t) <= 0) return 0;
+	p = d->buffer[t & d->mask];
+	if (!IQS_CAS(&d->top, t, t + 1)) return -1;
+	ptr[0] = p;
+	return 1;
+#else
+	int hr = 0;
+	IMUTEX_LOCK(&d->lock);
+	if (d->bottom != d->top) {
+		ptr[0] = d->buffer[d->top++ & d->mask];
+		hr = 1;
+	}
+	IMUTEX_UNLOCK(&d->lock);
+	return hr;
+#endif
+}
+
+/* approximate size */
+iulong steal_deque_size(const iStealDeque *d)
+{
+	ilong size = (ilong)(d->bottom - d->top);
+	return (size < 0)? 0 : (iulong)size;
+}
+
+
+/* each worker owns a deque and an inbox per priority: tasks pushed by
+   a worker go to its own deque, others go to the inbox of the hinted
+   (or next) worker. idle workers look for work from high priority to
+   low, own queues first, then steal from the others, and park on
+   one wait object which is only signaled when someone is parked */
+struct iTaskSched
+{
+	int workers;
+	int priorities;
+	unsigned int next;
+	volatile int stop;
+	volatile long running;
+	iQueueSafe **inbox;
+	iStealDeque **deque;
+	struct iQueueWait idle;
+};
+
+
+/* new scheduler */
+iTaskSched *task_sched_new(int workers, int priorities, iulong capacity)
+{
+	iTaskSched *s;
+	int count, i;
+	if (workers <= 0 || priorities <= 0) return NULL;
+	s = (iTaskSched*)ikmem_malloc(sizeof(iTaskSched));
+	if (s == NULL) return NULL;
+	count = workers * priorities;
+	s->inbox = (iQueueSafe**)ikmem_malloc(sizeof(iQueueSafe*) * count);
+	s->deque = (iStealDeque**)ikmem_malloc(sizeof(iStealDeque*) * count);
+	s->workers = workers;
+	s->priorities = priorities;
+	s->next = 0;
+	s->stop = 0;
+	s->running = 0;
+	if (s->inbox == NULL || s->deque == NULL || 
+		queue_wait_init(&s->idle) != 0) {
+		if (s->inbox) ikmem_free(s->inbox);
+		if (s->deque) ikmem_free(s->deque);
+		ikmem_free(s);
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		s->inbox[i] = queue_safe_new(0);
+		s->deque[i] = steal_deque_new(capacity);
+	}
+	for (i = 0; i < count; i++) {
+		if (s->inbox[i] == NULL || s->deque[i] == NULL) {
+			task_sched_delete(s);
+			return NULL;
+		}
+	}
+	return s;
+}
+
+/* delete scheduler, objs still in it are dropped */
+void task_sched_delete(iTaskSched *s)
+{
+	if (s) {
+		int count = s->workers * s->priorities, i;
+		for (i = 0; i < count; i++) {
+			if (s->inbox[i]) queue_safe_delete(s->inbox[i]);
+			if (s->deque[i]) steal_deque_delete(s->deque[i]);
+		}
+		queue_wait_destroy(&s->idle);
+		ikmem_free(s->inbox);
+		ikmem_free(s->deque);
+		ikmem_free(s);
+	}
+}
+
+/* push obj, self is the index of calling worker (-1 if caller is not
+   a worker), hint is the preferred worker (-1 for any), returns 1 for
+   success, 0 for error */
+int task_sched_push(iTaskSched *s, void *obj, int priority, int self,
+	int hint)
+{
+	int index;
+	if (priority < 0) priority = 0;
+	if (priority >= s->priorities) priority = s->priorities - 1;
+	if (self >= 0 && self < s->workers && (hint < 0 || hint == self)) {
+		index = priority * s->workers + self;
+		if (steal_deque_push(s->deque[index], obj) == 0) {
+			if (queue_safe_put(s->inbox[index], obj, 0) == 0) return 0;
+		}
+	}	else {
+		if (hint < 0 || hint >= s->workers) {
+			/* racy round robin is good enough for spreading */
+			hint = (int)(s->next++ % (unsigned int)s->workers);
+		}
+		index = priority * s->workers + hint;
+		if (queue_safe_put(s->inbox[index], obj, 0) == 0) return 0;
+	}
+	queue_wait_wake(&s->idle, 1);
+	return 1;
+}
+
+/* count objs being processed */
+static void task_sched_running(iTaskSched *s, long delta)
+{
+#ifdef IQUEUE_SAFE_RING
+	IQS_ADD(&s->running, delta);
+#else
+	IMUTEX_LOCK(&s->idle.lock);
+	s->running += delta;
+	IMUTEX_UNLOCK(&s->idle.lock);
+#endif
+}
+
+/* scan queues for worker self, an obj is counted as running before it
+   leaves the queue, so task_sched_size never misses it */
+static int task_sched_scan(iTaskSched *s, int self, void **obj)
+{
+	int p, k, n = s->workers;
+	task_sched_running(s, 1);
+	for (p = s->priorities - 1; p >= 0; p--) {
+		int base = p * n;
+		if (steal_deque_pop(s->deque[base + self], obj)) return 1;
+		if (queue_safe_get(s->inbox[base + self], obj, 0)) return 1;
+		for (k = 1; k < n; k++) {
+			int victim = base + (self + k) % n;
+			int hr;
+			while ((hr = steal_deque_steal(s->deque[victim], obj)) < 0);
+			if (hr > 0) return 1;
+			if (queue_safe_get(s->inbox[victim], obj, 0)) return 1;
+		}
+	}
+	task_sched_running(s, -1);
+	return 0;
+}
+
+/* worker self gets next obj, parks at most millisec if nothing to do,
+   returns 1 for success, 0 for timeout or stopped */
+int task_sched_pop(iTaskSched *s, int self, void **obj, 
+	unsigned long millisec)
+{
+	IUINT32 ts = iclock();
+	if (self < 0 || self >= s->workers) self = 0;
+	while (1) {
+		int seq;
+		if (task_sched_scan(s, self, obj)) return 1;
+		if (millisec == 0 || s->stop) return 0;
+		seq = queue_wait_prepare(&s->idle);
+		if (task_sched_scan(s, self, obj)) {
+			queue_wait_cancel(&s->idle);
+			return 1;
+		}
+		if (s->stop) {
+			queue_wait_cancel(&s->idle);
+			return 0;
+		}
+		if (millisec != IEVENT_INFINITE) {
+			IUINT32 passed = iclock() - ts;
+			if ((unsigned long)passed >= millisec) {
+				queue_wait_cancel(&s->idle);
+				return 0;
+			}
+			queue_wait_sleep(&s->idle, seq, millisec - passed);
+		}	else {
+			queue_wait_sleep(&s->idle, seq, IEVENT_INFINITE);
+		}
+	}
+	return 0;
+}
+
+/* worker finished processing an obj returned by task_sched_pop */
+void task_sched_done(iTaskSched *s)
+{
+	task_sched_running(s, -1);
+}
+
+/* stop = 1: wake up all parked workers and make pop return at once
+   when nothing to do, stop = 0: resume parking */
+void task_sched_stop(iTaskSched *s, int stop)
+{
+	s->stop = stop;
+	if (stop) queue_wait_wake(&s->idle, INT_MAX);
+}
+
+/* objs waiting or being processed (approximate) */
+iulong task_sched_size(const iTaskSched *s)
+{
+	int count = s->workers * s->priorities, i;
+	iulong size = (s->running > 0)? (iulong)s->running : 0;
+	for (i = 0; i < count; i++) {
+		size += queue_safe_size(s->inbox[i]);
+		size += steal_deque_size(s->deque[i]);
+	}
+	return size;
 }
 
 
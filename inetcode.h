@@ -54,7 +54,8 @@ int inet_socketpair(int fds[2]);
 /*===================================================================*/
 struct CAsyncSock
 {
-	IUINT32 time;					/* timeout */
+	IUINT32 time;					/* last active time */
+	IUINT32 time_send;				/* last write progress time */
 	int fd;							/* socket fd */
 	int state;						/* CLOSED/CONNECTING/ESTABLISHED */
 	long hid;						/* hid */
@@ -65,16 +66,20 @@ struct CAsyncSock
 	int mode;						/* socket mode */
 	int ipv6;						/* 0:ipv4, 1:ipv6 */
 	int flags;						/* flag bits */
+	ipolld pfd;						/* completion io device or NULL */
 	char *buffer;					/* internal working buffer */
 	char *external;					/* external working buffer */
 	long bufsize;					/* working buffer size */
 	long maxsize;					/* max packet size */
 	long limited;					/* buffer limited */
+	long timeout_idle;				/* idle timeout (ms), 0 for none */
+	long timeout_connect;			/* connect timeout (ms), 0 for none */
+	long timeout_stall;				/* write stall timeout (ms) */
 	int rc4_send_x;					/* rc4 encryption variable */
 	int rc4_send_y;					/* rc4 encryption variable */
 	int rc4_recv_x;					/* rc4 encryption variable */
 	int rc4_recv_y;					/* rc4 encryption variable */
-	struct IQUEUEHEAD node;			/* list node */
+	itimer_node timer;				/* timeout node */
 	struct IMSTREAM linemsg;		/* line buffer */
 	struct IMSTREAM sendmsg;		/* send buffer */
 	struct IMSTREAM recvmsg;		/* recv buffer */
@@ -200,6 +205,7 @@ typedef struct CAsyncCore CAsyncCore;
 #define ASYNC_CORE_EVT_DATA		3	/* data: (hid, tag)  */
 #define ASYNC_CORE_EVT_PROGRESS	4	/* output progress: (hid, tag) */
 #define ASYNC_CORE_EVT_PUSH		5	/* msg from async_core_push */
+#define ASYNC_CORE_EVT_SIGNAL	6	/* signal: (sig, 0) */
 
 #define ASYNC_CORE_NODE_IN			1		/* accepted node */
 #define ASYNC_CORE_NODE_OUT			2		/* connected out node */
@@ -211,10 +217,24 @@ typedef struct CAsyncCore CAsyncCore;
 typedef int (*CAsyncValidator)(const struct sockaddr *remote, int len,
 	CAsyncCore *core, long listenhid, void *user);
 
+/* event entry filled by async_core_read_batch */
+struct CAsyncEvent
+{
+	int event;
+	long wparam;
+	long lparam;
+	char *data;			/* points into the caller's buffer */
+	long size;
+};
+
+typedef struct CAsyncEvent CAsyncEvent;
+
 
 /**
  * create CAsyncCore object:
- * if (flags & 1) disable lock, if (flags & 2) disable notify
+ * if (flags & 1) disable lock, if (flags & 2) disable notify,
+ * if (flags & 4) use completion io when the poll device supports it
+ * (IDEVICE_URING): sends of a pass are submitted by a single syscall
  */
 CAsyncCore* async_core_new(int flags);
 
@@ -231,14 +251,44 @@ void async_core_wait(CAsyncCore *core, IUINT32 millisec);
 /* wake async_core_wait up, returns zero for success */
 int async_core_notify(CAsyncCore *core);
 
+/* raise signal sig (0-31) from any thread and wake async_core_wait up,
+   signals raised before next wait are merged into one 
+   ASYNC_CORE_EVT_SIGNAL, returns 0 for success, 1 for already raised */
+int async_core_signal(CAsyncCore *core, int sig);
+
 /**
  * read events, returns data length of the message, 
  * and returns -1 for no event, -2 for buffer size too small,
- * returns data size when data equals NULL.
+ * -3 while a view is not released, returns data size when data 
+ * equals NULL.
  */
 long async_core_read(CAsyncCore *core, int *event, long *wparam,
 	long *lparam, void *data, long size);
 
+/**
+ * view the next message without copy: vecptr/veclen receive the page 
+ * chunks of the message data, count is the capacity on input and the 
+ * chunk count on output. returns data length, -1 for no event, -2 for 
+ * count too small (count is set to the required size), -3 if previous
+ * view is not released. the message stays in queue and the chunks stay
+ * valid until async_core_read_release is called.
+ */
+long async_core_read_view(CAsyncCore *core, int *event, long *wparam,
+	long *lparam, const void *vecptr[], long veclen[], int *count);
+
+/* drop the message returned by async_core_read_view */
+void async_core_read_release(CAsyncCore *core);
+
+/**
+ * read up to count events under one lock, payloads are laid out one 
+ * after another in buffer and referenced by events[i].data. stops at 
+ * the first message which doesn't fit. returns number of events read, 
+ * 0 for no event, -2 for buffer too small to hold the first message, 
+ * -3 if a view is not released.
+ */
+int async_core_read_batch(CAsyncCore *core, CAsyncEvent *events, 
+	int count, void *buffer, long size);
+
 
 /* send data to given hid */
 long async_core_send(CAsyncCore *core, long hid, const void *ptr, long len);
@@ -308,8 +358,16 @@ long async_core_node_prev(const CAsyncCore *core, long hid);
 #define ASYNC_CORE_OPTION_GETFD			9
 #define ASYNC_CORE_OPTION_REUSEPORT		10
 #define ASYNC_CORE_OPTION_UNIXREUSE		11
+#define ASYNC_CORE_OPTION_TIMEOUT_IDLE		12	/* no data received */
+#define ASYNC_CORE_OPTION_TIMEOUT_CONNECT	13	/* still connecting */
+#define ASYNC_CORE_OPTION_TIMEOUT_STALL		14	/* pending data not sent */
 
-/* set connection socket option */
+/**
+ * set connection socket option, TIMEOUT_* values are in millisec 
+ * (0 to disable), they close the connection with code 2006 (idle), 
+ * 2007 (connect) or 2008 (write stall). pass hid = -1 with TIMEOUT_* 
+ * to set the defaults for new connections.
+ */
 int async_core_option(CAsyncCore *core, long hid, int opt, long value);
 
 #define ASYNC_CORE_STATUS_STATE		0
@@ -345,15 +403,98 @@ int async_core_peername(const CAsyncCore *core, long hid,
 long async_core_nfds(const CAsyncCore *core);
 
 
+/*===================================================================*/
+/* CAsyncGroup                                                       */
+/*===================================================================*/
+struct CAsyncGroup;
+typedef struct CAsyncGroup CAsyncGroup;
+
+#define ASYNC_GROUP_MAX_SHARDS		64
+
+/**
+ * create a group of nshards CAsyncCore objects (shards), each one is 
+ * driven by its own thread, the shard index is encoded in every hid.
+ * if (flags & 1) don't pin shard threads to cpus, otherwise shard i is
+ * pinned to cpu (i % cpus).
+ */
+CAsyncGroup* async_group_new(int nshards, int flags);
+
+/* stop shard threads and delete group */
+void async_group_delete(CAsyncGroup *group);
+
+/* get shard count */
+int async_group_count(const CAsyncGroup *group);
+
+/* get shard core: don't call async_core_wait on it. async_core_send,
+   async_core_send_vector and async_core_close can be called from any
+   thread: from other threads they are queued to the shard thread like
+   async_group_send/close (returns the size queued, failures show up
+   as events of hid). the shard thread sleeps in polling until an 
+   event or a timer, so wrap other calls on it with
+   async_group_suspend/async_group_resume */
+CAsyncCore* async_group_core(CAsyncGroup *group, int shard);
+
+/* make the shard thread step aside (and wait) until resumed, calls on
+   its core don't block on polling in between */
+void async_group_suspend(CAsyncGroup *group, int shard);
+
+/* let the shard thread poll again */
+void async_group_resume(CAsyncGroup *group, int shard);
+
+/* get shard index of the hid, returns -1 for invalid hid */
+int async_group_shard(const CAsyncGroup *group, long hid);
+
+/* wait until any shard has messages or timeout */
+void async_group_wait(CAsyncGroup *group, IUINT32 millisec);
+
+/* wake async_group_wait up */
+void async_group_notify(CAsyncGroup *group);
+
+/**
+ * read events from shards in round robin, same as async_core_read,
+ * only one thread should read a group.
+ */
+long async_group_read(CAsyncGroup *group, int *event, long *wparam,
+	long *lparam, void *data, long size);
+
+/* send data to given hid, thread safe and never blocks on a shard */
+long async_group_send(CAsyncGroup *group, long hid, const void *ptr, 
+	long len);
+
+/* close given hid, thread safe and never blocks on a shard */
+int async_group_close(CAsyncGroup *group, long hid, int code);
+
+/**
+ * new listener in every shard on the same address with SO_REUSEPORT, 
+ * each shard reports its own ASYNC_CORE_EVT_NEW, returns the hid of 
+ * the listener in shard 0. only shard 0 listens without SO_REUSEPORT.
+ */
+long async_group_new_listen(CAsyncGroup *group, 
+	const struct sockaddr *addr, int addrlen, int header);
+
+/* new connection in the next shard (round robin), returns hid */
+long async_group_new_connect(CAsyncGroup *group, 
+	const struct sockaddr *addr, int addrlen, int header);
+
+
 /*===================================================================*/
 /* Thread Safe Queue                                                 */
 /*===================================================================*/
 struct iQueueSafe;
 typedef struct iQueueSafe iQueueSafe;
 
-/* new queue */
+#define QUEUE_SAFE_SP		1	/* only one thread puts */
+#define QUEUE_SAFE_SC		2	/* only one thread gets */
+#define QUEUE_SAFE_SPSC		(QUEUE_SAFE_SP | QUEUE_SAFE_SC)
+#define QUEUE_SAFE_MPSC		QUEUE_SAFE_SC
+
+/* new queue, maxsize is rounded up to power of 2, 0 for unbounded */
 iQueueSafe *queue_safe_new(iulong maxsize);
 
+/* new queue with QUEUE_SAFE_* flags, which lets the lock-free ring 
+   skip compare-and-swap on the single producer/consumer side */
+iQueueSafe *queue_safe_new_ex(iulong maxsize, int flags);
+
 /* delete queue */
 void queue_safe_delete(iQueueSafe *q);
 
@@ -383,6 +524,65 @@ int queue_safe_peek_vec(iQueueSafe *q, void *vecptr[], int count,
 iulong queue_safe_size(iQueueSafe *q);
 
 
+/*===================================================================*/
+/* Work Stealing Scheduler                                           */
+/*===================================================================*/
+struct iStealDeque;
+typedef struct iStealDeque iStealDeque;
+
+/* new deque, capacity is rounded up to power of 2 */
+iStealDeque *steal_deque_new(iulong capacity);
+
+/* delete deque */
+void steal_deque_delete(iStealDeque *d);
+
+/* owner only: push at bottom, returns 1 for success, 0 for full */
+int steal_deque_push(iStealDeque *d, void *ptr);
+
+/* owner only: pop from bottom (LIFO), returns 1 for success, 0 for empty */
+int steal_deque_pop(iStealDeque *d, void **ptr);
+
+/* any thread: take from top (FIFO), returns 1 for success, 0 for
+   empty, -1 for losing the race to another thief or the owner */
+int steal_deque_steal(iStealDeque *d, void **ptr);
+
+/* approximate size */
+iulong steal_deque_size(const iStealDeque *d);
+
+
+struct iTaskSched;
+typedef struct iTaskSched iTaskSched;
+
+/* new scheduler: a deque (with capacity) and an inbox per priority for
+   each worker, higher priority is served first */
+iTaskSched *task_sched_new(int workers, int priorities, iulong capacity);
+
+/* delete scheduler, objs still in it are dropped */
+void task_sched_delete(iTaskSched *s);
+
+/* push obj, self is the index of calling worker (-1 if caller is not
+   a worker), hint is the preferred worker (-1 for any), returns 1 for
+   success, 0 for error. a parked worker is waked up if there is one */
+int task_sched_push(iTaskSched *s, void *obj, int priority, int self,
+	int hint);
+
+/* worker self gets next obj: own queues first, then steals from other
+   workers, parks at most millisec if nothing to do, returns 1 for 
+   success, 0 for timeout or stopped */
+int task_sched_pop(iTaskSched *s, int self, void **obj, 
+	unsigned long millisec);
+
+/* worker finished processing an obj returned by task_sched_pop */
+void task_sched_done(iTaskSched *s);
+
+/* stop = 1: wake up all parked workers and make pop return at once
+   when nothing to do, stop = 0: resume parking */
+void task_sched_stop(iTaskSched *s, int stop);
+
+/* objs waiting or being processed (approximate) */
+iulong task_sched_size(const iTaskSched *s);
+
+
 /*===================================================================*/
 /* System Utilities                                                  */
 /*===================================================================*/
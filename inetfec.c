@@ -0,0 +1,720 @@
+//=====================================================================
+//
+// inetfec.c - Reed-Solomon forward error correction for KCP
+//
+// NOTE:
+// for more information, please see the readme file.
+//
+//=====================================================================
+#include "inetfec.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+	(defined(__x86_64__) || defined(__i386__)) && (!defined(__AVM3__))
+#include <immintrin.h>
+#define IFEC_X86
+#define IFEC_TARGET(x)	__attribute__((target(x)))
+#endif
+
+
+//=====================================================================
+// GF(2^8): polynomial 0x11d
+//=====================================================================
+static unsigned char ifec_exp[512];
+static unsigned char ifec_log[256];
+static unsigned char ifec_inv[256];
+static unsigned char ifec_mul[256][256];	// ifec_mul[c][x] = c * x
+static unsigned char ifec_high[256][16];	// ifec_high[c][x] = c * (x << 4)
+static volatile long ifec_inited = 0;	// 0: none, 1: building, 2: ready
+static int ifec_level = IKCP_FEC_SCALAR;
+
+// tables are built once by the first caller, others wait until ready
+#if defined(__clang__) || (defined(__GNUC__) && ((__GNUC__ > 4) || \
+	((__GNUC__ == 4) && (__GNUC_MINOR__ >= 7))))
+	#define IFEC_LOAD(p)        __atomic_load_n(p, __ATOMIC_ACQUIRE)
+	#define IFEC_STORE(p, v)    __atomic_store_n(p, v, __ATOMIC_RELEASE)
+	#define IFEC_CAS(p, o, n)   __sync_bool_compare_and_swap(p, o, n)
+#elif defined(_MSC_VER) && (!defined(_M_PPC)) && (!defined(_XBOX))
+	#define IFEC_LOAD(p)        (*(p))
+	#define IFEC_STORE(p, v)    (*(p) = (v))
+	#define IFEC_CAS(p, o, n)   (InterlockedCompareExchange( \
+		(LONG volatile*)(p), (LONG)(n), (LONG)(o)) == (LONG)(o))
+#else
+	// no atomics: call ikcp_fec_simd(-1) once before starting threads
+	#define IFEC_LOAD(p)        (*(p))
+	#define IFEC_STORE(p, v)    (*(p) = (v))
+	#define IFEC_CAS(p, o, n)   ((*(p) == (o))? ((*(p) = (n)), 1) : 0)
+#endif
+
+typedef void (*ifec_region_t)(unsigned char *dst, const unsigned char *src,
+	unsigned char c, int size);
+
+static void ifec_region_scalar(unsigned char *dst, const unsigned char *src,
+	unsigned char c, int size);
+
+static ifec_region_t ifec_region = ifec_region_scalar;
+
+
+//---------------------------------------------------------------------
+// dst ^= c * src, lookup table
+//---------------------------------------------------------------------
+static void ifec_region_scalar(unsigned char *dst, const unsigned char *src,
+	unsigned char c, int size)
+{
+	const unsigned char *mt = ifec_mul[c];
+	int i;
+	for (i = 0; i + 4 <= size; i += 4) {
+		dst[i + 0] ^= mt[src[i + 0]];
+		dst[i + 1] ^= mt[src[i + 1]];
+		dst[i + 2] ^= mt[src[i + 2]];
+		dst[i + 3] ^= mt[src[i + 3]];
+	}
+	for (; i < size; i++) {
+		dst[i] ^= mt[src[i]];
+	}
+}
+
+
+#ifdef IFEC_X86
+//---------------------------------------------------------------------
+// dst ^= c * src, split into nibbles: c * x = c * lo(x) ^ c * hi(x),
+// each one is a 16 entries table looked up by pshufb
+//---------------------------------------------------------------------
+IFEC_TARGET("ssse3")
+static void ifec_region_ssse3(unsigned char *dst, const unsigned char *src,
+	unsigned char c, int size)
+{
+	__m128i lo = _mm_loadu_si128((const __m128i*)ifec_mul[c]);
+	__m128i hi = _mm_loadu_si128((const __m128i*)ifec_high[c]);
+	__m128i mask = _mm_set1_epi8(0x0f);
+	int i = 0;
+	for (; i + 16 <= size; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i y = _mm_loadu_si128((const __m128i*)(dst + i));
+		__m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(x, mask));
+		__m128i h = _mm_shuffle_epi8(hi, 
+			_mm_and_si128(_mm_srli_epi64(x, 4), mask));
+		y = _mm_xor_si128(y, _mm_xor_si128(l, h));
+		_mm_storeu_si128((__m128i*)(dst + i), y);
+	}
+	for (; i < size; i++) {
+		dst[i] ^= ifec_mul[c][src[i]];
+	}
+}
+
+IFEC_TARGET("avx2")
+static void ifec_region_avx2(unsigned char *dst, const unsigned char *src,
+	unsigned char c, int size)
+{
+	__m256i lo = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i*)ifec_mul[c]));
+	__m256i hi = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i*)ifec_high[c]));
+	__m256i mask = _mm256_set1_epi8(0x0f);
+	int i = 0;
+	for (; i + 32 <= size; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i y = _mm256_loadu_si256((const __m256i*)(dst + i));
+		__m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(x, mask));
+		__m256i h = _mm256_shuffle_epi8(hi, 
+			_mm256_and_si256(_mm256_srli_epi64(x, 4), mask));
+		y = _mm256_xor_si256(y, _mm256_xor_si256(l, h));
+		_mm256_storeu_si256((__m256i*)(dst + i), y);
+	}
+	// tail in vex encoding too, mixing with legacy sse is expensive
+	for (; i + 16 <= size; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i y = _mm_loadu_si128((const __m128i*)(dst + i));
+		__m128i l = _mm_shuffle_epi8(_mm256_castsi256_si128(lo), 
+			_mm_and_si128(x, _mm256_castsi256_si128(mask)));
+		__m128i h = _mm_shuffle_epi8(_mm256_castsi256_si128(hi), 
+			_mm_and_si128(_mm_srli_epi64(x, 4), 
+			_mm256_castsi256_si128(mask)));
+		y = _mm_xor_si128(y, _mm_xor_si128(l, h));
+		_mm_storeu_si128((__m128i*)(dst + i), y);
+	}
+	for (; i < size; i++) {
+		dst[i] ^= ifec_mul[c][src[i]];
+	}
+}
+#endif
+
+
+//---------------------------------------------------------------------
+// dst ^= c * src
+//---------------------------------------------------------------------
+static void ifec_muladd(unsigned char *dst, const unsigned char *src,
+	unsigned char c, int size)
+{
+	if (c == 0) return;
+	if (c == 1) {
+		int i;
+		for (i = 0; i < size; i++) dst[i] ^= src[i];
+		return;
+	}
+	ifec_region(dst, src, c, size);
+}
+
+static int ifec_best(void)
+{
+#ifdef IFEC_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return IKCP_FEC_AVX2;
+	if (__builtin_cpu_supports("ssse3")) return IKCP_FEC_SSSE3;
+#endif
+	return IKCP_FEC_SCALAR;
+}
+
+static void ifec_select(int level)
+{
+	int best = ifec_best();
+	if (level > best) level = best;
+	ifec_level = level;
+	ifec_region = ifec_region_scalar;
+#ifdef IFEC_X86
+	if (level == IKCP_FEC_SSSE3) ifec_region = ifec_region_ssse3;
+	if (level == IKCP_FEC_AVX2) ifec_region = ifec_region_avx2;
+#endif
+}
+
+static void ifec_build(void)
+{
+	int i, j, x = 1;
+	for (i = 0; i < 255; i++) {
+		ifec_exp[i] = (unsigned char)x;
+		ifec_exp[i + 255] = (unsigned char)x;
+		ifec_log[x] = (unsigned char)i;
+		x <<= 1;
+		if (x & 0x100) x ^= 0x11d;
+	}
+	ifec_exp[510] = ifec_exp[0];
+	ifec_exp[511] = ifec_exp[1];
+	ifec_log[0] = 0;
+	for (i = 0; i < 256; i++) {
+		for (j = 0; j < 256; j++) {
+			if (i == 0 || j == 0) ifec_mul[i][j] = 0;
+			else ifec_mul[i][j] = ifec_exp[ifec_log[i] + ifec_log[j]];
+		}
+		for (j = 0; j < 16; j++) {
+			ifec_high[i][j] = ifec_mul[i][j << 4];
+		}
+		ifec_inv[i] = (i == 0)? 0 : ifec_exp[255 - ifec_log[i]];
+	}
+	ifec_select(ifec_best());
+}
+
+static void ifec_init(void)
+{
+	if (IFEC_LOAD(&ifec_inited) == 2) return;
+	if (IFEC_CAS(&ifec_inited, 0, 1)) {
+		ifec_build();
+		IFEC_STORE(&ifec_inited, 2);
+		return;
+	}
+	while (IFEC_LOAD(&ifec_inited) != 2) {
+		// table build takes microseconds, just spin
+	}
+}
+
+int ikcp_fec_simd(int level)
+{
+	ifec_init();
+	if (level >= 0) ifec_select(level);
+	return ifec_level;
+}
+
+// cauchy matrix: parity shard of index x (x >= IKCP_FEC_MAXDATA) is
+// sum of inv(x ^ j) * data[j], every square sub-matrix is invertible
+#define IFEC_COEF(x, j)	(ifec_inv[(x) ^ (j)])
+
+// invert n * n matrix in place (gauss-jordan), 'work' is n * n bytes,
+// returns -1 if singular
+static int ifec_invert(unsigned char *m, unsigned char *work, int n)
+{
+	int i, j, k;
+	memset(work, 0, n * n);
+	for (i = 0; i < n; i++) work[i * n + i] = 1;
+	for (i = 0; i < n; i++) {
+		unsigned char c;
+		if (m[i * n + i] == 0) {
+			for (k = i + 1; k < n; k++) {
+				if (m[k * n + i] != 0) break;
+			}
+			if (k >= n) return -1;
+			for (j = 0; j < n; j++) {
+				unsigned char t;
+				t = m[i * n + j]; m[i * n + j] = m[k * n + j]; m[k * n + j] = t;
+				t = work[i * n + j]; 
+				work[i * n + j] = work[k * n + j]; 
+				work[k * n + j] = t;
+			}
+		}
+		c = ifec_inv[m[i * n + i]];
+		for (j = 0; j < n; j++) {
+			m[i * n + j] = ifec_mul[c][m[i * n + j]];
+			work[i * n + j] = ifec_mul[c][work[i * n + j]];
+		}
+		for (k = 0; k < n; k++) {
+			unsigned char f = m[k * n + i];
+			if (k == i || f == 0) continue;
+			for (j = 0; j < n; j++) {
+				m[k * n + j] ^= ifec_mul[f][m[i * n + j]];
+				work[k * n + j] ^= ifec_mul[f][work[i * n + j]];
+			}
+		}
+	}
+	memcpy(m, work, n * n);
+	return 0;
+}
+
+
+//=====================================================================
+// IKCPFEC
+//=====================================================================
+#define IKCP_FEC_HEAD		11		// conv + group + index + shards
+#define IKCP_FEC_GROUPS		8		// groups decoding at the same time
+
+// shards of one group received
+struct IKCPFECGROUP
+{
+	IUINT32 id;
+	int used;
+	int done;
+	int known;				// shard counts confirmed by a parity shard
+	int datashards;
+	int parityshards;
+	int count;				// shards stored
+	int ndata;				// data shards stored
+	int length;				// parity shard length
+	short where[256];		// shard index -> storage, -1 for absent
+	short size[256];		// shard length by storage
+	ivector_t *storage;		// count * slot bytes
+};
+
+struct IKCPFEC
+{
+	ikcpcb *kcp;
+	void *user;
+	int (*output)(const char *buf, int len, struct IKCPCB *kcp, void *user);
+	int mtu;				// kcp mtu before reduced
+	int slot;				// max shard size
+	int datashards;
+	int parityshards;
+	IUINT32 group;			// group being sent
+	int count;				// data shards sent in current group
+	int length;				// max data shard length of current group
+	ivector_t *encode;		// data shards of current group
+	ivector_t *matrix;		// decoding work space
+	char *buffer;			// output packet
+	IUINT32 recovered;
+	IUINT32 failed;
+	struct IKCPFECGROUP groups[IKCP_FEC_GROUPS];
+};
+
+
+//---------------------------------------------------------------------
+// send side
+//---------------------------------------------------------------------
+static char *ikcp_fec_head(ikcpfec *fec, char *ptr, int index, int k)
+{
+	ptr = iencode32u_lsb(ptr, fec->kcp->conv);
+	ptr = iencode32u_lsb(ptr, fec->group);
+	ptr = iencode8u(ptr, (unsigned char)index);
+	ptr = iencode8u(ptr, (unsigned char)k);
+	ptr = iencode8u(ptr, (unsigned char)fec->parityshards);
+	return ptr;
+}
+
+// send parity of the data shards sent in current group, start next one
+static void ikcp_fec_close(ikcpfec *fec)
+{
+	unsigned char *shards = (unsigned char*)fec->encode->data;
+	int k = fec->count, length = fec->length, i, j;
+
+	if (k == 0) return;
+
+	if (fec->parityshards > 0) {
+		for (j = 0; j < k; j++) {
+			unsigned char *shard = shards + j * fec->slot;
+			int size = (int)shard[0] | ((int)shard[1] << 8);
+			memset(shard + size + 2, 0, length - size - 2);
+		}
+		for (i = 0; i < fec->parityshards; i++) {
+			int x = IKCP_FEC_MAXDATA + i;
+			char *ptr = ikcp_fec_head(fec, fec->buffer, x, k);
+			memset(ptr, 0, length);
+			for (j = 0; j < k; j++) {
+				ifec_muladd((unsigned char*)ptr, shards + j * fec->slot, 
+					IFEC_COEF(x, j), length);
+			}
+			fec->output(fec->buffer, IKCP_FEC_HEAD + length, fec->kcp, 
+				fec->user);
+		}
+	}
+
+	fec->group++;
+	fec->count = 0;
+	fec->length = 0;
+}
+
+static int ikcp_fec_output(const char *buf, int len, ikcpcb *kcp, 
+	void *user)
+{
+	ikcpfec *fec = (ikcpfec*)user;
+	char *ptr;
+	int hr;
+
+	if (len + IKCP_FEC_OVERHEAD > fec->mtu) 
+		return -1;
+
+	ptr = ikcp_fec_head(fec, fec->buffer, fec->count, fec->datashards);
+	ptr = iencode16u_lsb(ptr, (unsigned short)len);
+	memcpy(ptr, buf, len);
+	len += IKCP_FEC_OVERHEAD;
+
+	hr = fec->output(fec->buffer, len, kcp, fec->user);
+
+	if (fec->parityshards > 0) {
+		unsigned char *shard = fec->encode->data + fec->count * fec->slot;
+		memcpy(shard, fec->buffer + IKCP_FEC_HEAD, len - IKCP_FEC_HEAD);
+		if (len - IKCP_FEC_HEAD > fec->length) {
+			fec->length = len - IKCP_FEC_HEAD;
+		}
+	}
+
+	fec->count++;
+
+	if (fec->count >= fec->datashards) {
+		ikcp_fec_close(fec);
+	}
+
+	return hr;
+}
+
+void ikcp_fec_flush(ikcpfec *fec)
+{
+	ikcp_fec_close(fec);
+}
+
+
+//---------------------------------------------------------------------
+// receive side
+//---------------------------------------------------------------------
+static void ikcp_fec_reset(ikcpfec *fec, struct IKCPFECGROUP *g)
+{
+	if (g->used && g->done == 0 && g->parityshards > 0) {
+		if (g->ndata < g->datashards) fec->failed++;
+	}
+	g->used = 0;
+	g->done = 0;
+	g->known = 0;
+	g->count = 0;
+	g->ndata = 0;
+	g->length = 0;
+	memset(g->where, -1, sizeof(g->where));
+}
+
+// group of id, NULL if it is older than the ones decoding
+static struct IKCPFECGROUP *ikcp_fec_group(ikcpfec *fec, IUINT32 id)
+{
+	struct IKCPFECGROUP *g = &fec->groups[id % IKCP_FEC_GROUPS];
+	if (g->used) {
+		if (g->id == id) return g;
+		if ((IINT32)(id - g->id) < 0) return NULL;
+	}
+	ikcp_fec_reset(fec, g);
+	g->used = 1;
+	g->id = id;
+	return g;
+}
+
+static void ikcp_fec_recover(ikcpfec *fec, struct IKCPFECGROUP *g)
+{
+	int k = g->datashards, length = g->length, slot = fec->slot;
+	int lost[IKCP_FEC_MAXDATA], rows[IKCP_FEC_MAXDATA];
+	unsigned char *m, *work, *base;
+	int e = 0, n = 0, i, j, x;
+
+	// shards are padded with zero to parity length
+	if (iv_resize(g->storage, (g->count + k - g->ndata) * slot) != 0) 
+		return;
+
+	base = (unsigned char*)g->storage->data;
+
+	for (j = 0; j < k; j++) {
+		if (g->where[j] < 0) lost[e++] = j;
+		else {
+			unsigned char *shard = base + g->where[j] * slot;
+			int size = g->size[g->where[j]];
+			if (size > length) {
+				g->done = 1;
+				return;
+			}
+			memset(shard + size, 0, length - size);
+		}
+	}
+
+	for (x = IKCP_FEC_MAXDATA; x < 256 && n < e; x++) {
+		if (g->where[x] >= 0) rows[n++] = x;
+	}
+
+	if (n < e) return;
+
+	if (iv_resize(fec->matrix, e * e * 2) != 0)
+		return;
+
+	m = (unsigned char*)fec->matrix->data;
+	work = m + e * e;
+
+	// parity minus received data shards leaves lost data shards only
+	for (i = 0; i < e; i++) {
+		unsigned char *parity = base + g->where[rows[i]] * slot;
+		for (j = 0; j < k; j++) {
+			if (g->where[j] >= 0) {
+				ifec_muladd(parity, base + g->where[j] * slot,
+					IFEC_COEF(rows[i], j), length);
+			}
+		}
+		for (j = 0; j < e; j++) {
+			m[i * e + j] = IFEC_COEF(rows[i], lost[j]);
+		}
+	}
+
+	if (ifec_invert(m, work, e) != 0) 
+		return;
+
+	for (i = 0; i < e; i++) {
+		unsigned char *shard = base + g->count * slot;
+		int size;
+		memset(shard, 0, length);
+		for (j = 0; j < e; j++) {
+			ifec_muladd(shard, base + g->where[rows[j]] * slot, 
+				m[i * e + j], length);
+		}
+		g->where[lost[i]] = (short)g->count;
+		g->size[g->count] = (short)length;
+		g->count++;
+		g->ndata++;
+		size = (int)shard[0] | ((int)shard[1] << 8);
+		if (size + 2 <= length) {
+			fec->recovered++;
+			ikcp_input(fec->kcp, (const char*)shard + 2, size);
+		}
+	}
+
+	g->done = 1;
+}
+
+int ikcp_fec_input(ikcpfec *fec, const char *data, long size)
+{
+	struct IKCPFECGROUP *g;
+	const char *ptr = data;
+	unsigned char index, k, m;
+	IUINT32 conv, id;
+	int hr = 0, length;
+
+	if (size < IKCP_FEC_HEAD + 2) return -10;
+
+	ptr = idecode32u_lsb(ptr, &conv);
+	ptr = idecode32u_lsb(ptr, &id);
+	ptr = idecode8u(ptr, &index);
+	ptr = idecode8u(ptr, &k);
+	ptr = idecode8u(ptr, &m);
+	length = (int)(size - IKCP_FEC_HEAD);
+
+	if (k == 0 || k > IKCP_FEC_MAXDATA || m > IKCP_FEC_MAXPARITY) 
+		return -10;
+
+	if (index < IKCP_FEC_MAXDATA) {
+		unsigned short len;
+		if (index >= k) return -10;
+		idecode16u_lsb(ptr, &len);
+		if ((long)len + IKCP_FEC_OVERHEAD > size) return -10;
+		hr = ikcp_input(fec->kcp, ptr + 2, len);
+	}
+	else if (index >= IKCP_FEC_MAXDATA + m) {
+		return -10;
+	}
+
+	if (conv != fec->kcp->conv || m == 0 || length > fec->slot) 
+		return hr;
+
+	g = ikcp_fec_group(fec, id);
+
+	if (g == NULL || g->done || g->where[index] >= 0) 
+		return hr;
+
+	if (index >= IKCP_FEC_MAXDATA) {
+		// parity shards tell the real data shard count of the group
+		if (g->known == 0) {
+			g->known = 1;
+			g->datashards = k;
+			g->parityshards = m;
+			g->length = length;
+		}
+		if (length != g->length || k != g->datashards) 
+			return hr;
+	}
+	else if (g->count == 0) {
+		g->datashards = k;
+		g->parityshards = m;
+	}
+
+	if (iv_resize(g->storage, (g->count + 1) * fec->slot) != 0)
+		return hr;
+
+	memcpy(g->storage->data + g->count * fec->slot, ptr, length);
+	g->where[index] = (short)g->count;
+	g->size[g->count] = (short)length;
+	g->count++;
+
+	if (index < IKCP_FEC_MAXDATA) {
+		g->ndata++;
+	}
+
+	if (g->ndata >= g->datashards) {
+		g->done = 1;
+	}
+	else if (g->known && g->count >= g->datashards) {
+		ikcp_fec_recover(fec, g);
+	}
+
+	return hr;
+}
+
+
+//---------------------------------------------------------------------
+// create / delete
+//---------------------------------------------------------------------
+ikcpfec* ikcp_fec_new(ikcpcb *kcp, int datashards, int parityshards)
+{
+	ikcpfec *fec;
+	int failed = 0, i;
+
+	ifec_init();
+
+	if ((int)kcp->mtu - IKCP_FEC_OVERHEAD < 50) 
+		return NULL;
+
+	fec = (ikcpfec*)ikmem_malloc(sizeof(ikcpfec));
+	if (fec == NULL) return NULL;
+
+	memset(fec, 0, sizeof(ikcpfec));
+
+	fec->kcp = kcp;
+	fec->mtu = (int)kcp->mtu;
+	fec->slot = fec->mtu - IKCP_FEC_HEAD;
+	fec->buffer = (char*)ikmem_malloc(fec->mtu);
+	fec->encode = iv_create();
+	fec->matrix = iv_create();
+
+	for (i = 0; i < IKCP_FEC_GROUPS; i++) {
+		fec->groups[i].storage = iv_create();
+		ikcp_fec_reset(fec, &fec->groups[i]);
+		if (fec->groups[i].storage == NULL) failed = 1;
+	}
+
+	if (failed || fec->buffer == NULL || fec->encode == NULL || 
+		fec->matrix == NULL ||
+		ikcp_fec_shards(fec, datashards, parityshards) != 0 ||
+		ikcp_setmtu(kcp, fec->mtu - IKCP_FEC_OVERHEAD) != 0) {
+		fec->kcp = NULL;
+		ikcp_fec_delete(fec);
+		return NULL;
+	}
+
+	fec->output = kcp->output;
+	fec->user = kcp->user;
+	kcp->output = ikcp_fec_output;
+	kcp->user = fec;
+
+	return fec;
+}
+
+void ikcp_fec_delete(ikcpfec *fec)
+{
+	int i;
+	assert(fec);
+	if (fec->kcp) {
+		fec->kcp->output = fec->output;
+		fec->kcp->user = fec->user;
+		ikcp_setmtu(fec->kcp, fec->mtu);
+	}
+	for (i = 0; i < IKCP_FEC_GROUPS; i++) {
+		if (fec->groups[i].storage) iv_delete(fec->groups[i].storage);
+	}
+	if (fec->encode) iv_delete(fec->encode);
+	if (fec->matrix) iv_delete(fec->matrix);
+	if (fec->buffer) ikmem_free(fec->buffer);
+	ikmem_free(fec);
+}
+
+int ikcp_fec_shards(ikcpfec *fec, int datashards, int parityshards)
+{
+	if (datashards < 1 || datashards > IKCP_FEC_MAXDATA) return -1;
+	if (parityshards < 0 || parityshards > IKCP_FEC_MAXPARITY) return -1;
+	if (fec->kcp && fec->kcp->output == ikcp_fec_output) {
+		ikcp_fec_close(fec);
+	}
+	if (iv_resize(fec->encode, datashards * fec->slot) != 0) return -2;
+	fec->datashards = datashards;
+	fec->parityshards = parityshards;
+	return 0;
+}
+
+void* ikcp_fec_user(const ikcpcb *kcp)
+{
+	return ((const ikcpfec*)kcp->user)->user;
+}
+
+ikcpfec* ikcp_fec_get(const ikcpcb *kcp, 
+	int (*output)(const char *buf, int len, struct IKCPCB *kcp, void *user))
+{
+	ikcpfec *fec;
+	if (kcp->output != ikcp_fec_output) return NULL;
+	fec = (ikcpfec*)kcp->user;
+	if (output != NULL && fec->output != output) return NULL;
+	return fec;
+}
+
+int ikcp_fec_probe(const char *data, long size)
+{
+	unsigned char index, k, m, cmd;
+	unsigned short len;
+	IUINT32 conv, inner;
+	const char *ptr = data;
+
+	if (size < IKCP_FEC_OVERHEAD + 24) return 0;
+
+	ptr = idecode32u_lsb(ptr, &conv);
+	ptr = idecode8u(ptr + 4, &index);
+	ptr = idecode8u(ptr, &k);
+	ptr = idecode8u(ptr, &m);
+	ptr = idecode16u_lsb(ptr, &len);
+
+	if (k == 0 || k > IKCP_FEC_MAXDATA || m > IKCP_FEC_MAXPARITY) return 0;
+	if (index >= k) return 0;
+	if (len < 24 || (long)len + IKCP_FEC_OVERHEAD > size) return 0;
+
+	// the shard starts with a kcp segment (cmd 81 - 85) of the same conv
+	idecode32u_lsb(ptr, &inner);
+	idecode8u(ptr + 4, &cmd);
+
+	if (inner != conv || cmd < 81 || cmd > 85) return 0;
+
+	return 1;
+}
+
+IUINT32 ikcp_fec_recovered(const ikcpfec *fec)
+{
+	return fec->recovered;
+}
+
+IUINT32 ikcp_fec_failed(const ikcpfec *fec)
+{
+	return fec->failed;
+}
+
@@ -0,0 +1,105 @@
+//=====================================================================
+//
+// inetfec.h - Reed-Solomon forward error correction for KCP
+//
+// NOTE:
+// for more information, please see the readme file.
+//
+//=====================================================================
+#ifndef __INETFEC_H__
+#define __INETFEC_H__
+
+#include "imemdata.h"
+#include "inetkcp.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+//=====================================================================
+// IKCPFEC: fec stage between kcp output and the transport
+//
+// packets of kcp output are sent at once as data shards, after every
+// 'datashards' of them 'parityshards' parity packets are sent, so any
+// 'datashards' packets of a group can recover the lost data shards,
+// which are fed back through ikcp_input without waiting for a resend.
+//
+// packet: conv(4) group(4) index(1) datashards(1) parityshards(1)
+// followed by the shard: size(2) + kcp packet for data, and parity
+// bytes for parity. conv comes first, so routing by conv still works.
+// group sizes are carried in each packet, so a receiver needs no 
+// configuration and the sender can change them at any time.
+//=====================================================================
+struct IKCPFEC;
+typedef struct IKCPFEC ikcpfec;
+
+#define IKCP_FEC_OVERHEAD		13		// header + shard size
+#define IKCP_FEC_MAXDATA		128		// max data shards of a group
+#define IKCP_FEC_MAXPARITY		127		// max parity shards of a group
+
+#define IKCP_FEC_SCALAR			0		// region multiply: lookup table
+#define IKCP_FEC_SSSE3			1		// region multiply: pshufb
+#define IKCP_FEC_AVX2			2		// region multiply: vpshufb
+
+
+//---------------------------------------------------------------------
+// interfaces
+//---------------------------------------------------------------------
+
+// create fec stage for kcp: kcp->output and kcp->user are taken over
+// until deleted (the original output gets the original user), and kcp
+// mtu is reduced by IKCP_FEC_OVERHEAD. returns NULL for error
+ikcpfec* ikcp_fec_new(ikcpcb *kcp, int datashards, int parityshards);
+
+// delete fec stage, restore kcp output/user/mtu
+void ikcp_fec_delete(ikcpfec *fec);
+
+// change group sizes, the current group is closed first. parityshards
+// can be 0 to send data shards only. returns 0 for success, -1 for
+// bad size, -2 for allocation failure
+int ikcp_fec_shards(ikcpfec *fec, int datashards, int parityshards);
+
+// call it instead of ikcp_input with packets from the transport.
+// returns the ikcp_input result of the packet, -10 for bad header
+int ikcp_fec_input(ikcpfec *fec, const char *data, long size);
+
+// close the current group early: parity of the data shards sent so far
+// is sent now. groups only close when full, call it after ikcp_update
+// (or ikcp_flush) if traffic is sparse and latency matters
+void ikcp_fec_flush(ikcpfec *fec);
+
+// get the original user of kcp
+void* ikcp_fec_user(const ikcpcb *kcp);
+
+// get the stage which took over kcp->output, NULL for none. if output
+// is not NULL, only a stage sending packets to it is returned
+ikcpfec* ikcp_fec_get(const ikcpcb *kcp, 
+	int (*output)(const char *buf, int len, struct IKCPCB *kcp, void *user));
+
+// check if a datagram is a data shard carrying a kcp segment of the
+// same conv, to tell fec framing from plain kcp before any stage
+// exists. returns 1 for yes, 0 for no
+int ikcp_fec_probe(const char *data, long size);
+
+// statistics: data shards recovered, groups that couldn't be recovered
+IUINT32 ikcp_fec_recovered(const ikcpfec *fec);
+IUINT32 ikcp_fec_failed(const ikcpfec *fec);
+
+// select region multiply for all fec stages: IKCP_FEC_SCALAR/SSSE3/AVX2
+// (best one supported by cpu is used by default), -1 to query only.
+// returns the one in use, it can be lower than required.
+// tables are built once on first use by any thread (ikcp_fec_new or here).
+// changing the level swaps a global routine: do it before stages are used,
+// never while any stage in any thread is encoding or decoding.
+int ikcp_fec_simd(int level);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
+
@@ -24,11 +24,14 @@ const IUINT32 IKCP_CMD_PUSH = 81;		// cmd: push data
 const IUINT32 IKCP_CMD_ACK  = 82;		// cmd: ack
 const IUINT32 IKCP_CMD_WASK = 83;		// cmd: window probe (ask)
 const IUINT32 IKCP_CMD_WINS = 84;		// cmd: window size (tell)
+const IUINT32 IKCP_CMD_SACK = 85;		// cmd: selective ack ranges
+const IUINT32 IKCP_SACK_FLAG = 1;		// frg of non-push: sack capable
 const IUINT32 IKCP_ASK_SEND = 1;		// need to send IKCP_CMD_WASK
 const IUINT32 IKCP_ASK_TELL = 2;		// need to send IKCP_CMD_WINS
 const IUINT32 IKCP_WND_SND = 32;
 const IUINT32 IKCP_WND_RCV = 32;
 const IUINT32 IKCP_MTU_DEF = 1400;
+const IUINT32 IKCP_MTU_MAX = 0x1000000;
 const IUINT32 IKCP_ACK_FAST	= 3;
 const IUINT32 IKCP_INTERVAL	= 100;
 const IUINT32 IKCP_OVERHEAD = 24;
@@ -37,6 +40,8 @@ const IUINT32 IKCP_THRESH_INIT = 2;
 const IUINT32 IKCP_THRESH_MIN = 2;
 const IUINT32 IKCP_PROBE_INIT = 7000;		// 7 secs to probe window size
 const IUINT32 IKCP_PROBE_LIMIT = 120000;	// up to 120 secs to probe window
+const IUINT32 IKCP_POOL_LIMIT = 32;		// cached segments of private pool
+const IUINT32 IKCP_WND_MAX = 0x1000000;	// max window (ring size)
 
 
 //---------------------------------------------------------------------
@@ -44,14 +49,121 @@ const IUINT32 IKCP_PROBE_LIMIT = 120000;	// up to 120 secs to probe window
 //---------------------------------------------------------------------
 typedef struct IKCPSEG IKCPSEG;
 
+// segment with its data capacity, segments of one pool have the same
+struct IKCPSLOT
+{
+	IUINT32 size;
+	IKCPSEG seg;
+};
+
+#define IKCP_SLOT_HEAD	(offsetof(struct IKCPSLOT, seg))
+#define IKCP_SLOT_ARENA	0x80000000	// size flag: in kcp->arena (import)
+
 static IKCPSEG* ikcp_segment_new(ikcpcb *kcp, int size)
 {
-	return (IKCPSEG*)ikmem_malloc(sizeof(IKCPSEG) + size);
+	struct IKCPPOOL *pool = kcp->pool;
+	struct IKCPSLOT *slot;
+	if ((IUINT32)size <= pool->size) {
+		if (!iqueue_is_empty(&pool->free)) {
+			IKCPSEG *seg = iqueue_entry(pool->free.next, IKCPSEG, node);
+			iqueue_del(&seg->node);
+			pool->count--;
+			return seg;
+		}
+		size = (int)pool->size;
+	}
+	slot = (struct IKCPSLOT*)ikmem_malloc(IKCP_SLOT_HEAD + 
+		sizeof(IKCPSEG) + size);
+	if (slot == NULL) return NULL;
+	slot->size = (IUINT32)size;
+	return &slot->seg;
+}
+
+static IUINT32 ikcp_segment_size(const IKCPSEG *seg)
+{
+	const struct IKCPSLOT *slot;
+	slot = (const struct IKCPSLOT*)((const char*)seg - IKCP_SLOT_HEAD);
+	return slot->size & ~IKCP_SLOT_ARENA;
 }
 
 static void ikcp_segment_delete(ikcpcb *kcp, IKCPSEG *seg)
 {
-	ikmem_free(seg);
+	struct IKCPPOOL *pool = kcp->pool;
+	struct IKCPSLOT *slot;
+	slot = (struct IKCPSLOT*)((char*)seg - IKCP_SLOT_HEAD);
+	if (slot->size == pool->size && pool->count < pool->limit) {
+		iqueue_add(&seg->node, &pool->free);
+		pool->count++;
+	}
+	else if (slot->size & IKCP_SLOT_ARENA) {
+		// imported segments share one block, freed with the last one
+		if (--kcp->narena == 0) {
+			ikmem_free(kcp->arena);
+			kcp->arena = NULL;
+		}
+	}
+	else {
+		ikmem_free(slot);
+	}
+}
+
+static void ikcp_pool_init(ikcppool *pool, IUINT32 size, IUINT32 limit)
+{
+	iqueue_init(&pool->free);
+	pool->size = size;
+	pool->count = 0;
+	pool->limit = limit;
+}
+
+static void ikcp_pool_clear(ikcppool *pool)
+{
+	while (!iqueue_is_empty(&pool->free)) {
+		IKCPSEG *seg = iqueue_entry(pool->free.next, IKCPSEG, node);
+		iqueue_del(&seg->node);
+		ikmem_free((char*)seg - IKCP_SLOT_HEAD);
+	}
+	pool->count = 0;
+}
+
+ikcppool* ikcp_pool_new(int size, int limit)
+{
+	ikcppool *pool;
+	if (size < 0 || limit < 0) return NULL;
+	pool = (ikcppool*)ikmem_malloc(sizeof(ikcppool));
+	if (pool == NULL) return NULL;
+	ikcp_pool_init(pool, (IUINT32)size, (IUINT32)limit);
+	return pool;
+}
+
+void ikcp_pool_delete(ikcppool *pool)
+{
+	assert(pool);
+	ikcp_pool_clear(pool);
+	ikmem_free(pool);
+}
+
+// ring index of snd_buf/rcv_buf: slot (sn & mask) holds the segment
+// of sn, a window never exceeds the ring so there is no collision
+static int ikcp_ring_grow(IKCPSEG ***ring, IUINT32 *mask, IUINT32 wnd,
+	const struct IQUEUEHEAD *head)
+{
+	const struct IQUEUEHEAD *p;
+	IKCPSEG **slots;
+	IUINT32 size = 1;
+	if (wnd > IKCP_WND_MAX) return -1;
+	while (size < wnd) size <<= 1;
+	if (ring[0] && size <= mask[0] + 1) return 0;
+	slots = (IKCPSEG**)ikmem_malloc(sizeof(IKCPSEG*) * size);
+	if (slots == NULL) return -1;
+	memset(slots, 0, sizeof(IKCPSEG*) * size);
+	for (p = head->next; p != head; p = p->next) {
+		IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
+		slots[seg->sn & (size - 1)] = seg;
+	}
+	if (ring[0]) ikmem_free(ring[0]);
+	ring[0] = slots;
+	mask[0] = size - 1;
+	return 0;
 }
 
 void ikcp_log(ikcpcb *kcp, int mask, const char *fmt, ...)
@@ -79,6 +191,8 @@ static int ikcp_output(ikcpcb *kcp, const void *data, int size)
 		ikcp_log(kcp, IKCP_LOG_OUTPUT, "[RO] %ld bytes", (long)size);
 	}
 	if (size == 0) return 0;
+	kcp->stat.bytes_out += (IUINT32)size;
+	kcp->stat.pkts_out++;
 	return kcp->output((const char*)data, size, kcp, kcp->user);
 }
 
@@ -97,6 +211,418 @@ void ikcp_qprint(const char *name, const struct IQUEUEHEAD *head)
 }
 
 
+//=====================================================================
+// CONGESTION CONTROL
+//=====================================================================
+
+//---------------------------------------------------------------------
+// default: slow start below ssthresh and additive increase above it,
+// shrink to half of inflight on fast resend and restart on timeout
+//---------------------------------------------------------------------
+static void ikcp_reno_ack(ikcpcb *kcp, IUINT32 una, IUINT32 acked, IINT32 rtt)
+{
+	if (itimediff(kcp->snd_una, una) > 0) {
+		if (kcp->cwnd < kcp->rmt_wnd) {
+			IUINT32 mss = kcp->mss;
+			if (kcp->cwnd < kcp->ssthresh) {
+				kcp->cwnd++;
+				kcp->incr += mss;
+			}	else {
+				if (kcp->incr < mss) kcp->incr = mss;
+				kcp->incr += (mss * mss) / kcp->incr + (mss / 16);
+				if ((kcp->cwnd + 1) * mss >= kcp->incr) {
+					kcp->cwnd++;
+				}
+			}
+			if (kcp->cwnd > kcp->rmt_wnd) {
+				kcp->cwnd = kcp->rmt_wnd;
+				kcp->incr = kcp->rmt_wnd * mss;
+			}
+		}
+	}
+}
+
+static void ikcp_reno_loss(ikcpcb *kcp, int fast, int timeout, IUINT32 cwnd)
+{
+	if (fast) {
+		IUINT32 inflight = kcp->snd_nxt - kcp->snd_una;
+		kcp->ssthresh = inflight / 2;
+		if (kcp->ssthresh < IKCP_THRESH_MIN)
+			kcp->ssthresh = IKCP_THRESH_MIN;
+		kcp->cwnd = kcp->ssthresh + (IUINT32)kcp->fastresend;
+		kcp->incr = kcp->cwnd * kcp->mss;
+	}
+
+	if (timeout) {
+		kcp->ssthresh = cwnd / 2;
+		if (kcp->ssthresh < IKCP_THRESH_MIN)
+			kcp->ssthresh = IKCP_THRESH_MIN;
+		kcp->cwnd = 1;
+		kcp->incr = kcp->mss;
+	}
+}
+
+static const struct IKCPCC ikcp_cc_reno = {
+	"default",
+	NULL,
+	NULL,
+	ikcp_reno_ack,
+	ikcp_reno_loss,
+	NULL,
+};
+
+
+//---------------------------------------------------------------------
+// bbr: model the path by the max delivery rate of recent rounds and 
+// the min rtt of recent 10 secs, keep cwnd around their product and
+// never take random loss as congestion. gains of the mode are applied
+// to cwnd, and to the rate of the pacer if ikcp_pacing is enabled: it
+// sends at max bandwidth by the gain, without the padding of cwnd.
+//---------------------------------------------------------------------
+#define IKCP_BBR_STARTUP		0
+#define IKCP_BBR_DRAIN			1
+#define IKCP_BBR_PROBE_BW		2
+#define IKCP_BBR_PROBE_RTT		3
+
+#define IKCP_BBR_ROUNDS			10		// length of max bandwidth filter
+#define IKCP_BBR_RTT_EXPIRE		10000	// length of min rtt filter
+#define IKCP_BBR_PROBE_TIME		200		// time to stay in PROBE_RTT
+#define IKCP_BBR_CWND_MIN		4
+#define IKCP_BBR_BW_SHIFT		16		// bandwidth unit: seg/ms >> 16
+#define IKCP_BBR_HIGH_GAIN		11		// startup gain 2/ln2, in quarters
+
+struct IKCPBBR
+{
+	int mode;
+	int cycle;
+	int full_cnt;
+	IUINT32 round;
+	IUINT32 bw[IKCP_BBR_ROUNDS];	// delivery rate of recent rounds
+	IUINT32 full_bw;
+	IUINT32 min_rtt;
+	IUINT32 min_rtt_ts;
+	IUINT32 delivered;
+	IUINT32 round_ts;
+	IUINT32 round_delivered;
+	IUINT32 probe_rtt_ts;
+	IUINT32 prior_cwnd;
+	IUINT32 drain_round;
+};
+
+// cwnd gain of PROBE_BW rounds in quarters: probe, drain, cruise
+static const IUINT32 ikcp_bbr_gain[8] = { 5, 3, 4, 4, 4, 4, 4, 4 };
+
+static IUINT32 ikcp_bbr_maxbw(const struct IKCPBBR *bbr)
+{
+	IUINT32 bw = 0;
+	int i;
+	for (i = 0; i < IKCP_BBR_ROUNDS; i++) {
+		if (bbr->bw[i] > bw) bw = bbr->bw[i];
+	}
+	return bw;
+}
+
+// segments of (gain / 4) bdp, acks are delayed by the flush interval
+// of remote, so one more interval of data is kept in flight
+static IUINT32 ikcp_bbr_window(const ikcpcb *kcp, 
+	const struct IKCPBBR *bbr, IUINT32 gain)
+{
+	IUINT64 bw = ikcp_bbr_maxbw(bbr);
+	IUINT64 time = ((IUINT64)bbr->min_rtt * gain) / 4 + kcp->interval;
+	return (IUINT32)((bw * time) >> IKCP_BBR_BW_SHIFT);
+}
+
+static int ikcp_bbr_init(ikcpcb *kcp)
+{
+	struct IKCPBBR *bbr;
+	bbr = (struct IKCPBBR*)ikmem_malloc(sizeof(struct IKCPBBR));
+	if (bbr == NULL) return -1;
+	memset(bbr, 0, sizeof(struct IKCPBBR));
+	bbr->mode = IKCP_BBR_STARTUP;
+	bbr->round_ts = kcp->current;
+	if (kcp->cwnd < IKCP_BBR_CWND_MIN) {
+		kcp->cwnd = IKCP_BBR_CWND_MIN;
+		kcp->incr = kcp->cwnd * kcp->mss;
+	}
+	kcp->ccdata = bbr;
+	return 0;
+}
+
+static void ikcp_bbr_release(ikcpcb *kcp)
+{
+	if (kcp->ccdata) {
+		ikmem_free(kcp->ccdata);
+		kcp->ccdata = NULL;
+	}
+}
+
+static void ikcp_bbr_ack(ikcpcb *kcp, IUINT32 una, IUINT32 acked, IINT32 rtt)
+{
+	struct IKCPBBR *bbr = (struct IKCPBBR*)kcp->ccdata;
+	IUINT32 current = kcp->current;
+	IUINT32 cwnd = kcp->cwnd;
+	IUINT32 window;
+	IINT32 elapsed;
+
+	bbr->delivered += acked;
+
+	// min rtt expired: drain the queue and measure it again
+	if (rtt >= 0) {
+		if (bbr->min_rtt > 0 && bbr->mode != IKCP_BBR_PROBE_RTT &&
+			itimediff(current, bbr->min_rtt_ts) > IKCP_BBR_RTT_EXPIRE) {
+			bbr->mode = IKCP_BBR_PROBE_RTT;
+			bbr->prior_cwnd = cwnd;
+			bbr->probe_rtt_ts = current + 
+				_imax(IKCP_BBR_PROBE_TIME, bbr->min_rtt);
+			bbr->min_rtt = 0;
+		}
+		if (bbr->min_rtt == 0 || (IUINT32)rtt <= bbr->min_rtt) {
+			bbr->min_rtt = (rtt > 0)? (IUINT32)rtt : 1;
+			bbr->min_rtt_ts = current;
+		}
+	}
+
+	// one sample of delivery rate per round (min rtt)
+	elapsed = itimediff(current, bbr->round_ts);
+	if (elapsed > 0 && elapsed >= (IINT32)_imax(bbr->min_rtt, kcp->interval)) {
+		IUINT64 count = bbr->delivered - bbr->round_delivered;
+		IUINT32 rate = (IUINT32)((count << IKCP_BBR_BW_SHIFT) / elapsed);
+		IUINT32 maxbw = ikcp_bbr_maxbw(bbr);
+		int limited = (kcp->nsnd_que == 0 && kcp->nsnd_buf < cwnd);
+		bbr->round++;
+		if (limited && rate < maxbw) rate = 0;
+		bbr->bw[bbr->round % IKCP_BBR_ROUNDS] = rate;
+		bbr->round_ts = current;
+		bbr->round_delivered = bbr->delivered;
+		maxbw = ikcp_bbr_maxbw(bbr);
+		if (bbr->mode == IKCP_BBR_STARTUP && limited == 0) {
+			// pipe is full if bandwidth grows less than 25% in 3 rounds
+			if (maxbw >= bbr->full_bw + bbr->full_bw / 4) {
+				bbr->full_bw = maxbw;
+				bbr->full_cnt = 0;
+			}
+			else if (++bbr->full_cnt >= 3) {
+				bbr->mode = IKCP_BBR_DRAIN;
+				bbr->drain_round = bbr->round;
+			}
+		}
+		else if (bbr->mode == IKCP_BBR_PROBE_BW) {
+			bbr->cycle = (bbr->cycle + 1) & 7;
+		}
+	}
+
+	window = ikcp_bbr_window(kcp, bbr, 4);
+
+	switch (bbr->mode) {
+	case IKCP_BBR_STARTUP:
+		cwnd += acked;
+		break;
+	case IKCP_BBR_DRAIN:
+		// lost segments stay in snd_buf, so drain at most one round
+		cwnd = window;
+		if (kcp->nsnd_buf <= window || bbr->round != bbr->drain_round) {
+			bbr->mode = IKCP_BBR_PROBE_BW;
+			bbr->cycle = 2;
+		}
+		break;
+	case IKCP_BBR_PROBE_BW:
+		cwnd = ikcp_bbr_window(kcp, bbr, ikcp_bbr_gain[bbr->cycle]);
+		break;
+	case IKCP_BBR_PROBE_RTT:
+		cwnd = IKCP_BBR_CWND_MIN;
+		if (itimediff(current, bbr->probe_rtt_ts) >= 0) {
+			bbr->mode = (bbr->full_cnt >= 3)? 
+				IKCP_BBR_PROBE_BW : IKCP_BBR_STARTUP;
+			cwnd = bbr->prior_cwnd;
+		}
+		break;
+	}
+
+	if (cwnd < IKCP_BBR_CWND_MIN) cwnd = IKCP_BBR_CWND_MIN;
+
+	// ikcp_flush limits (snd_nxt - snd_una) by cwnd, segments acked
+	// behind a lost one are not in flight and must not block sending
+	cwnd += (kcp->snd_nxt - kcp->snd_una) - kcp->nsnd_buf;
+	if (cwnd > kcp->snd_wnd) cwnd = kcp->snd_wnd;
+
+	kcp->cwnd = cwnd;
+	kcp->incr = cwnd * kcp->mss;
+}
+
+// pacing rate: max bandwidth by the gain of current mode, the padding
+// and hole correction of cwnd are not part of it
+static IUINT64 ikcp_bbr_rate(const ikcpcb *kcp)
+{
+	const struct IKCPBBR *bbr = (const struct IKCPBBR*)kcp->ccdata;
+	IUINT64 bw = ikcp_bbr_maxbw(bbr);
+	IUINT64 num = 4, den = 4;
+	switch (bbr->mode) {
+	case IKCP_BBR_STARTUP: num = IKCP_BBR_HIGH_GAIN; break;
+	case IKCP_BBR_DRAIN: den = IKCP_BBR_HIGH_GAIN; break;
+	case IKCP_BBR_PROBE_BW: num = ikcp_bbr_gain[bbr->cycle]; break;
+	}
+	return ((bw * kcp->mss * 1000 * num / den) >> IKCP_BBR_BW_SHIFT);
+}
+
+static const struct IKCPCC ikcp_cc_bbr = {
+	"bbr",
+	ikcp_bbr_init,
+	ikcp_bbr_release,
+	ikcp_bbr_ack,
+	NULL,
+	ikcp_bbr_rate,
+};
+
+
+//---------------------------------------------------------------------
+// cubic: window grows as a cubic function of the time since the last
+// reduction, plateaus around the window where loss happened before.
+// reduction is done at most once per rtt.
+//---------------------------------------------------------------------
+#define IKCP_CUBIC_BETA			717		// decrease factor 0.7 (x1024)
+#define IKCP_CUBIC_C			410		// scaling constant 0.4 (x1024)
+#define IKCP_CUBIC_TMAX			300000	// bound of (t - K) in millisec
+
+struct IKCPCUBIC
+{
+	IUINT32 epoch;			// start of current growth, 0 for none
+	IUINT32 w_max;			// window before last reduction
+	IUINT32 origin;			// window of the plateau
+	IUINT32 k;				// millisec to reach the plateau
+	IUINT32 ack_cnt;		// acked segments since last increase
+	IUINT32 loss_ts;		// time of last reduction
+};
+
+// integer cube root
+static IUINT32 ikcp_cbrt(IUINT64 x)
+{
+	IUINT64 y = 0, b;
+	int s;
+	for (s = 63; s >= 0; s -= 3) {
+		y += y;
+		b = 3 * y * (y + 1) + 1;
+		if ((x >> s) >= b) {
+			x -= b << s;
+			y++;
+		}
+	}
+	return (IUINT32)y;
+}
+
+static int ikcp_cubic_init(ikcpcb *kcp)
+{
+	struct IKCPCUBIC *cubic;
+	cubic = (struct IKCPCUBIC*)ikmem_malloc(sizeof(struct IKCPCUBIC));
+	if (cubic == NULL) return -1;
+	memset(cubic, 0, sizeof(struct IKCPCUBIC));
+	kcp->ccdata = cubic;
+	// slow start until the first loss
+	kcp->ssthresh = kcp->snd_wnd;
+	return 0;
+}
+
+static void ikcp_cubic_release(ikcpcb *kcp)
+{
+	if (kcp->ccdata) {
+		ikmem_free(kcp->ccdata);
+		kcp->ccdata = NULL;
+	}
+}
+
+static void ikcp_cubic_ack(ikcpcb *kcp, IUINT32 una, IUINT32 acked, IINT32 rtt)
+{
+	struct IKCPCUBIC *cubic = (struct IKCPCUBIC*)kcp->ccdata;
+	IUINT32 current = kcp->current;
+	IUINT32 cwnd = kcp->cwnd;
+
+	if (acked == 0 || cwnd >= kcp->rmt_wnd) return;
+
+	if (cwnd < kcp->ssthresh) {
+		cwnd += acked;
+	}	else {
+		IUINT64 offs, delta;
+		IUINT32 target, cnt;
+		IINT32 t;
+		if (cubic->epoch == 0) {
+			cubic->epoch = current;
+			cubic->ack_cnt = 0;
+			if (cwnd < cubic->w_max) {
+				IUINT64 x = (IUINT64)(cubic->w_max - cwnd) * 1024;
+				x = x * 1000000000 / IKCP_CUBIC_C;
+				cubic->k = ikcp_cbrt(x);
+				cubic->origin = cubic->w_max;
+			}	else {
+				cubic->k = 0;
+				cubic->origin = cwnd;
+			}
+		}
+		// target window one rtt later
+		t = itimediff(current, cubic->epoch) + kcp->rx_srtt;
+		if (t < 0) t = 0;
+		offs = ((IUINT32)t < cubic->k)? cubic->k - t : t - cubic->k;
+		if (offs > IKCP_CUBIC_TMAX) offs = IKCP_CUBIC_TMAX;
+		delta = ((offs * offs * offs * IKCP_CUBIC_C) >> 10) / 1000000000;
+		if ((IUINT32)t >= cubic->k) {
+			target = cubic->origin + (IUINT32)delta;
+		}
+		else if (delta < cubic->origin) {
+			target = cubic->origin - (IUINT32)delta;
+		}
+		else {
+			target = 1;
+		}
+		cnt = (target > cwnd)? cwnd / (target - cwnd) : cwnd * 100;
+		if (cnt < 1) cnt = 1;
+		cubic->ack_cnt += acked;
+		if (cubic->ack_cnt >= cnt) {
+			cwnd += cubic->ack_cnt / cnt;
+			cubic->ack_cnt %= cnt;
+		}
+	}
+
+	if (cwnd > kcp->rmt_wnd) cwnd = kcp->rmt_wnd;
+
+	kcp->cwnd = cwnd;
+	kcp->incr = cwnd * kcp->mss;
+}
+
+static void ikcp_cubic_loss(ikcpcb *kcp, int fast, int timeout, IUINT32 cwnd)
+{
+	struct IKCPCUBIC *cubic = (struct IKCPCUBIC*)kcp->ccdata;
+	IUINT32 window = kcp->cwnd;
+
+	if (cubic->loss_ts != 0 && 
+		itimediff(kcp->current, cubic->loss_ts) < kcp->rx_srtt) 
+		return;
+
+	cubic->loss_ts = kcp->current;
+	cubic->epoch = 0;
+
+	// fast convergence: leave more room for new flows
+	if (window < cubic->w_max) {
+		cubic->w_max = (window * (1024 + IKCP_CUBIC_BETA)) >> 11;
+	}	else {
+		cubic->w_max = window;
+	}
+
+	kcp->ssthresh = (window * IKCP_CUBIC_BETA) >> 10;
+	if (kcp->ssthresh < IKCP_THRESH_MIN)
+		kcp->ssthresh = IKCP_THRESH_MIN;
+
+	kcp->cwnd = (timeout)? 1 : kcp->ssthresh;
+	kcp->incr = kcp->cwnd * kcp->mss;
+}
+
+static const struct IKCPCC ikcp_cc_cubic = {
+	"cubic",
+	ikcp_cubic_init,
+	ikcp_cubic_release,
+	ikcp_cubic_ack,
+	ikcp_cubic_loss,
+	NULL,
+};
+
+
 //---------------------------------------------------------------------
 // create a new kcpcb
 //---------------------------------------------------------------------
@@ -139,10 +665,32 @@ ikcpcb* ikcp_create(IUINT32 conv, void *user)
 	iqueue_init(&kcp->rcv_queue);
 	iqueue_init(&kcp->snd_buf);
 	iqueue_init(&kcp->rcv_buf);
+
+	kcp->acklog = iv_create();
+	kcp->nacklog = 0;
+	kcp->snd_ring = NULL;
+	kcp->rcv_ring = NULL;
+	kcp->snd_mask = 0;
+	kcp->rcv_mask = 0;
+
+	if (kcp->acklog == NULL || 
+		ikcp_ring_grow(&kcp->snd_ring, &kcp->snd_mask, IKCP_WND_SND,
+			&kcp->snd_buf) != 0 ||
+		ikcp_ring_grow(&kcp->rcv_ring, &kcp->rcv_mask, IKCP_WND_RCV,
+			&kcp->rcv_buf) != 0) {
+		if (kcp->snd_ring) ikmem_free(kcp->snd_ring);
+		if (kcp->acklog) iv_delete(kcp->acklog);
+		iv_delete(kcp->acklist);
+		ikmem_free(kcp->buffer);
+		ikmem_free(kcp);
+		return NULL;
+	}
+
 	kcp->nrcv_buf = 0;
 	kcp->nsnd_buf = 0;
 	kcp->nrcv_que = 0;
 	kcp->nsnd_que = 0;
+	kcp->rcv_skip = 0;
 	kcp->state = 0;
 	kcp->ackcount = 0;
 	kcp->rx_srtt = 0;
@@ -159,10 +707,24 @@ ikcpcb* ikcp_create(IUINT32 conv, void *user)
 	kcp->ssthresh = IKCP_THRESH_INIT;
 	kcp->fastresend = 0;
 	kcp->nocwnd = 0;
+	kcp->sack = 0;
+	kcp->stream = 0;
 	kcp->xmit = 0;
+	kcp->pacing = 0;
+	kcp->paced = 0;
+	kcp->ts_pace = 0;
+	kcp->ts_refill = 0;
+	kcp->pace_tokens = 0;
     kcp->dead_link = IKCP_DEADLINK;
 	kcp->output = NULL;
 	kcp->writelog = NULL;
+	kcp->cc = &ikcp_cc_reno;
+	kcp->ccdata = NULL;
+	ikcp_pool_init(&kcp->segpool, kcp->mss, IKCP_POOL_LIMIT);
+	kcp->pool = &kcp->segpool;
+	kcp->arena = NULL;
+	kcp->narena = 0;
+	memset(&kcp->stat, 0, sizeof(kcp->stat));
 
 	return kcp;
 }
@@ -202,6 +764,22 @@ void ikcp_release(ikcpcb *kcp)
 		if (kcp->acklist) {
 			iv_delete(kcp->acklist);
 		}
+		if (kcp->acklog) {
+			iv_delete(kcp->acklog);
+		}
+		if (kcp->snd_ring) {
+			ikmem_free(kcp->snd_ring);
+		}
+		if (kcp->rcv_ring) {
+			ikmem_free(kcp->rcv_ring);
+		}
+		if (kcp->cc && kcp->cc->release) {
+			kcp->cc->release(kcp);
+		}
+		if (kcp->arena) {
+			ikmem_free(kcp->arena);
+		}
+		ikcp_pool_clear(&kcp->segpool);
 
 		kcp->nrcv_buf = 0;
 		kcp->nsnd_buf = 0;
@@ -210,12 +788,43 @@ void ikcp_release(ikcpcb *kcp)
 		kcp->ackcount = 0;
 		kcp->buffer = NULL;
 		kcp->acklist = NULL;
+		kcp->acklog = NULL;
+		kcp->snd_ring = NULL;
+		kcp->rcv_ring = NULL;
 		ikmem_free(kcp);
 	}
 }
 
 
 
+//---------------------------------------------------------------------
+// move available data from rcv_buf -> rcv_queue after user recv
+//---------------------------------------------------------------------
+static void ikcp_recv_move(ikcpcb *kcp, int recover)
+{
+	while (! iqueue_is_empty(&kcp->rcv_buf)) {
+		IKCPSEG *seg = iqueue_entry(kcp->rcv_buf.next, IKCPSEG, node);
+		if (seg->sn == kcp->rcv_nxt && kcp->nrcv_que < kcp->rcv_wnd) {
+			kcp->rcv_ring[seg->sn & kcp->rcv_mask] = NULL;
+			iqueue_del(&seg->node);
+			kcp->nrcv_buf--;
+			iqueue_add_tail(&seg->node, &kcp->rcv_queue);
+			kcp->nrcv_que++;
+			kcp->rcv_nxt++;
+		}	else {
+			break;
+		}
+	}
+
+	// fast recover
+	if (kcp->nrcv_que < kcp->rcv_wnd && recover) {
+		// ready to send back IKCP_CMD_WINS in ikcp_flush
+		// tell remote my window size
+		kcp->probe |= IKCP_ASK_TELL;
+	}
+}
+
+
 //---------------------------------------------------------------------
 // user/upper level recv: returns size, returns below zero for EAGAIN
 //---------------------------------------------------------------------
@@ -233,6 +842,28 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len)
 
 	if (len < 0) len = -len;
 
+	if (kcp->stream) {
+		IUINT32 skip = kcp->rcv_skip;
+		int size = 0;
+		// as many bytes as 'len' allows
+		for (p = kcp->rcv_queue.next; p != &kcp->rcv_queue; p = p->next) {
+			int n;
+			seg = iqueue_entry(p, IKCPSEG, node);
+			n = (int)(seg->len - skip);
+			if (n > len - size) n = len - size;
+			if (buffer) {
+				memcpy(buffer + size, seg->data + skip, n);
+			}
+			size += n;
+			skip = 0;
+			if (size >= len) break;
+		}
+		if (ispeek == 0) {
+			ikcp_consume(kcp, size);
+		}
+		return size;
+	}
+
 	peeksize = ikcp_peeksize(kcp);
 
 	if (peeksize < 0) 
@@ -246,16 +877,17 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len)
 
 	// merge fragment
 	for (len = 0, p = kcp->rcv_queue.next; p != &kcp->rcv_queue; ) {
+		IUINT32 skip = (p == kcp->rcv_queue.next)? kcp->rcv_skip : 0;
 		int fragment;
 		seg = iqueue_entry(p, IKCPSEG, node);
 		p = p->next;
 
 		if (buffer) {
-			memcpy(buffer, seg->data, seg->len);
-			buffer += seg->len;
+			memcpy(buffer, seg->data + skip, seg->len - skip);
+			buffer += seg->len - skip;
 		}
 
-		len += seg->len;
+		len += seg->len - skip;
 		fragment = seg->frg;
 
 		if (ikcp_canlog(kcp, IKCP_LOG_RECV)) {
@@ -266,6 +898,7 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len)
 			iqueue_del(&seg->node);
 			ikcp_segment_delete(kcp, seg);
 			kcp->nrcv_que--;
+			kcp->rcv_skip = 0;
 		}
 
 		if (fragment == 0) 
@@ -274,28 +907,70 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len)
 
 	assert(len == peeksize);
 
-	// move available data from rcv_buf -> rcv_queue
-	while (! iqueue_is_empty(&kcp->rcv_buf)) {
-		IKCPSEG *seg = iqueue_entry(kcp->rcv_buf.next, IKCPSEG, node);
-		if (seg->sn == kcp->rcv_nxt && kcp->nrcv_que < kcp->rcv_wnd) {
-			iqueue_del(&seg->node);
-			kcp->nrcv_buf--;
-			iqueue_add_tail(&seg->node, &kcp->rcv_queue);
-			kcp->nrcv_que++;
-			kcp->rcv_nxt++;
-		}	else {
+	ikcp_recv_move(kcp, recover);
+
+	return len;
+}
+
+
+//---------------------------------------------------------------------
+// zero-copy recv: pieces of payload in rcv_queue
+//---------------------------------------------------------------------
+int ikcp_peekv(const ikcpcb *kcp, const char **data, int *size, int count)
+{
+	const struct IQUEUEHEAD *p;
+	IUINT32 skip = kcp->rcv_skip, index = 0;
+	int n = 0;
+
+	assert(kcp);
+
+	for (p = kcp->rcv_queue.next; p != &kcp->rcv_queue && n < count; ) {
+		const IKCPSEG *seg = iqueue_entry(p, const IKCPSEG, node);
+		p = p->next;
+		// frg is the count of fragments behind it in the same message
+		if (kcp->nrcv_que - index <= seg->frg) break;
+		data[n] = seg->data + skip;
+		size[n] = (int)(seg->len - skip);
+		skip = 0;
+		index++;
+		n++;
+	}
+
+	return n;
+}
+
+
+//---------------------------------------------------------------------
+// zero-copy recv: remove bytes from the head of rcv_queue
+//---------------------------------------------------------------------
+int ikcp_consume(ikcpcb *kcp, int len)
+{
+	int recover = (kcp->nrcv_que >= kcp->rcv_wnd)? 1 : 0;
+	int size = 0;
+
+	assert(kcp);
+
+	while (! iqueue_is_empty(&kcp->rcv_queue)) {
+		IKCPSEG *seg = iqueue_entry(kcp->rcv_queue.next, IKCPSEG, node);
+		IUINT32 n = seg->len - kcp->rcv_skip;
+		if (n > (IUINT32)(len - size)) {
+			kcp->rcv_skip += (IUINT32)(len - size);
+			size = len;
 			break;
 		}
+		if (ikcp_canlog(kcp, IKCP_LOG_RECV)) {
+			ikcp_log(kcp, IKCP_LOG_RECV, "recv sn=%lu", seg->sn);
+		}
+		size += (int)n;
+		kcp->rcv_skip = 0;
+		iqueue_del(&seg->node);
+		ikcp_segment_delete(kcp, seg);
+		kcp->nrcv_que--;
 	}
 
-	// fast recover
-	if (kcp->nrcv_que < kcp->rcv_wnd && recover) {
-		// ready to send back IKCP_CMD_WINS in ikcp_flush
-		// tell remote my window size
-		kcp->probe |= IKCP_ASK_TELL;
-	}
+	ikcp_recv_move(kcp, recover);
 
-	return len;
+	return size;
 }
 
 
@@ -312,8 +987,16 @@ int ikcp_peeksize(const ikcpcb *kcp)
 
 	if (iqueue_is_empty(&kcp->rcv_queue)) return -1;
 
+	if (kcp->stream) {
+		for (p = kcp->rcv_queue.next; p != &kcp->rcv_queue; p = p->next) {
+			seg = iqueue_entry(p, IKCPSEG, node);
+			length += seg->len;
+		}
+		return length - (int)kcp->rcv_skip;
+	}
+
 	seg = iqueue_entry(kcp->rcv_queue.next, IKCPSEG, node);
-	if (seg->frg == 0) return seg->len;
+	if (seg->frg == 0) return seg->len - kcp->rcv_skip;
 
 	if (kcp->nrcv_que < seg->frg + 1) return -1;
 
@@ -323,7 +1006,7 @@ int ikcp_peeksize(const ikcpcb *kcp)
 		if (seg->frg == 0) break;
 	}
 
-	return length;
+	return length - (int)kcp->rcv_skip;
 }
 
 
@@ -338,17 +1021,36 @@ int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
 	assert(kcp->mss > 0);
 	if (len < 0) return -1;
 
+	// append to the last segment not sent yet
+	if (kcp->stream) {
+		if (!iqueue_is_empty(&kcp->snd_queue)) {
+			IKCPSEG *old = iqueue_entry(kcp->snd_queue.prev, IKCPSEG, node);
+			IUINT32 room = _imin(ikcp_segment_size(old), kcp->mss);
+			if (old->len < room) {
+				int extend = (int)_imin(room - old->len, (IUINT32)len);
+				if (buffer) {
+					memcpy(old->data + old->len, buffer, extend);
+					buffer += extend;
+				}
+				old->len += extend;
+				len -= extend;
+			}
+		}
+		if (len <= 0) return 0;
+	}
+
 	if (len <= (int)kcp->mss) count = 1;
 	else count = (len + kcp->mss - 1) / kcp->mss;
 
-	if (count > 255) return -2;
+	if (count > 255 && kcp->stream == 0) return -2;
 
 	if (count == 0) count = 1;
 
 	// fragment
 	for (i = 0; i < count; i++) {
 		int size = len > (int)kcp->mss ? (int)kcp->mss : len;
-		seg = ikcp_segment_new(kcp, size);
+		// full capacity in stream mode, so later sends can be packed
+		seg = ikcp_segment_new(kcp, kcp->stream? (int)kcp->mss : size);
 		assert(seg);
 		if (seg == NULL) {
 			return -2;
@@ -357,7 +1059,7 @@ int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
 			memcpy(seg->data, buffer, size);
 		}
 		seg->len = size;
-		seg->frg = count - i - 1;
+		seg->frg = kcp->stream? 0 : count - i - 1;
 		iqueue_init(&seg->node);
 		iqueue_add_tail(&seg->node, &kcp->snd_queue);
 		kcp->nsnd_que++;
@@ -371,6 +1073,18 @@ int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
 }
 
 
+//---------------------------------------------------------------------
+// rtt histogram: bucket i holds [2^(i-1), 2^i) ms, the last one the rest
+//---------------------------------------------------------------------
+static void ikcp_stat_rtt(ikcpcb *kcp, IINT32 rtt)
+{
+	IUINT32 x = (IUINT32)rtt;
+	int i = 0;
+	for (; x > 0 && i < IKCP_RTT_BUCKETS - 1; x >>= 1) i++;
+	kcp->stat.rtt_hist[i]++;
+}
+
+
 //---------------------------------------------------------------------
 // parse ack
 //---------------------------------------------------------------------
@@ -390,6 +1104,7 @@ static void ikcp_update_ack(ikcpcb *kcp, IINT32 rtt)
 	rto = kcp->rx_srtt + _imax(1, 4 * kcp->rx_rttval);
 	kcp->rx_rto = _ibound(kcp->rx_minrto, rto, IKCP_RTO_MAX);
 	kcp->rx_rtt = (IUINT32)rtt;
+	ikcp_stat_rtt(kcp, rtt);
 }
 
 static void ikcp_shrink_buf(ikcpcb *kcp)
@@ -403,29 +1118,189 @@ static void ikcp_shrink_buf(ikcpcb *kcp)
 	}
 }
 
-static void ikcp_parse_ack(ikcpcb *kcp, IUINT32 sn)
+//---------------------------------------------------------------------
+// skipped acks: every segment in snd_buf before an acked one is counted
+// as skipped (fastack). instead of walking snd_buf on each ack, acks
+// are logged as (key, ts, count) and ikcp_flush applies them in one 
+// walk: segments with sn < key get count. controllers other than the
+// default one don't shrink cwnd on loss, so they only take acks of 
+// segments sent after the last transmission (ts not older), or a hole
+// will be resent on every other ack.
+//---------------------------------------------------------------------
+static void ikcp_acklog_push(ikcpcb *kcp, IUINT32 key, IUINT32 ts,
+	IUINT32 count)
 {
-	struct IQUEUEHEAD *p, *next;
+	size_t newsize = (kcp->nacklog + 1) * (sizeof(key) * 3);
+	IUINT32 *ptr;
+	if (newsize > kcp->acklog->size) {
+		if (iv_resize(kcp->acklog, newsize) != 0) return;
+	}
+	ptr = (IUINT32*)kcp->acklog->data;
+	ptr += kcp->nacklog * 3;
+	ptr[0] = key;
+	ptr[1] = ts;
+	ptr[2] = count;
+	kcp->nacklog++;
+}
 
-	if (itimediff(sn, kcp->snd_una) < 0 || itimediff(sn, kcp->snd_nxt) >= 0)
+static int ikcp_acklog_cmp(const void *a, const void *b)
+{
+	IUINT32 x = ((const IUINT32*)a)[0];
+	IUINT32 y = ((const IUINT32*)b)[0];
+	return (x < y)? -1 : ((x > y)? 1 : 0);
+}
+
+// number of sorted distinct values <= x
+static IUINT32 ikcp_upper_bound(const IUINT32 *vals, IUINT32 n, IUINT32 x)
+{
+	IUINT32 lo = 0, hi = n;
+	while (lo < hi) {
+		IUINT32 mid = (lo + hi) >> 1;
+		if (vals[mid] <= x) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+static void ikcp_apply_fastack(ikcpcb *kcp)
+{
+	IUINT32 n = kcp->nacklog, total = 0, passed = 0, i, j, m;
+	IUINT32 *log, *ages, *sums, *tree;
+	struct IQUEUEHEAD *p;
+
+	kcp->nacklog = 0;
+	if (n == 0 || iqueue_is_empty(&kcp->snd_buf)) return;
+
+	// key -> offset to snd_una, ts -> age, drop keys nothing is under
+	log = (IUINT32*)kcp->acklog->data;
+	for (i = 0, j = 0; i < n; i++) {
+		IINT32 key = itimediff(log[i * 3], kcp->snd_una);
+		IINT32 age = itimediff(kcp->current, log[i * 3 + 1]);
+		if (key <= 0) continue;
+		log[j * 3 + 0] = (IUINT32)key;
+		log[j * 3 + 1] = (age > 0)? (IUINT32)age : 0;
+		log[j * 3 + 2] = log[i * 3 + 2];
+		total += log[i * 3 + 2];
+		j++;
+	}
+
+	if (j == 0) return;
+	n = j;
+	if (n > 1) qsort(log, n, sizeof(IUINT32) * 3, ikcp_acklog_cmp);
+
+	if (kcp->cc == &ikcp_cc_reno) {
+		for (i = 0, p = kcp->snd_buf.next; p != &kcp->snd_buf; p = p->next) {
+			IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
+			IUINT32 key = seg->sn - kcp->snd_una;
+			for (; i < n && log[i * 3] <= key; i++) passed += log[i * 3 + 2];
+			if (passed == total) break;
+			seg->fastack += total - passed;
+		}
 		return;
+	}
 
-	for (p = kcp->snd_buf.next; p != &kcp->snd_buf; p = next) {
+	// count acks with key > sn and age <= age of segment: all acks 
+	// of an age (sums) minus those already passed (fenwick tree)
+	if (iv_resize(kcp->acklog, (n * 6 + 2) * sizeof(IUINT32)) != 0) return;
+	log = (IUINT32*)kcp->acklog->data;
+	ages = log + n * 3;
+	sums = ages + n;
+	tree = sums + n + 1;
+
+	for (i = 0; i < n; i++) ages[i] = log[i * 3 + 1];
+	qsort(ages, n, sizeof(IUINT32), ikcp_acklog_cmp);
+	for (i = 1, m = 1; i < n; i++) {
+		if (ages[i] != ages[m - 1]) ages[m++] = ages[i];
+	}
+	memset(sums, 0, sizeof(IUINT32) * (m + 1));
+	memset(tree, 0, sizeof(IUINT32) * (m + 1));
+	for (i = 0; i < n; i++) {
+		sums[ikcp_upper_bound(ages, m, log[i * 3 + 1])] += log[i * 3 + 2];
+	}
+	for (i = 1; i <= m; i++) sums[i] += sums[i - 1];
+
+	for (i = 0, p = kcp->snd_buf.next; p != &kcp->snd_buf; p = p->next) {
 		IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
-		next = p->next;
-		if (sn == seg->sn) {
-			iqueue_del(p);
-			ikcp_segment_delete(kcp, seg);
-			kcp->nsnd_buf--;
-			break;
-		}
-		else {
-			seg->fastack++;
-			if (seg->fastack >= IKCP_ACK_FAST) {
-		//		kcp->fastack++;
+		IUINT32 key = seg->sn - kcp->snd_una;
+		IINT32 age = itimediff(kcp->current, seg->ts);
+		IUINT32 r, k, count;
+		for (; i < n && log[i * 3] <= key; i++) {
+			for (k = ikcp_upper_bound(ages, m, log[i * 3 + 1]); k <= m; 
+				k += k & (~k + 1)) {
+				tree[k] += log[i * 3 + 2];
 			}
+			passed += log[i * 3 + 2];
+		}
+		if (passed == total) break;
+		r = ikcp_upper_bound(ages, m, (age > 0)? (IUINT32)age : 0);
+		for (count = sums[r], k = r; k > 0; k -= k & (~k + 1)) {
+			count -= tree[k];
+		}
+		seg->fastack += count;
+	}
+}
+
+static void ikcp_parse_ack(ikcpcb *kcp, IUINT32 sn, IUINT32 ts)
+{
+	IKCPSEG *seg;
+
+	if (itimediff(sn, kcp->snd_una) < 0 || itimediff(sn, kcp->snd_nxt) >= 0)
+		return;
+
+	seg = kcp->snd_ring[sn & kcp->snd_mask];
+
+	if (seg != NULL && seg->sn == sn) {
+		kcp->snd_ring[sn & kcp->snd_mask] = NULL;
+		iqueue_del(&seg->node);
+		ikcp_segment_delete(kcp, seg);
+		kcp->nsnd_buf--;
+		ikcp_acklog_push(kcp, sn, ts, 1);
+	}	else {
+		// already acked: every segment is counted
+		ikcp_acklog_push(kcp, kcp->snd_nxt, ts, 1);
+	}
+}
+
+// remove segments in [start, end), segments before them are counted
+// as skipped once per removed one like plain acks
+static void ikcp_parse_range(ikcpcb *kcp, IUINT32 start, IUINT32 end,
+	IUINT32 ts)
+{
+	IUINT32 count = 0, sn;
+
+	// both ends must be in [snd_una, snd_nxt], or a bogus range could
+	// wrap around and walk the whole sequence space
+	if (itimediff(start, kcp->snd_una) < 0) start = kcp->snd_una;
+	if (itimediff(end, kcp->snd_nxt) > 0) end = kcp->snd_nxt;
+	if (itimediff(start, kcp->snd_nxt) >= 0) return;
+	if (itimediff(end, kcp->snd_una) <= 0) return;
+	if (itimediff(end, start) <= 0) return;
+
+	for (sn = start; sn != end; sn++) {
+		IKCPSEG *seg = kcp->snd_ring[sn & kcp->snd_mask];
+		if (seg != NULL && seg->sn == sn) {
+			kcp->snd_ring[sn & kcp->snd_mask] = NULL;
+			iqueue_del(&seg->node);
+			ikcp_segment_delete(kcp, seg);
+			kcp->nsnd_buf--;
+			count++;
 		}
 	}
+
+	if (count > 0) {
+		ikcp_acklog_push(kcp, start, ts, count);
+	}
+}
+
+static void ikcp_parse_sack(ikcpcb *kcp, const char *data, IUINT32 len,
+	IUINT32 ts)
+{
+	for (; len >= 8; len -= 8) {
+		IUINT32 start, end;
+		data = idecode32u_lsb(data, &start);
+		data = idecode32u_lsb(data, &end);
+		ikcp_parse_range(kcp, start, end, ts);
+	}
 }
 
 static void ikcp_parse_una(ikcpcb *kcp, IUINT32 una)
@@ -436,6 +1311,7 @@ static void ikcp_parse_una(ikcpcb *kcp, IUINT32 una)
 		IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
 		next = p->next;
 		if (itimediff(una, seg->sn) > 0) {
+			kcp->snd_ring[seg->sn & kcp->snd_mask] = NULL;
 			iqueue_del(p);
 			ikcp_segment_delete(kcp, seg);
 			kcp->nsnd_buf--;
@@ -478,7 +1354,7 @@ static void ikcp_ack_get(const ikcpcb *kcp, int p, IUINT32 *sn, IUINT32 *ts)
 //---------------------------------------------------------------------
 void ikcp_parse_data(ikcpcb *kcp, IKCPSEG *newseg)
 {
-	struct IQUEUEHEAD *p, *prev;
+	struct IQUEUEHEAD *p;
 	IUINT32 sn = newseg->sn;
 	int repeat = 0;
 	
@@ -488,21 +1364,25 @@ void ikcp_parse_data(ikcpcb *kcp, IKCPSEG *newseg)
 		return;
 	}
 
-	for (p = kcp->rcv_buf.prev; p != &kcp->rcv_buf; p = prev) {
-		IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
-		prev = p->prev;
-		if (seg->sn == sn) {
-			repeat = 1;
-			break;
-		}
-		if (itimediff(sn, seg->sn) > 0) {
-			break;
+	if (kcp->rcv_ring[sn & kcp->rcv_mask] != NULL) {
+		repeat = 1;
+	}	else {
+		// insert after the nearest segment before it
+		IUINT32 prev_sn = sn - 1;
+		p = &kcp->rcv_buf;
+		for (; itimediff(prev_sn, kcp->rcv_nxt) >= 0; prev_sn--) {
+			IKCPSEG *seg = kcp->rcv_ring[prev_sn & kcp->rcv_mask];
+			if (seg != NULL) {
+				p = &seg->node;
+				break;
+			}
 		}
 	}
 
 	if (repeat == 0) {
 		iqueue_init(&newseg->node);
 		iqueue_add(&newseg->node, p);
+		kcp->rcv_ring[sn & kcp->rcv_mask] = newseg;
 		kcp->nrcv_buf++;
 	}	else {
 		ikcp_segment_delete(kcp, newseg);
@@ -517,6 +1397,7 @@ void ikcp_parse_data(ikcpcb *kcp, IKCPSEG *newseg)
 	while (! iqueue_is_empty(&kcp->rcv_buf)) {
 		IKCPSEG *seg = iqueue_entry(kcp->rcv_buf.next, IKCPSEG, node);
 		if (seg->sn == kcp->rcv_nxt && kcp->nrcv_que < kcp->rcv_wnd) {
+			kcp->rcv_ring[seg->sn & kcp->rcv_mask] = NULL;
 			iqueue_del(&seg->node);
 			kcp->nrcv_buf--;
 			iqueue_add_tail(&seg->node, &kcp->rcv_queue);
@@ -545,6 +1426,8 @@ void ikcp_parse_data(ikcpcb *kcp, IKCPSEG *newseg)
 int ikcp_input(ikcpcb *kcp, const char *data, long size)
 {
 	IUINT32 una = kcp->snd_una;
+	IUINT32 nsnd_buf = kcp->nsnd_buf;
+	IINT32 minrtt = -1;
 
 	if (ikcp_canlog(kcp, IKCP_LOG_INPUT)) {
 		ikcp_log(kcp, IKCP_LOG_INPUT, "[RI] %d bytes", size);
@@ -552,17 +1435,16 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 
 	if (data == NULL || size < 24) return 0;
 
-	while (1) {
+	kcp->stat.bytes_in += (IUINT32)size;
+	kcp->stat.pkts_in++;
+
+	while (size >= (long)IKCP_OVERHEAD) {
 		IUINT32 ts, sn, len, una, conv;
 		IUINT16 wnd;
 		IUINT8 cmd, frg;
 		IKCPSEG *seg;
 
-		if (size < (int)IKCP_OVERHEAD) break;
-
 		data = idecode32u_lsb(data, &conv);
-		if (conv != kcp->conv) return -1;
-
 		data = idecode8u(data, &cmd);
 		data = idecode8u(data, &frg);
 		data = idecode16u_lsb(data, &wnd);
@@ -572,12 +1454,25 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 		data = idecode32u_lsb(data, &len);
 
 		size -= IKCP_OVERHEAD;
+		if (conv != kcp->conv) {
+			kcp->stat.bad_pkts++;
+			return -1;
+		}
+		if ((IUINT32)size < len) {
+			kcp->stat.bad_pkts++;
+			return -2;
+		}
 
-		if ((long)size < (long)len) return -2;
-
-		if (cmd != IKCP_CMD_PUSH && cmd != IKCP_CMD_ACK &&
-			cmd != IKCP_CMD_WASK && cmd != IKCP_CMD_WINS) 
+		// commands are continuous from IKCP_CMD_PUSH to IKCP_CMD_SACK
+		if (cmd < IKCP_CMD_PUSH || cmd > IKCP_CMD_SACK) {
+			kcp->stat.bad_pkts++;
 			return -3;
+		}
+		size -= len;
+
+		if (cmd != IKCP_CMD_PUSH && (frg & IKCP_SACK_FLAG)) {
+			kcp->sack |= IKCP_SACK_REMOTE;
+		}
 
 		kcp->rmt_wnd = wnd;
 		ikcp_parse_una(kcp, una);
@@ -585,9 +1480,11 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 
 		if (cmd == IKCP_CMD_ACK) {
 			if (itimediff(kcp->current, ts) >= 0) {
-				ikcp_update_ack(kcp, itimediff(kcp->current, ts));
+				IINT32 rtt = itimediff(kcp->current, ts);
+				ikcp_update_ack(kcp, rtt);
+				if (minrtt < 0 || rtt < minrtt) minrtt = rtt;
 			}
-			ikcp_parse_ack(kcp, sn);
+			ikcp_parse_ack(kcp, sn, ts);
 			ikcp_shrink_buf(kcp);
 			if (ikcp_canlog(kcp, IKCP_LOG_IN_ACK)) {
 				ikcp_log(kcp, IKCP_LOG_IN_DATA, 
@@ -596,15 +1493,37 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 					(long)kcp->rx_rto);
 			}
 		}
+		else if (cmd == IKCP_CMD_SACK) {
+			kcp->sack |= IKCP_SACK_REMOTE | IKCP_SACK_CONFIRM;
+			if (itimediff(kcp->current, ts) >= 0) {
+				IINT32 rtt = itimediff(kcp->current, ts);
+				ikcp_update_ack(kcp, rtt);
+				if (minrtt < 0 || rtt < minrtt) minrtt = rtt;
+			}
+			ikcp_parse_sack(kcp, data, len, ts);
+			ikcp_shrink_buf(kcp);
+			if (ikcp_canlog(kcp, IKCP_LOG_IN_ACK)) {
+				ikcp_log(kcp, IKCP_LOG_IN_ACK, 
+					"input sack: ranges=%lu rtt=%ld rto=%ld", len / 8,
+					(long)itimediff(kcp->current, ts),
+					(long)kcp->rx_rto);
+			}
+		}
 		else if (cmd == IKCP_CMD_PUSH) {
 			if (ikcp_canlog(kcp, IKCP_LOG_IN_DATA)) {
 				ikcp_log(kcp, IKCP_LOG_IN_DATA, 
 					"input psh: sn=%lu ts=%lu", sn, ts);
 			}
 			if (itimediff(sn, kcp->rcv_nxt + kcp->rcv_wnd) < 0) {
-				ikcp_ack_push(kcp, sn, ts);
-				if (itimediff(sn, kcp->rcv_nxt) >= 0) {
+				// duplicates are acked again but never allocated, 
+				// and a segment is not acked if it can't be stored
+				if (itimediff(sn, kcp->rcv_nxt) >= 0 &&
+					kcp->rcv_ring[sn & kcp->rcv_mask] == NULL) {
 					seg = ikcp_segment_new(kcp, len);
+					if (seg == NULL) {
+						data += len;
+						continue;
+					}
 					seg->conv = conv;
 					seg->cmd = cmd;
 					seg->frg = frg;
@@ -619,7 +1538,15 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 					}
 
 					ikcp_parse_data(kcp, seg);
+					kcp->stat.segs_recv++;
+				}
+				else {
+					kcp->stat.dup_segs++;
 				}
+				ikcp_ack_push(kcp, sn, ts);
+			}
+			else {
+				kcp->stat.wnd_drops++;
 			}
 		}
 		else if (cmd == IKCP_CMD_WASK) {
@@ -642,26 +1569,11 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 		}
 
 		data += len;
-		size -= len;
 	}
 
-	if (itimediff(kcp->snd_una, una) > 0) {
-		if (kcp->cwnd < kcp->rmt_wnd) {
-			IUINT32 mss = kcp->mss;
-			if (kcp->cwnd < kcp->ssthresh) {
-				kcp->cwnd++;
-				kcp->incr += mss;
-			}	else {
-				if (kcp->incr < mss) kcp->incr = mss;
-				kcp->incr += (mss * mss) / kcp->incr + (mss / 16);
-				if ((kcp->cwnd + 1) * mss >= kcp->incr) {
-					kcp->cwnd++;
-				}
-			}
-			if (kcp->cwnd > kcp->rmt_wnd) {
-				kcp->cwnd = kcp->rmt_wnd;
-				kcp->incr = kcp->rmt_wnd * mss;
-			}
+	if (kcp->nsnd_buf < nsnd_buf || itimediff(kcp->snd_una, una) > 0) {
+		if (kcp->cc->ack) {
+			kcp->cc->ack(kcp, una, nsnd_buf - kcp->nsnd_buf, minrtt);
 		}
 	}
 
@@ -694,6 +1606,95 @@ static int ikcp_wnd_unused(const ikcpcb *kcp)
 }
 
 
+//---------------------------------------------------------------------
+// compact acklist into IKCP_CMD_SACK segments: runs of continuous sn 
+// become [start, end) ranges, ts of the last entry is for rtt
+//---------------------------------------------------------------------
+static char *ikcp_flush_sack(ikcpcb *kcp, char *ptr, const IKCPSEG *ack)
+{
+	char *buffer = kcp->buffer;
+	int count = (int)kcp->ackcount;
+	int i = 0;
+	IKCPSEG seg = *ack;
+
+	seg.cmd = IKCP_CMD_SACK;
+
+	while (i < count) {
+		char *head, *data;
+		int size = (int)(ptr - buffer);
+		int room, n;
+		if (size + IKCP_OVERHEAD + 8 > (int)kcp->mtu) {
+			ikcp_output(kcp, buffer, size);
+			ptr = buffer;
+			size = 0;
+		}
+		room = ((int)kcp->mtu - size - (int)IKCP_OVERHEAD) / 8;
+		head = ptr;
+		data = ptr + IKCP_OVERHEAD;
+		for (n = 0; n < room && i < count; n++) {
+			IUINT32 sn, start, end;
+			ikcp_ack_get(kcp, i++, &seg.sn, &seg.ts);
+			start = seg.sn;
+			end = start + 1;
+			for (; i < count; i++) {
+				ikcp_ack_get(kcp, i, &sn, NULL);
+				if (sn != end) break;
+				ikcp_ack_get(kcp, i, &seg.sn, &seg.ts);
+				end++;
+			}
+			data = iencode32u_lsb(data, start);
+			data = iencode32u_lsb(data, end);
+		}
+		seg.len = (IUINT32)(n * 8);
+		ikcp_encode_seg(head, &seg);
+		ptr = data;
+	}
+
+	return ptr;
+}
+
+
+//---------------------------------------------------------------------
+// pacing: bytes per second given by the congestion control or allowed
+// by cwnd (segments) and srtt, the budget accrues for at most one 
+// interval and may go below zero by the last segment sent
+//---------------------------------------------------------------------
+static IUINT64 ikcp_pace_rate(const ikcpcb *kcp, IUINT32 cwnd)
+{
+	IUINT64 gain = kcp->pacing;
+	IUINT64 srtt = (kcp->rx_srtt > 0)? (IUINT64)kcp->rx_srtt : 1;
+	if (kcp->cc->rate) {
+		IUINT64 rate = kcp->cc->rate(kcp);
+		if (rate > 0) return (rate * gain) / 100;
+	}
+	if (kcp->nocwnd == 0 && kcp->cwnd < kcp->ssthresh) gain *= 2;
+	return ((IUINT64)cwnd * kcp->mss * gain * 10) / srtt;
+}
+
+static void ikcp_pace_refill(ikcpcb *kcp, IUINT64 rate)
+{
+	IINT32 elapsed = itimediff(kcp->current, kcp->ts_refill);
+	IINT64 limit = (IINT64)((rate * kcp->interval) / 1000);
+	IINT64 tokens;
+	if (elapsed < 0) elapsed = 0;
+	if (elapsed > (IINT32)kcp->interval) elapsed = kcp->interval;
+	if (limit < (IINT64)kcp->mtu) limit = kcp->mtu;
+	tokens = kcp->pace_tokens + (IINT64)((rate * elapsed) / 1000);
+	kcp->pace_tokens = (IINT32)((tokens < limit)? tokens : limit);
+	kcp->ts_refill = kcp->current;
+}
+
+// millisec until the budget is positive again
+static IUINT32 ikcp_pace_wait(const ikcpcb *kcp, IUINT64 rate)
+{
+	IUINT64 deficit = (IUINT64)(1 - (IINT64)kcp->pace_tokens);
+	IUINT64 wait = (rate > 0)? (deficit * 1000 + rate - 1) / rate : 1;
+	if (wait < 1) wait = 1;
+	if (wait > kcp->interval) wait = kcp->interval;
+	return (IUINT32)wait;
+}
+
+
 //---------------------------------------------------------------------
 // ikcp_flush
 //---------------------------------------------------------------------
@@ -705,17 +1706,22 @@ void ikcp_flush(ikcpcb *kcp)
 	int count, size, i;
 	IUINT32 resent, cwnd;
 	IUINT32 rtomin;
+	IUINT64 rate = 0;
 	struct IQUEUEHEAD *p;
 	int change = 0;
 	int lost = 0;
+	int paced = 0;
 	IKCPSEG seg;
 
 	// 'ikcp_update' haven't been called. 
 	if (kcp->updated == 0) return;
 
+	// count skipped acks received since last flush
+	ikcp_apply_fastack(kcp);
+
 	seg.conv = kcp->conv;
 	seg.cmd = IKCP_CMD_ACK;
-	seg.frg = 0;
+	seg.frg = (kcp->sack & IKCP_SACK_ENABLE)? IKCP_SACK_FLAG : 0;
 	seg.wnd = ikcp_wnd_unused(kcp);
 	seg.una = kcp->rcv_nxt;
 	seg.len = 0;
@@ -724,6 +1730,10 @@ void ikcp_flush(ikcpcb *kcp)
 
 	// flush acknowledges
 	count = kcp->ackcount;
+	if ((kcp->sack & IKCP_SACK_ENABLE) && (kcp->sack & IKCP_SACK_REMOTE)) {
+		ptr = ikcp_flush_sack(kcp, ptr, &seg);
+		count = 0;
+	}
 	for (i = 0; i < count; i++) {
 		size = (int)(ptr - buffer);
 		if (size + IKCP_OVERHEAD > (int)kcp->mtu) {
@@ -758,6 +1768,14 @@ void ikcp_flush(ikcpcb *kcp)
 		kcp->probe_wait = 0;
 	}
 
+	// remote can parse sack but doesn't know we can, tell it by a 
+	// flagged IKCP_CMD_WINS while it has data to acknowledge
+	if ((kcp->sack & IKCP_SACK_ENABLE) && (kcp->sack & IKCP_SACK_REMOTE)) {
+		if ((kcp->sack & IKCP_SACK_CONFIRM) == 0 && kcp->nsnd_buf > 0) {
+			kcp->probe |= IKCP_ASK_TELL;
+		}
+	}
+
 	// flush window probing commands
 	if (kcp->probe & IKCP_ASK_SEND) {
 		seg.cmd = IKCP_CMD_WASK;
@@ -795,6 +1813,7 @@ void ikcp_flush(ikcpcb *kcp)
 
 		iqueue_del(&newseg->node);
 		iqueue_add_tail(&newseg->node, &kcp->snd_buf);
+		kcp->snd_ring[kcp->snd_nxt & kcp->snd_mask] = newseg;
 		kcp->nsnd_que--;
 		kcp->nsnd_buf++;
 
@@ -814,20 +1833,36 @@ void ikcp_flush(ikcpcb *kcp)
 	resent = (kcp->fastresend > 0)? (IUINT32)kcp->fastresend : 0xffffffff;
 	rtomin = (kcp->nodelay == 0)? (kcp->rx_rto >> 3) : 0;
 
+	if (kcp->pacing) {
+		rate = ikcp_pace_rate(kcp, cwnd);
+		ikcp_pace_refill(kcp, rate);
+	}
+
 	// flush data segments
 	for (p = kcp->snd_buf.next; p != &kcp->snd_buf; p = p->next) {
 		IKCPSEG *segment = iqueue_entry(p, IKCPSEG, node);
 		int needsend = 0;
+		if (kcp->pacing && kcp->pace_tokens <= 0) {
+			// out of budget: stop at the first segment due to send
+			if (segment->xmit == 0 || segment->fastack >= resent ||
+				itimediff(current, segment->resendts) >= 0) {
+				paced = 1;
+				break;
+			}
+			continue;
+		}
 		if (segment->xmit == 0) {
 			needsend = 1;
 			segment->xmit++;
 			segment->rto = kcp->rx_rto;
 			segment->resendts = current + segment->rto + rtomin;
+			kcp->stat.segs_sent++;
 		}
 		else if (itimediff(current, segment->resendts) >= 0) {
 			needsend = 1;
 			segment->xmit++;
 			kcp->xmit++;
+			kcp->stat.retrans_timeout++;
 			if (kcp->nodelay == 0) {
 				segment->rto += kcp->rx_rto;
 			}	else {
@@ -841,6 +1876,7 @@ void ikcp_flush(ikcpcb *kcp)
 			segment->xmit++;
 			segment->fastack = 0;
 			segment->resendts = current + segment->rto;
+			kcp->stat.retrans_fast++;
 			change++;
 		}
 
@@ -865,6 +1901,10 @@ void ikcp_flush(ikcpcb *kcp)
 				ptr += segment->len;
 			}
 
+			if (kcp->pacing) {
+				kcp->pace_tokens -= need;
+			}
+
 			if (segment->xmit >= kcp->dead_link) {
 				kcp->state = -1;
 			}
@@ -877,22 +1917,22 @@ void ikcp_flush(ikcpcb *kcp)
 		ikcp_output(kcp, buffer, size);
 	}
 
-	// update ssthresh
-	if (change) {
-		IUINT32 inflight = kcp->snd_nxt - kcp->snd_una;
-		kcp->ssthresh = inflight / 2;
-		if (kcp->ssthresh < IKCP_THRESH_MIN)
-			kcp->ssthresh = IKCP_THRESH_MIN;
-		kcp->cwnd = kcp->ssthresh + resent;
-		kcp->incr = kcp->cwnd * kcp->mss;
+	// wake up for the rest when the budget is positive
+	kcp->paced = paced;
+	if (paced) {
+		kcp->ts_pace = current + ikcp_pace_wait(kcp, rate);
 	}
 
-	if (lost) {
-		kcp->ssthresh = cwnd / 2;
-		if (kcp->ssthresh < IKCP_THRESH_MIN)
-			kcp->ssthresh = IKCP_THRESH_MIN;
-		kcp->cwnd = 1;
-		kcp->incr = kcp->mss;
+	// sample the window in use while data is in flight
+	if (kcp->nsnd_buf > 0) {
+		kcp->stat.cwnd_sum += cwnd;
+		kcp->stat.cwnd_samples++;
+		if (cwnd > kcp->stat.cwnd_max) kcp->stat.cwnd_max = cwnd;
+	}
+
+	// update ssthresh
+	if ((change || lost) && kcp->cc->loss) {
+		kcp->cc->loss(kcp, change, lost, cwnd);
 	}
 
 	if (kcp->cwnd < 1) {
@@ -932,6 +1972,9 @@ void ikcp_update(ikcpcb *kcp, IUINT32 current)
 		}
 		ikcp_flush(kcp);
 	}
+	else if (kcp->paced && itimediff(kcp->current, kcp->ts_pace) >= 0) {
+		ikcp_flush(kcp);
+	}
 }
 
 
@@ -949,6 +1992,7 @@ IUINT32 ikcp_check(const ikcpcb *kcp, IUINT32 current)
 	IUINT32 ts_flush = kcp->ts_flush;
 	IINT32 tm_flush = 0x7fffffff;
 	IINT32 tm_packet = 0x7fffffff;
+	IINT32 tm_pace = 0;
 	IUINT32 minimal = 0;
 	struct IQUEUEHEAD *p;
 
@@ -956,6 +2000,12 @@ IUINT32 ikcp_check(const ikcpcb *kcp, IUINT32 current)
 		return current;
 	}
 
+	// segments due are held by pacing until ts_pace
+	if (kcp->paced) {
+		tm_pace = itimediff(kcp->ts_pace, current);
+		if (tm_pace <= 0) return current;
+	}
+
 	if (itimediff(current, ts_flush) >= 10000 ||
 		itimediff(current, ts_flush) < -10000) {
 		ts_flush = current;
@@ -970,6 +2020,7 @@ IUINT32 ikcp_check(const ikcpcb *kcp, IUINT32 current)
 	for (p = kcp->snd_buf.next; p != &kcp->snd_buf; p = p->next) {
 		const IKCPSEG *seg = iqueue_entry(p, const IKCPSEG, node);
 		IINT32 diff = itimediff(seg->resendts, current);
+		if (diff < tm_pace) diff = tm_pace;
 		if (diff <= 0) {
 			return current;
 		}
@@ -989,7 +2040,7 @@ IUINT32 ikcp_check(const ikcpcb *kcp, IUINT32 current)
 int ikcp_setmtu(ikcpcb *kcp, int mtu)
 {
 	char *buffer;
-	if (mtu < 50 || mtu < (int)IKCP_OVERHEAD) 
+	if (mtu < 50 || mtu < (int)IKCP_OVERHEAD || mtu > (int)IKCP_MTU_MAX) 
 		return -1;
 	buffer = (char*)ikmem_malloc((mtu + IKCP_OVERHEAD) * 3);
 	if (buffer == NULL) 
@@ -998,6 +2049,10 @@ int ikcp_setmtu(ikcpcb *kcp, int mtu)
 	kcp->mss = kcp->mtu - IKCP_OVERHEAD;
 	ikmem_free(kcp->buffer);
 	kcp->buffer = buffer;
+	if (kcp->segpool.size != kcp->mss) {
+		ikcp_pool_clear(&kcp->segpool);
+		kcp->segpool.size = kcp->mss;
+	}
 	return 0;
 }
 
@@ -1035,13 +2090,77 @@ int ikcp_nodelay(ikcpcb *kcp, int nodelay, int interval, int resend, int nc)
 }
 
 
+int ikcp_congestion(ikcpcb *kcp, int id)
+{
+	switch (id) {
+	case IKCP_CC_DEFAULT: return ikcp_setcc(kcp, &ikcp_cc_reno);
+	case IKCP_CC_BBR: return ikcp_setcc(kcp, &ikcp_cc_bbr);
+	case IKCP_CC_CUBIC: return ikcp_setcc(kcp, &ikcp_cc_cubic);
+	}
+	return -1;
+}
+
+int ikcp_setcc(ikcpcb *kcp, const struct IKCPCC *cc)
+{
+	if (kcp->cc && kcp->cc->release) {
+		kcp->cc->release(kcp);
+	}
+	kcp->ccdata = NULL;
+	kcp->cc = (cc)? cc : &ikcp_cc_reno;
+	if (kcp->cc->init) {
+		if (kcp->cc->init(kcp) != 0) {
+			kcp->ccdata = NULL;
+			kcp->cc = &ikcp_cc_reno;
+			return -2;
+		}
+	}
+	return 0;
+}
+
+
+int ikcp_setpool(ikcpcb *kcp, ikcppool *pool)
+{
+	kcp->pool = (pool)? pool : &kcp->segpool;
+	return 0;
+}
+
+int ikcp_stream(ikcpcb *kcp, int enable)
+{
+	kcp->stream = enable? 1 : 0;
+	return 0;
+}
+
+int ikcp_sack(ikcpcb *kcp, int enable)
+{
+	if (enable) kcp->sack |= IKCP_SACK_ENABLE;
+	else kcp->sack &= ~IKCP_SACK_ENABLE;
+	return 0;
+}
+
+int ikcp_pacing(ikcpcb *kcp, int gain)
+{
+	if (gain < 0) return -1;
+	kcp->pacing = (IUINT32)gain;
+	kcp->paced = 0;
+	kcp->pace_tokens = 0;
+	kcp->ts_refill = kcp->current - kcp->interval;
+	return 0;
+}
+
+
 int ikcp_wndsize(ikcpcb *kcp, int sndwnd, int rcvwnd)
 {
 	if (kcp) {
 		if (sndwnd > 0) {
+			if (ikcp_ring_grow(&kcp->snd_ring, &kcp->snd_mask, sndwnd,
+				&kcp->snd_buf) != 0)
+				return -2;
 			kcp->snd_wnd = sndwnd;
 		}
 		if (rcvwnd > 0) {
+			if (ikcp_ring_grow(&kcp->rcv_ring, &kcp->rcv_mask, rcvwnd,
+				&kcp->rcv_buf) != 0)
+				return -2;
 			kcp->rcv_wnd = rcvwnd;
 		}
 	}
@@ -1053,3 +2172,422 @@ int ikcp_waitsnd(const ikcpcb *kcp)
 	return kcp->nsnd_buf + kcp->nsnd_que;
 }
 
+// nothing to send, resend, ack or probe: ikcp_update can be suspended
+// until the next ikcp_input/ikcp_send/ikcp_recv
+int ikcp_idle(const ikcpcb *kcp)
+{
+	if (kcp->updated == 0) return 0;
+	if (kcp->nsnd_buf || kcp->nsnd_que || kcp->ackcount) return 0;
+	if (kcp->probe || kcp->rmt_wnd == 0) return 0;
+	return 1;
+}
+
+
+//=====================================================================
+// SESSION STATE
+//=====================================================================
+#define IKCP_STATE_MAGIC	0x5350434b	// "KCPS"
+#define IKCP_STATE_VERSION	1
+#define IKCP_STATE_FIELDS	40
+#define IKCP_STATE_HEAD		28			// magic, size, version, fields, 
+										// segments, data bytes, reserved
+#define IKCP_STATE_SEG		35			// segment header in the blob
+#define IKCP_ARENA_ALIGN(x)	(((x) + 7) & ~((size_t)7))
+
+#define IKCP_FIELD_U(x) do { if (save) v[n++] = (IUINT32)(x); \
+		else (x) = v[n++]; } while (0)
+#define IKCP_FIELD_I(x) do { if (save) v[n++] = (IUINT32)(x); \
+		else (x) = (IINT32)v[n++]; } while (0)
+
+// scalar fields in the order of the blob: saved to or loaded from v[],
+// returns the count
+static int ikcp_state_fields(ikcpcb *kcp, IUINT32 *v, int save)
+{
+	int n = 0;
+	IKCP_FIELD_U(kcp->conv);
+	IKCP_FIELD_U(kcp->mtu);
+	IKCP_FIELD_U(kcp->state);
+	IKCP_FIELD_U(kcp->snd_una);
+	IKCP_FIELD_U(kcp->snd_nxt);
+	IKCP_FIELD_U(kcp->rcv_nxt);
+	IKCP_FIELD_U(kcp->ts_recent);
+	IKCP_FIELD_U(kcp->ts_lastack);
+	IKCP_FIELD_U(kcp->ssthresh);
+	IKCP_FIELD_I(kcp->rx_rttval);
+	IKCP_FIELD_I(kcp->rx_srtt);
+	IKCP_FIELD_I(kcp->rx_rto);
+	IKCP_FIELD_I(kcp->rx_minrto);
+	IKCP_FIELD_U(kcp->snd_wnd);
+	IKCP_FIELD_U(kcp->rcv_wnd);
+	IKCP_FIELD_U(kcp->rmt_wnd);
+	IKCP_FIELD_U(kcp->cwnd);
+	IKCP_FIELD_U(kcp->probe);
+	IKCP_FIELD_U(kcp->current);
+	IKCP_FIELD_U(kcp->interval);
+	IKCP_FIELD_U(kcp->ts_flush);
+	IKCP_FIELD_U(kcp->xmit);
+	IKCP_FIELD_U(kcp->rcv_skip);
+	IKCP_FIELD_U(kcp->nodelay);
+	IKCP_FIELD_U(kcp->updated);
+	IKCP_FIELD_U(kcp->ts_probe);
+	IKCP_FIELD_U(kcp->probe_wait);
+	IKCP_FIELD_U(kcp->dead_link);
+	IKCP_FIELD_U(kcp->incr);
+	IKCP_FIELD_U(kcp->rx_rtt);
+	IKCP_FIELD_U(kcp->pacing);
+	IKCP_FIELD_U(kcp->paced);
+	IKCP_FIELD_U(kcp->ts_pace);
+	IKCP_FIELD_U(kcp->ts_refill);
+	IKCP_FIELD_I(kcp->pace_tokens);
+	IKCP_FIELD_I(kcp->fastresend);
+	IKCP_FIELD_I(kcp->nocwnd);
+	IKCP_FIELD_I(kcp->sack);
+	IKCP_FIELD_I(kcp->stream);
+	IKCP_FIELD_I(kcp->logmask);
+	return n;
+}
+
+#undef IKCP_FIELD_U
+#undef IKCP_FIELD_I
+
+// built-in controllers and the 32 bits words of their state
+static int ikcp_state_cc(const ikcpcb *kcp, IUINT32 *words)
+{
+	if (kcp->cc == &ikcp_cc_bbr) {
+		*words = sizeof(struct IKCPBBR) / 4;
+		return IKCP_CC_BBR;
+	}
+	if (kcp->cc == &ikcp_cc_cubic) {
+		*words = sizeof(struct IKCPCUBIC) / 4;
+		return IKCP_CC_CUBIC;
+	}
+	*words = 0;
+	return IKCP_CC_DEFAULT;
+}
+
+static const struct IQUEUEHEAD *ikcp_state_queue(const ikcpcb *kcp, int i)
+{
+	switch (i) {
+	case 0: return &kcp->snd_queue;
+	case 1: return &kcp->snd_buf;
+	case 2: return &kcp->rcv_buf;
+	}
+	return &kcp->rcv_queue;
+}
+
+long ikcp_export(const ikcpcb *kcp, char *buffer, long maxsize)
+{
+	IUINT32 fields[IKCP_STATE_FIELDS], words, nseg = 0, bytes = 0;
+	const struct IQUEUEHEAD *p;
+	const IUINT32 *v;
+	long size;
+	char *ptr = buffer;
+	int cc, n, i;
+
+	n = ikcp_state_fields((ikcpcb*)kcp, fields, 1);
+	cc = ikcp_state_cc(kcp, &words);
+	if (kcp->ccdata == NULL) words = 0;
+
+	for (i = 0; i < 4; i++) {
+		const struct IQUEUEHEAD *head = ikcp_state_queue(kcp, i);
+		for (p = head->next; p != head; p = p->next) {
+			nseg++;
+			bytes += iqueue_entry(p, const IKCPSEG, node)->len;
+		}
+	}
+
+	size = IKCP_STATE_HEAD + n * 4 + 2 + words * 4 + 4 + 
+		kcp->ackcount * 8 + 4 + kcp->nacklog * 12 + 16 +
+		nseg * IKCP_STATE_SEG + bytes;
+
+	if (buffer == NULL) return size;
+	if (size > maxsize) return -1;
+
+	ptr = iencode32u_lsb(ptr, IKCP_STATE_MAGIC);
+	ptr = iencode32u_lsb(ptr, (IUINT32)size);
+	ptr = iencode32u_lsb(ptr, IKCP_STATE_VERSION);
+	ptr = iencode32u_lsb(ptr, (IUINT32)n);
+	ptr = iencode32u_lsb(ptr, nseg);
+	ptr = iencode32u_lsb(ptr, bytes);
+	ptr = iencode32u_lsb(ptr, 0);
+	for (i = 0; i < n; i++) {
+		ptr = iencode32u_lsb(ptr, fields[i]);
+	}
+
+	// controller state is made of 32 bits words
+	ptr = iencode8u(ptr, (unsigned char)cc);
+	ptr = iencode8u(ptr, (unsigned char)words);
+	v = (const IUINT32*)kcp->ccdata;
+	for (i = 0; i < (int)words; i++) {
+		ptr = iencode32u_lsb(ptr, v[i]);
+	}
+
+	ptr = iencode32u_lsb(ptr, kcp->ackcount);
+	v = (const IUINT32*)kcp->acklist->data;
+	for (i = 0; i < (int)kcp->ackcount * 2; i++) {
+		ptr = iencode32u_lsb(ptr, v[i]);
+	}
+
+	ptr = iencode32u_lsb(ptr, kcp->nacklog);
+	v = (const IUINT32*)kcp->acklog->data;
+	for (i = 0; i < (int)kcp->nacklog * 3; i++) {
+		ptr = iencode32u_lsb(ptr, v[i]);
+	}
+
+	for (i = 0; i < 4; i++) {
+		const struct IQUEUEHEAD *head = ikcp_state_queue(kcp, i);
+		char *count = ptr;
+		IUINT32 k = 0;
+		ptr += 4;
+		for (p = head->next; p != head; p = p->next, k++) {
+			const IKCPSEG *seg = iqueue_entry(p, const IKCPSEG, node);
+			ptr = iencode8u(ptr, (unsigned char)seg->frg);
+			ptr = iencode16u_lsb(ptr, (unsigned short)seg->wnd);
+			ptr = iencode32u_lsb(ptr, seg->ts);
+			ptr = iencode32u_lsb(ptr, seg->sn);
+			ptr = iencode32u_lsb(ptr, seg->una);
+			ptr = iencode32u_lsb(ptr, seg->len);
+			ptr = iencode32u_lsb(ptr, seg->resendts);
+			ptr = iencode32u_lsb(ptr, seg->rto);
+			ptr = iencode32u_lsb(ptr, seg->fastack);
+			ptr = iencode32u_lsb(ptr, seg->xmit);
+			memcpy(ptr, seg->data, seg->len);
+			ptr += seg->len;
+		}
+		iencode32u_lsb(count, k);
+	}
+
+	assert(ptr - buffer == size);
+
+	return size;
+}
+
+// decode segments of one queue into the arena, snd_buf and rcv_buf
+// segments are also indexed by sn. returns 0 for success
+static int ikcp_import_queue(ikcpcb *kcp, int i, const char **data, 
+	const char *end, size_t capacity, size_t *used)
+{
+	struct IQUEUEHEAD *head = (struct IQUEUEHEAD*)ikcp_state_queue(kcp, i);
+	const char *ptr = *data;
+	IUINT32 count, k, last = 0;
+
+	if (end - ptr < 4) return -1;
+	ptr = idecode32u_lsb(ptr, &count);
+
+	for (k = 0; k < count; k++) {
+		struct IKCPSLOT *slot;
+		IKCPSEG *seg;
+		IUINT32 ts, sn, una, len, resendts, rto, fastack, xmit;
+		IUINT16 wnd;
+		IUINT8 frg;
+		size_t need, room;
+
+		if (end - ptr < (long)IKCP_STATE_SEG) return -1;
+		ptr = idecode8u(ptr, &frg);
+		ptr = idecode16u_lsb(ptr, &wnd);
+		ptr = idecode32u_lsb(ptr, &ts);
+		ptr = idecode32u_lsb(ptr, &sn);
+		ptr = idecode32u_lsb(ptr, &una);
+		ptr = idecode32u_lsb(ptr, &len);
+		ptr = idecode32u_lsb(ptr, &resendts);
+		ptr = idecode32u_lsb(ptr, &rto);
+		ptr = idecode32u_lsb(ptr, &fastack);
+		ptr = idecode32u_lsb(ptr, &xmit);
+
+		// len is not bound by the local mss: rcv_buf/rcv_queue keep the
+		// peer's segment size, snd_queue/snd_buf keep theirs after mtu
+		// was lowered (eg. by ikcp_fec_new)
+		if (len > IKCP_MTU_MAX || (IUINT32)(end - ptr) < len) return -1;
+
+		// stream mode ikcp_send appends to the tail of snd_queue
+		room = len;
+		if (i == 0 && k + 1 == count && kcp->stream && room < kcp->mss) 
+			room = kcp->mss;
+		need = IKCP_ARENA_ALIGN(IKCP_SLOT_HEAD + sizeof(IKCPSEG) + room);
+		if (*used + need > capacity) return -1;
+
+		// segments of snd_buf/rcv_buf are sorted and in their windows
+		if (i == 1 || i == 2) {
+			IUINT32 base = (i == 1)? kcp->snd_una : kcp->rcv_nxt;
+			IUINT32 mask = (i == 1)? kcp->snd_mask : kcp->rcv_mask;
+			if (sn - base > mask) return -1;
+			if (i == 1 && itimediff(sn, kcp->snd_nxt) >= 0) return -1;
+			if (k > 0 && itimediff(sn, last) <= 0) return -1;
+			last = sn;
+		}
+
+		slot = (struct IKCPSLOT*)(kcp->arena + *used);
+		slot->size = (IUINT32)room | IKCP_SLOT_ARENA;
+		*used += need;
+		kcp->narena++;
+
+		seg = &slot->seg;
+		seg->conv = kcp->conv;
+		seg->cmd = IKCP_CMD_PUSH;
+		seg->frg = frg;
+		seg->wnd = wnd;
+		seg->ts = ts;
+		seg->sn = sn;
+		seg->una = una;
+		seg->len = len;
+		seg->resendts = resendts;
+		seg->rto = rto;
+		seg->fastack = fastack;
+		seg->xmit = xmit;
+		memcpy(seg->data, ptr, len);
+		ptr += len;
+
+		iqueue_add_tail(&seg->node, head);
+
+		switch (i) {
+		case 0: kcp->nsnd_que++; break;
+		case 1: kcp->nsnd_buf++; 
+				kcp->snd_ring[sn & kcp->snd_mask] = seg; break;
+		case 2: kcp->nrcv_buf++; 
+				kcp->rcv_ring[sn & kcp->rcv_mask] = seg; break;
+		default: kcp->nrcv_que++; break;
+		}
+	}
+
+	*data = ptr;
+	return 0;
+}
+
+ikcpcb* ikcp_import(const char *data, long size, void *user)
+{
+	IUINT32 fields[IKCP_STATE_FIELDS], magic, total, version, n;
+	IUINT32 nseg, bytes, count, words, i;
+	const char *end;
+	size_t capacity, used = 0;
+	IUINT8 cc, nword;
+	ikcpcb *kcp;
+
+	if (data == NULL || size < IKCP_STATE_HEAD) return NULL;
+
+	data = idecode32u_lsb(data, &magic);
+	data = idecode32u_lsb(data, &total);
+	data = idecode32u_lsb(data, &version);
+	data = idecode32u_lsb(data, &n);
+	data = idecode32u_lsb(data, &nseg);
+	data = idecode32u_lsb(data, &bytes);
+	data += 4;
+
+	if (magic != IKCP_STATE_MAGIC || version != IKCP_STATE_VERSION) 
+		return NULL;
+	if (total > (IUINT32)size || total < IKCP_STATE_HEAD) return NULL;
+	if (n != IKCP_STATE_FIELDS || bytes > total || nseg > total) return NULL;
+
+	end = data - IKCP_STATE_HEAD + total;
+	if (end - data < (long)(n * 4 + 2)) return NULL;
+
+	for (i = 0; i < n; i++) {
+		data = idecode32u_lsb(data, &fields[i]);
+	}
+
+	kcp = ikcp_create(0, user);
+	if (kcp == NULL) return NULL;
+
+	data = idecode8u(data, &cc);
+	data = idecode8u(data, &nword);
+
+	if (end - data < (long)nword * 4 + 8) {
+		ikcp_release(kcp);
+		return NULL;
+	}
+
+	// unknown controller: the default one is used
+	ikcp_congestion(kcp, cc);
+	ikcp_state_cc(kcp, &words);
+
+	for (i = 0; i < nword; i++) {
+		IUINT32 x;
+		data = idecode32u_lsb(data, &x);
+		if (nword == words && kcp->ccdata) {
+			((IUINT32*)kcp->ccdata)[i] = x;
+		}
+	}
+
+	// fields after controller init, which may change cwnd
+	ikcp_state_fields(kcp, fields, 0);
+
+	if (ikcp_setmtu(kcp, (int)kcp->mtu) != 0 ||
+		ikcp_wndsize(kcp, (int)kcp->snd_wnd, (int)kcp->rcv_wnd) != 0) {
+		ikcp_release(kcp);
+		return NULL;
+	}
+
+	data = idecode32u_lsb(data, &count);
+	if ((IUINT32)(end - data) / 8 < count) {
+		ikcp_release(kcp);
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		IUINT32 sn, ts;
+		data = idecode32u_lsb(data, &sn);
+		data = idecode32u_lsb(data, &ts);
+		ikcp_ack_push(kcp, sn, ts);
+	}
+
+	if (end - data < 4) {
+		ikcp_release(kcp);
+		return NULL;
+	}
+	data = idecode32u_lsb(data, &count);
+	if ((IUINT32)(end - data) / 12 < count) {
+		ikcp_release(kcp);
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		IUINT32 key, ts, num;
+		data = idecode32u_lsb(data, &key);
+		data = idecode32u_lsb(data, &ts);
+		data = idecode32u_lsb(data, &num);
+		ikcp_acklog_push(kcp, key, ts, num);
+	}
+
+	// one block for all segments instead of one allocation each
+	capacity = (size_t)nseg * IKCP_ARENA_ALIGN(IKCP_SLOT_HEAD + 
+		sizeof(IKCPSEG)) + IKCP_ARENA_ALIGN((size_t)bytes + nseg * 8) +
+		kcp->mss;
+	if (nseg > 0) {
+		kcp->arena = (char*)ikmem_malloc(capacity);
+		if (kcp->arena == NULL) {
+			ikcp_release(kcp);
+			return NULL;
+		}
+	}
+
+	for (i = 0; i < 4; i++) {
+		if (ikcp_import_queue(kcp, i, &data, end, capacity, &used) != 0) {
+			ikcp_release(kcp);
+			return NULL;
+		}
+	}
+
+	if (kcp->narena == 0 && kcp->arena) {
+		ikmem_free(kcp->arena);
+		kcp->arena = NULL;
+	}
+
+	return kcp;
+}
+
+
+//---------------------------------------------------------------------
+// statistics snapshot
+//---------------------------------------------------------------------
+void ikcp_stat(const ikcpcb *kcp, struct IKCPSTAT *stat)
+{
+	assert(kcp && stat);
+	*stat = kcp->stat;
+	stat->cwnd = kcp->cwnd;
+	stat->ssthresh = kcp->ssthresh;
+	stat->rto = (IUINT32)kcp->rx_rto;
+	stat->srtt = (IUINT32)kcp->rx_srtt;
+	stat->nsnd_que = kcp->nsnd_que;
+	stat->nsnd_buf = kcp->nsnd_buf;
+	stat->nrcv_buf = kcp->nrcv_buf;
+	stat->nrcv_que = kcp->nrcv_que;
+	stat->state = (IINT32)kcp->state;
+}
+
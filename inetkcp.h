@@ -39,6 +39,69 @@ struct IKCPSEG
 };
 
 
+//---------------------------------------------------------------------
+// segment pool
+//---------------------------------------------------------------------
+struct IKCPPOOL
+{
+	struct IQUEUEHEAD free;		// cached segments
+	IUINT32 size;				// data capacity of pooled segments
+	IUINT32 count;				// number of cached segments
+	IUINT32 limit;				// max cached segments
+};
+
+
+//---------------------------------------------------------------------
+// congestion control strategy
+//---------------------------------------------------------------------
+struct IKCPCB;
+
+struct IKCPCC
+{
+	const char *name;
+	// setup kcp->ccdata when installed, returns zero for success
+	int (*init)(struct IKCPCB *kcp);
+	// free kcp->ccdata when uninstalled or kcp released
+	void (*release)(struct IKCPCB *kcp);
+	// after ikcp_input: 'una' is snd_una before input, 'acked' is the
+	// count of segments removed from snd_buf, 'rtt' is the smallest
+	// rtt sample of this input or -1 if there is none
+	void (*ack)(struct IKCPCB *kcp, IUINT32 una, IUINT32 acked, IINT32 rtt);
+	// after ikcp_flush: 'fast' segments are fast retransmitted, 'timeout'
+	// is nonzero if any segment timed out, 'cwnd' is the window used
+	void (*loss)(struct IKCPCB *kcp, int fast, int timeout, IUINT32 cwnd);
+	// optional, rate of the pacer (ikcp_pacing) in bytes per second,
+	// zero if unknown yet: cwnd per srtt is used then, as if NULL
+	IUINT64 (*rate)(const struct IKCPCB *kcp);
+};
+
+
+//---------------------------------------------------------------------
+// IKCPSTAT: counters since ikcp_create, read them by ikcp_stat
+//---------------------------------------------------------------------
+#define IKCP_RTT_BUCKETS	16
+
+struct IKCPSTAT
+{
+	IUINT64 bytes_in, bytes_out;		// bytes of ikcp_input / output
+	IUINT32 pkts_in, pkts_out;			// packets of ikcp_input / output
+	IUINT32 bad_pkts;					// ikcp_input returned below zero
+	IUINT32 segs_sent, segs_recv;		// new data segments
+	IUINT32 retrans_timeout;			// segments resent by rto
+	IUINT32 retrans_fast;				// segments resent by fastack
+	IUINT32 dup_segs;					// data segments received again
+	IUINT32 wnd_drops;					// data segments beyond rcv_wnd
+	IUINT32 rtt_hist[IKCP_RTT_BUCKETS];	// [0]: 0ms, [i]: 2^(i-1) - 2^i ms
+	IUINT64 cwnd_sum;					// sum of cwnd over cwnd_samples
+	IUINT32 cwnd_samples;				// flushes with data in flight
+	IUINT32 cwnd_max;					// max cwnd over cwnd_samples
+	// gauges, only filled by ikcp_stat
+	IUINT32 cwnd, ssthresh, rto, srtt;
+	IUINT32 nsnd_que, nsnd_buf, nrcv_buf, nrcv_que;
+	IINT32 state;
+};
+
+
 //---------------------------------------------------------------------
 // IKCPCB
 //---------------------------------------------------------------------
@@ -52,26 +115,44 @@ struct IKCPCB
 	IUINT32 current, interval, ts_flush, xmit;
 	IUINT32 nrcv_buf, nsnd_buf;
 	IUINT32 nrcv_que, nsnd_que;
+	IUINT32 rcv_skip;
 	IUINT32 nodelay, updated;
 	IUINT32 ts_probe, probe_wait;
 	IUINT32 dead_link, incr, rx_rtt;
+	IUINT32 pacing, paced, ts_pace, ts_refill;
+	IINT32 pace_tokens;
 	struct IQUEUEHEAD snd_queue;
 	struct IQUEUEHEAD rcv_queue;
 	struct IQUEUEHEAD snd_buf;
 	struct IQUEUEHEAD rcv_buf;
+	struct IKCPSEG **snd_ring;
+	struct IKCPSEG **rcv_ring;
+	IUINT32 snd_mask, rcv_mask;
 	ivector_t *acklist;
 	IUINT32 ackcount;
+	ivector_t *acklog;
+	IUINT32 nacklog;
 	void *user;
 	char *buffer;
 	int fastresend;
 	int nocwnd;
+	int sack;
+	int stream;
 	int logmask;
 	int (*output)(const char *buf, int len, struct IKCPCB *kcp, void *user);
 	void (*writelog)(const char *log, struct IKCPCB *kcp, void *user);
+	const struct IKCPCC *cc;
+	void *ccdata;
+	struct IKCPPOOL *pool;
+	struct IKCPPOOL segpool;
+	char *arena;
+	IUINT32 narena;
+	struct IKCPSTAT stat;
 };
 
 
 typedef struct IKCPCB ikcpcb;
+typedef struct IKCPPOOL ikcppool;
 
 #define IKCP_LOG_OUTPUT			1
 #define IKCP_LOG_INPUT			2
@@ -86,6 +167,14 @@ typedef struct IKCPCB ikcpcb;
 #define IKCP_LOG_OUT_PROBE		1024
 #define IKCP_LOG_OUT_WINS		2048
 
+#define IKCP_SACK_ENABLE		1	// local: sack enabled
+#define IKCP_SACK_REMOTE		2	// remote can parse sack
+#define IKCP_SACK_CONFIRM		4	// remote knows we can parse sack
+
+#define IKCP_CC_DEFAULT			0	// loss based (slow start / avoidance)
+#define IKCP_CC_BBR				1	// bottleneck bandwidth and min rtt
+#define IKCP_CC_CUBIC			2	// cubic window growth
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -126,17 +215,38 @@ IUINT32 ikcp_check(const ikcpcb *kcp, IUINT32 current);
 int ikcp_input(ikcpcb *kcp, const char *data, long size);
 void ikcp_flush(ikcpcb *kcp);
 
+// size of next message, or all bytes received in stream mode
 int ikcp_peeksize(const ikcpcb *kcp);
 
+// stream mode: small sends are packed into mss sized segments and no
+// message boundary is kept, ikcp_recv returns as many bytes as 'len'
+// allows. both endpoints should use the same mode
+int ikcp_stream(ikcpcb *kcp, int enable);
+
+// zero-copy receive: point 'data'/'size' to at most 'count' pieces of
+// payload at the head of rcv_queue (only completed messages in message
+// mode), returns the number of pieces. they are valid until the next
+// ikcp_consume/ikcp_recv/ikcp_release
+int ikcp_peekv(const ikcpcb *kcp, const char **data, int *size, int count);
+
+// remove 'len' bytes from the head of rcv_queue after ikcp_peekv,
+// returns bytes removed
+int ikcp_consume(ikcpcb *kcp, int len);
+
 // change MTU size, default is 1400
 int ikcp_setmtu(ikcpcb *kcp, int mtu);
 
-// set maximum window size: sndwnd=32, rcvwnd=32 by default
+// set maximum window size: sndwnd=32, rcvwnd=32 by default,
+// returns -2 if the index of send/receive buffers can't grow
 int ikcp_wndsize(ikcpcb *kcp, int sndwnd, int rcvwnd);
 
 // get how many packet is waiting to be sent
 int ikcp_waitsnd(const ikcpcb *kcp);
 
+// returns 1 if there is nothing to send, resend, ack or probe, then
+// ikcp_update can be suspended until next ikcp_input/_send/_recv
+int ikcp_idle(const ikcpcb *kcp);
+
 // fastest: ikcp_nodelay(kcp, 1, 20, 2, 1)
 // nodelay: 0:disable(default), 1:enable
 // interval: internal update timer interval in millisec, default is 100ms 
@@ -144,6 +254,69 @@ int ikcp_waitsnd(const ikcpcb *kcp);
 // nc: 0:normal congestion control(default), 1:disable congestion control
 int ikcp_nodelay(ikcpcb *kcp, int nodelay, int interval, int resend, int nc);
 
+// select congestion control: IKCP_CC_DEFAULT, IKCP_CC_BBR, IKCP_CC_CUBIC
+// returns 0 for success, -1 for unknown id, -2 for init failure (the
+// default one will be used then)
+int ikcp_congestion(ikcpcb *kcp, int id);
+
+// install a custom congestion control, NULL for the default one.
+// 'cc' must be valid until it is replaced or kcp released
+int ikcp_setcc(ikcpcb *kcp, const struct IKCPCC *cc);
+
+// segment pool: segments freed on ack/delivery are cached for the next
+// ikcp_send/ikcp_input instead of going back to ikmem_free. each kcp
+// has a private one (sized to mss), kcps in one thread (eg. sessions of
+// a reactor) can share a bigger one. 'size' is the max payload of a
+// pooled segment, 'limit' is the max number of cached segments.
+ikcppool* ikcp_pool_new(int size, int limit);
+
+// delete pool after all kcps using it are released or switched
+void ikcp_pool_delete(ikcppool *pool);
+
+// use a shared pool (not thread safe), NULL for the private one
+int ikcp_setpool(ikcpcb *kcp, ikcppool *pool);
+
+// enable selective ack ranges: acknowledges of one flush are compacted
+// into ranges of sn (8 bytes each instead of a 24 bytes segment). it
+// is negotiated per conv: plain acks are used until both endpoints
+// have enabled it, so it is safe to talk with older implementations
+int ikcp_sack(ikcpcb *kcp, int enable);
+
+// pacing: data segments are sent at 'gain' percent of cwnd per srtt
+// (doubled in slow start), or of the rate given by the congestion 
+// control if it has one (bbr: max bandwidth by the gain of its mode),
+// instead of the whole window in one flush, to avoid overflowing 
+// shallow queues of shaped links. the budget of one flush is at most 
+// one interval of the rate, segments over it are sent
+// at ikcp_check time, so schedule ikcp_update by ikcp_check (or let
+// CAsyncUdp drive it). 0 to disable (default), 125 is fine for most.
+int ikcp_pacing(ikcpcb *kcp, int gain);
+
+// session state for hot migration: write windows, rtt, congestion and
+// all queued segments of kcp to 'buffer' (little endian), returns the
+// size written, -1 if maxsize is too small. returns the size needed if
+// buffer is NULL. output, writelog, user and pool are not saved, nor 
+// the state of a custom congestion control (ikcp_setcc). logmask is 
+// saved but logs are only written after writelog is set again.
+// a blob starts with "KCPS" and its size (32 bits), so blobs can be
+// streamed back to back.
+long ikcp_export(const ikcpcb *kcp, char *buffer, long maxsize);
+
+// create kcp from a blob of ikcp_export, NULL for bad data or no
+// memory. segments are placed in one block instead of one allocation
+// each. set output (and pool, custom cc) again before use. timestamps
+// go on from the exported ones, so both processes must use the same
+// clock (eg. iclock, which is system wide).
+ikcpcb* ikcp_import(const char *data, long size, void *user);
+
+// copy counters of kcp->stat and current gauges to 'stat'. counters
+// are plain increments on the paths of input/flush, no text is built,
+// so it is cheap enough to poll every session. counters are plain 
+// fields written by the thread driving kcp, so the snapshot must be
+// taken in that thread as well, no lock is taken.
+// counters are not saved by ikcp_export.
+void ikcp_stat(const ikcpcb *kcp, struct IKCPSTAT *stat);
+
 int ikcp_rcvbuf_count(const ikcpcb *kcp);
 int ikcp_sndbuf_count(const ikcpcb *kcp);
 
@@ -36,6 +36,9 @@ void isim_transfer_init(iSimTransfer *trans, long rtt, long lost, long amb,
 	trans->cnt_send = 0;
 	trans->cnt_drop = 0;
 	trans->mode = mode;
+	trans->bandwidth = 0;
+	trans->queue = 0;
+	trans->busy = 0;
 	iqueue_init(&trans->head);
 }
 
@@ -93,6 +96,7 @@ long isim_transfer_send(iSimTransfer *trans, const void *data, long size)
 	iqueue_head *p;
 	long feature;
 	long wave;
+	long delay = 0;
 
 	trans->cnt_send++;
 
@@ -102,6 +106,18 @@ long isim_transfer_send(iSimTransfer *trans, const void *data, long size)
 		return -1;
 	}
 
+	// ƿŶӣβ
+	if (trans->bandwidth > 0) {
+		double start = (double)trans->current;
+		if (trans->busy > start) start = trans->busy;
+		if (start - (double)trans->current > (double)trans->queue) {
+			trans->cnt_drop++;
+			return -3;
+		}
+		trans->busy = start + size * 1000.0 / trans->bandwidth;
+		delay = (long)(trans->busy - (double)trans->current);
+	}
+
 	// жǷ񶪰
 	if (trans->lost > 0) {
 		if (isim_transfer_random(trans, 100) < trans->lost) {
@@ -124,8 +140,8 @@ long isim_transfer_send(iSimTransfer *trans, const void *data, long size)
 	wave = (wave * (isim_transfer_random(trans, 200) - 100)) / 100;
 	wave = wave + trans->rtt;
 
-	if (wave < 0) feature = trans->current;
-	else feature = trans->current + wave;
+	if (wave < 0) feature = trans->current + delay;
+	else feature = trans->current + delay + wave;
 
 	packet->timestamp = feature;
 
@@ -185,6 +201,17 @@ long isim_transfer_recv(iSimTransfer *trans, void *data, long maxsize)
 	return size;
 }
 
+//---------------------------------------------------------------------
+// ·ƿ
+//---------------------------------------------------------------------
+void isim_transfer_bandwidth(iSimTransfer *trans, long bandwidth, long queue)
+{
+	assert(trans);
+	trans->bandwidth = bandwidth;
+	trans->queue = queue;
+	trans->busy = (double)trans->current;
+}
+
 
 //---------------------------------------------------------------------
 // isim_init:
@@ -276,3 +303,16 @@ void isim_seed(iSimNet *simnet, unsigned long seed1, unsigned long seed2)
 	simnet->t2.seed = seed2;
 }
 
+//---------------------------------------------------------------------
+// ƿ
+// bandwidth - ÿĴ(ֽ/)0Ϊ
+// queue     - ƿɵŶʱ()β
+// ʱ  = Ŷʱ + ӳ
+//---------------------------------------------------------------------
+void isim_bandwidth(iSimNet *simnet, long bandwidth, long queue)
+{
+	assert(simnet);
+	isim_transfer_bandwidth(&simnet->t1, bandwidth, queue);
+	isim_transfer_bandwidth(&simnet->t2, bandwidth, queue);
+}
+
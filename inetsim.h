@@ -121,6 +121,9 @@ struct ISIMTRANSFER
 	int mode;						// ģʽ0(ǰ󵽴)1(˳򵽴)
 	long cnt_send;					// ˶ٸ
 	long cnt_drop;					// ʧ˶ٸ
+	long bandwidth;					// ƿ(ֽ/), 0Ϊ
+	long queue;						// ƿŶʱ()
+	double busy;					// ƿʱ()
 };
 
 typedef struct ISIMTRANSFER iSimTransfer;
@@ -173,6 +176,9 @@ long isim_transfer_send(iSimTransfer *trans, const void *data, long size);
 // ·
 long isim_transfer_recv(iSimTransfer *trans, void *data, long maxsize);
 
+// ·ƿ
+void isim_transfer_bandwidth(iSimTransfer *trans, long bandwidth, long queue);
+
 
 
 // isim_init:
@@ -208,6 +214,12 @@ iSimPeer *isim_peer(iSimNet *simnet, int peerno);
 // 
 void isim_seed(iSimNet *simnet, unsigned long seed1, unsigned long seed2);
 
+// ƿ
+// bandwidth - ÿĴ(ֽ/)0Ϊ
+// queue     - ƿɵŶʱ()β
+// ʱ  = Ŷʱ + ӳ
+void isim_bandwidth(iSimNet *simnet, long bandwidth, long queue);
+
 
 
 #ifdef __cplusplus
@@ -38,6 +38,7 @@ const IUINT32 ITCP_DEF_RTO = 3000;
 const IUINT32 ITCP_MAX_RTO = 60000;
 const IUINT32 ITCP_ACK_DELAY = 500;
 const IUINT32 ITCP_BLOCKING_RETRY = 250;
+const IUINT32 ITCP_CORK_LIMIT = 200;
 
 const IUINT8 ITCP_FLAG_CTL = 0x02;
 const IUINT8 ITCP_FLAG_RST = 0x04;
@@ -210,6 +211,10 @@ itcpcb *itcp_create(IUINT32 conv, const void *user)
 
 	tcp->keepalive = 0;
 	tcp->shutdown = 0;
+	tcp->cork = 0;
+	tcp->cork_delay = 0;
+	tcp->ts_unsent = 0;
+	tcp->snd_push = 0;
 	tcp->user = (void*)user;
 
 	tcp->logmask = 0;
@@ -290,6 +295,42 @@ void itcp_release(itcpcb *tcp)
 }
 
 
+//---------------------------------------------------------------------
+// millisec to hold a partial segment, 0 for none
+//---------------------------------------------------------------------
+static IUINT32 itcp_hold_limit(const itcpcb *tcp)
+{
+	if (tcp->state != ITCP_ESTAB || tcp->shutdown) return 0;
+	return tcp->cork ? ITCP_CORK_LIMIT : tcp->cork_delay;
+}
+
+
+//---------------------------------------------------------------------
+// is unsent data held by cork or coalescing
+//---------------------------------------------------------------------
+static int itcp_hold(const itcpcb *tcp)
+{
+	IUINT32 limit = itcp_hold_limit(tcp);
+	if (limit == 0) return 0;
+	if (tcp->slen == tcp->snd_nxt - tcp->snd_una) return 0;
+	return (itimediff(tcp->current, tcp->ts_unsent) < (long)limit)? 1 : 0;
+}
+
+
+//---------------------------------------------------------------------
+// can nagle hold a partial segment while data is in flight
+//---------------------------------------------------------------------
+static int itcp_nagle(itcpcb *tcp)
+{
+	// pushed by uncork
+	if (itimediff(tcp->snd_push, tcp->snd_nxt) > 0) return 0;
+	tcp->snd_push = tcp->snd_nxt;
+	// already held long enough by cork or coalescing
+	if (itcp_hold_limit(tcp)) return 0;
+	return 1;
+}
+
+
 //---------------------------------------------------------------------
 // check timers
 //---------------------------------------------------------------------
@@ -323,6 +364,10 @@ int itcp_check(itcpcb *tcp)
 		ntimeout = _imin(ntimeout, 
 			itimediff(tcp->last_traffic + timeout, now));
 	}
+	if (itcp_hold(tcp)) {
+		ntimeout = _imin(ntimeout,
+			itimediff(tcp->ts_unsent + itcp_hold_limit(tcp), now));
+	}
 	return ntimeout;
 }
 
@@ -483,6 +528,9 @@ static long itcp_send_queue(itcpcb *tcp, const char *data, int len, int ctl)
 		ASSERT(!ctl);
 		len = tcp->buf_size - tcp->slen;
 	}	
+	if (tcp->slen == tcp->snd_nxt - tcp->snd_una) {
+		tcp->ts_unsent = tcp->current;
+	}
 	if (!iqueue_is_empty(&tcp->slist)) {
 		node = iqueue_entry(tcp->slist.prev, ISEGOUT, head);
 		if (node->bctl == ctl && node->xmit == 0) {
@@ -663,6 +711,11 @@ static void itcp_send_newdata(itcpcb *tcp, int sflag)
 			}
 		}
 
+		// wait for more writes to fill the segment
+		if (navailiable < tcp->mss && itcp_hold(tcp)) {
+			navailiable = 0;
+		}
+
 		if ((tcp->logmask & ILOG_WINDOW) && (tcp->logmask & ILOG_PACKET)) {
 			itcp_log(tcp, ILOG_WINDOW, 
 			"[%d] [cwnd:%u nwin:%d fly:%d avai:%d que:%d free:%d ssth:%d]",
@@ -685,7 +738,8 @@ static void itcp_send_newdata(itcpcb *tcp, int sflag)
 			}
 			break;
 		}
-		if ((tcp->snd_nxt > tcp->snd_una) && (navailiable < tcp->mss)) {
+		if ((tcp->snd_nxt > tcp->snd_una) && (navailiable < tcp->mss) &&
+			itcp_nagle(tcp)) {
 			break;
 		}
 		
@@ -1407,6 +1461,12 @@ void itcp_update(itcpcb *tcp, IUINT32 millisec)
 		}
 	}
 
+	// held data timeout, before delayed ack to carry it
+	if (itcp_hold_limit(tcp) && tcp->slen != tcp->snd_nxt - tcp->snd_una &&
+		itcp_hold(tcp) == 0) {
+		itcp_send_newdata(tcp, ISFLAG_NONE);
+	}
+
 	// delay acks
 	if (tcp->t_ack && itimediff(tcp->t_ack + tcp->rx_ackdelay, now) <= 0) {
 		itcp_output(tcp, tcp->snd_nxt, 0, NULL, 0);
@@ -1457,6 +1517,28 @@ void itcp_option(itcpcb *tcp, int nodelay, int keepalive)
 }
 
 
+//---------------------------------------------------------------------
+// cork / uncork
+//---------------------------------------------------------------------
+void itcp_cork(itcpcb *tcp, int cork)
+{
+	tcp->cork = cork? 1 : 0;
+	if (cork == 0 && tcp->state == ITCP_ESTAB) {
+		tcp->snd_push = tcp->snd_una + tcp->slen;
+		itcp_send_newdata(tcp, ISFLAG_NONE);
+	}
+}
+
+
+//---------------------------------------------------------------------
+// max delay of coalescing small writes
+//---------------------------------------------------------------------
+void itcp_coalesce(itcpcb *tcp, long delay)
+{
+	tcp->cork_delay = (delay > 0)? (IUINT32)delay : 0;
+}
+
+
 //---------------------------------------------------------------------
 // how many bytes can write to send buffer
 //---------------------------------------------------------------------
@@ -150,11 +150,13 @@ struct ITCPCB
 	int keepalive;
 	int shutdown;
 	int nodelay;
+	int cork;
 
 	IUINT32 ssthresh, cwnd;
 	IUINT32 dup_acks;
 	IUINT32 recover;
 	IUINT32 t_ack;
+	IUINT32 cork_delay, ts_unsent, snd_push;
 
 	void *user;
 	void *extra;
@@ -201,6 +203,17 @@ long itcp_canwrite(const itcpcb *tcp);
 
 void itcp_option(itcpcb *tcp, int nodelay, int keepalive);
 
+// cork: hold segments smaller than mss until uncorked, so writes are
+// packed into full segments. uncork pushes them at once without
+// waiting for acks. held data is sent anyway after ITCP_CORK_LIMIT ms
+void itcp_cork(itcpcb *tcp, int cork);
+
+// coalesce: time bounded nagle, a segment smaller than mss is sent 
+// when its first byte is 'delay' millisec old, whether data is in 
+// flight or not. writes within 'delay' are packed in one segment and
+// never wait longer for acks. 0 for nagle only (default)
+void itcp_coalesce(itcpcb *tcp, long delay);
+
 
 
 #ifdef __cplusplus
@@ -0,0 +1,1195 @@
+//=====================================================================
+//
+// inetudp.c - batched UDP transport for KCP
+//
+// NOTE:
+// for more information, please see the readme file.
+//
+//=====================================================================
+#include "inetudp.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__linux__) && (!defined(__AVM3__))
+#include <sys/uio.h>
+#include <netinet/udp.h>
+#include <linux/filter.h>
+#define IHAVE_MMSG
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF	51
+#endif
+#ifndef SOL_UDP
+#define SOL_UDP			17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT		103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO			104
+#endif
+#endif
+
+
+//=====================================================================
+// CAsyncUdp
+//=====================================================================
+#define ASYNC_UDP_SLOT			4096	// receive slot without GRO
+#define ASYNC_UDP_SLOT_GRO		65536	// receive slot with GRO
+#define ASYNC_UDP_GSO_SIZE		65000	// max bytes of one GSO send
+
+
+//---------------------------------------------------------------------
+// CAsyncUdpAddr
+//---------------------------------------------------------------------
+union CAsyncUdpAddr
+{
+	struct sockaddr sa;
+	struct sockaddr_in in4;
+	char data[128];
+};
+
+
+//---------------------------------------------------------------------
+// CAsyncUdpLink: one attached kcp
+//---------------------------------------------------------------------
+struct CAsyncUdpLink
+{
+	struct IQUEUEHEAD node;
+	ikcpcb *kcp;
+	CAsyncUdp *udp;
+	void *user;				// original kcp->user
+	int (*output)(const char *buf, int len, struct IKCPCB *kcp, void *user);
+	ikcpfec *fec;				// stage above the link, or NULL
+	union CAsyncUdpAddr remote;
+	int addrlen;
+	itimer_node timer;			// next ikcp_update
+	struct IQUEUEHEAD dirty;	// needs rescheduling
+};
+
+
+//---------------------------------------------------------------------
+// CAsyncUdpPacket: queued datagram in sndbuf
+//---------------------------------------------------------------------
+struct CAsyncUdpPacket
+{
+	struct CAsyncUdpLink *link;
+	long offset;
+	long size;
+};
+
+
+//---------------------------------------------------------------------
+// CAsyncUdp
+//---------------------------------------------------------------------
+struct CAsyncUdp
+{
+	struct IQUEUEHEAD links;	// attached kcps
+	struct IQUEUEHEAD dirty;	// links touched since last update
+	itimer_wheel wheel;			// update schedule of links
+	idict_t *convs;				// conv -> link
+	struct IVECTOR sndbuf;		// payload of queued datagrams
+	struct CAsyncUdpPacket packets[ASYNC_UDP_BATCH];
+	char *rcvbuf;				// rcvcount slots of rcvslot bytes
+	long rcvslot;
+	long sndsize;				// bytes used in sndbuf
+	int rcvcount;
+	int npackets;				// queued datagrams
+	int count;					// attached kcp count
+	int flags;					// enabled ASYNC_UDP_GSO/GRO
+	int error;					// last socket error
+	int started;				// wheel initialized
+	IUINT32 current;
+	int fd;
+	CAsyncUdpUnknown unknown;
+	void *user;
+	CAsyncUdpNotify notify;
+	void *nuser;
+};
+
+typedef struct CAsyncUdpLink CAsyncUdpLink;
+typedef struct CAsyncUdpPacket CAsyncUdpPacket;
+
+
+//---------------------------------------------------------------------
+// create transport
+//---------------------------------------------------------------------
+CAsyncUdp* async_udp_new(const struct sockaddr *addr, int addrlen,
+	int flags)
+{
+	CAsyncUdp *udp;
+
+	udp = (CAsyncUdp*)ikmem_malloc(sizeof(CAsyncUdp));
+	if (udp == NULL) return NULL;
+
+	udp->fd = isocket(addr->sa_family, SOCK_DGRAM, 0);
+	if (udp->fd < 0) {
+		ikmem_free(udp);
+		return NULL;
+	}
+
+	ienable(udp->fd, ISOCK_NOBLOCK);
+	ienable(udp->fd, ISOCK_CLOEXEC);
+
+	if (flags & ASYNC_UDP_REUSEPORT) {
+		ienable(udp->fd, ISOCK_REUSEPORT);
+	}
+
+	if (ibind(udp->fd, addr, addrlen) != 0) {
+		iclose(udp->fd);
+		ikmem_free(udp);
+		return NULL;
+	}
+
+	udp->flags = 0;
+
+#ifdef IHAVE_MMSG
+	if (flags & ASYNC_UDP_GSO) {
+		int value = 0;
+		int size = sizeof(value);
+		if (igetsockopt(udp->fd, SOL_UDP, UDP_SEGMENT, (char*)&value,
+			&size) == 0) {
+			udp->flags |= ASYNC_UDP_GSO;
+		}
+	}
+	if (flags & ASYNC_UDP_GRO) {
+		int value = 1;
+		if (isetsockopt(udp->fd, SOL_UDP, UDP_GRO, (const char*)&value,
+			sizeof(value)) == 0) {
+			udp->flags |= ASYNC_UDP_GRO;
+		}
+	}
+#endif
+
+	if (udp->flags & ASYNC_UDP_GRO) {
+		udp->rcvslot = ASYNC_UDP_SLOT_GRO;
+		udp->rcvcount = ASYNC_UDP_BATCH / 4;
+	}	else {
+		udp->rcvslot = ASYNC_UDP_SLOT;
+		udp->rcvcount = ASYNC_UDP_BATCH;
+	}
+
+	udp->rcvbuf = (char*)ikmem_malloc(udp->rcvslot * udp->rcvcount);
+	udp->convs = idict_create();
+
+	iv_init(&udp->sndbuf, NULL);
+
+	if (udp->rcvbuf == NULL || udp->convs == NULL ||
+		iv_resize(&udp->sndbuf, ASYNC_UDP_BATCH * 1500) != 0) {
+		if (udp->rcvbuf) ikmem_free(udp->rcvbuf);
+		if (udp->convs) idict_delete(udp->convs);
+		iv_destroy(&udp->sndbuf);
+		iclose(udp->fd);
+		ikmem_free(udp);
+		return NULL;
+	}
+
+	iqueue_init(&udp->links);
+	iqueue_init(&udp->dirty);
+	udp->started = 0;
+	udp->current = 0;
+	udp->sndsize = 0;
+	udp->npackets = 0;
+	udp->count = 0;
+	udp->error = 0;
+	udp->unknown = NULL;
+	udp->user = NULL;
+	udp->notify = NULL;
+	udp->nuser = NULL;
+
+	return udp;
+}
+
+
+//---------------------------------------------------------------------
+// delete transport
+//---------------------------------------------------------------------
+void async_udp_delete(CAsyncUdp *udp)
+{
+	assert(udp);
+	while (!iqueue_is_empty(&udp->links)) {
+		CAsyncUdpLink *link;
+		link = iqueue_entry(udp->links.next, CAsyncUdpLink, node);
+		async_udp_detach(udp, link->kcp->conv);
+	}
+	if (udp->fd >= 0) iclose(udp->fd);
+	udp->fd = -1;
+	if (udp->started) itimer_wheel_destroy(&udp->wheel);
+	idict_delete(udp->convs);
+	iv_destroy(&udp->sndbuf);
+	ikmem_free(udp->rcvbuf);
+	ikmem_free(udp);
+}
+
+
+//---------------------------------------------------------------------
+// get socket fd
+//---------------------------------------------------------------------
+int async_udp_fd(const CAsyncUdp *udp)
+{
+	return udp->fd;
+}
+
+int async_udp_count(const CAsyncUdp *udp)
+{
+	return udp->count;
+}
+
+
+//---------------------------------------------------------------------
+// kcp output: queue the datagram until async_udp_flush
+//---------------------------------------------------------------------
+static int async_udp_output(const char *buf, int len, ikcpcb *kcp,
+	void *user)
+{
+	CAsyncUdpLink *link = (CAsyncUdpLink*)user;
+	CAsyncUdp *udp = link->udp;
+	CAsyncUdpPacket *packet;
+
+	if (udp->npackets >= ASYNC_UDP_BATCH) {
+		async_udp_flush(udp);
+	}
+
+	if ((size_t)(udp->sndsize + len) > udp->sndbuf.size) {
+		size_t newsize = udp->sndbuf.size * 2;
+		while (newsize < (size_t)(udp->sndsize + len)) newsize *= 2;
+		if (iv_resize(&udp->sndbuf, newsize) != 0) return -1;
+	}
+
+	memcpy(udp->sndbuf.data + udp->sndsize, buf, len);
+	packet = &udp->packets[udp->npackets++];
+	packet->link = link;
+	packet->offset = udp->sndsize;
+	packet->size = len;
+	udp->sndsize += len;
+
+	return 0;
+}
+
+
+//---------------------------------------------------------------------
+// schedule: idle kcps leave the wheel until they are touched again
+//---------------------------------------------------------------------
+static void async_udp_schedule(CAsyncUdp *udp, CAsyncUdpLink *link)
+{
+	if (ikcp_idle(link->kcp)) {
+		itimer_node_del(&udp->wheel, &link->timer);
+	}	else {
+		IUINT32 expires = ikcp_check(link->kcp, udp->current);
+		itimer_node_add(&udp->wheel, &link->timer, expires);
+	}
+}
+
+static void async_udp_on_timer(void *data, void *user)
+{
+	CAsyncUdpLink *link = (CAsyncUdpLink*)data;
+	CAsyncUdp *udp = (CAsyncUdp*)user;
+	ikcp_update(link->kcp, udp->current);
+	async_udp_schedule(udp, link);
+	if (link->kcp->state != 0 && udp->notify) {
+		udp->notify(udp, link->kcp, ASYNC_UDP_EVT_DEAD, udp->nuser);
+	}
+}
+
+static void async_udp_dirty(CAsyncUdp *udp, CAsyncUdpLink *link)
+{
+	if (iqueue_is_empty(&link->dirty)) {
+		iqueue_add_tail(&link->dirty, &udp->dirty);
+	}
+}
+
+
+//---------------------------------------------------------------------
+// attach / detach
+//---------------------------------------------------------------------
+int async_udp_attach(CAsyncUdp *udp, ikcpcb *kcp,
+	const struct sockaddr *remote, int addrlen)
+{
+	CAsyncUdpLink *link;
+	void *ptr;
+
+	if (addrlen <= 0 || addrlen > (int)sizeof(union CAsyncUdpAddr))
+		return -2;
+
+	if (idict_search_ip(udp->convs, (ilong)kcp->conv, &ptr) == 0)
+		return -1;
+
+	// the stage would send around the link and take the input as kcp
+	if (ikcp_fec_get(kcp, NULL) != NULL)
+		return -4;
+
+	link = (CAsyncUdpLink*)ikmem_malloc(sizeof(CAsyncUdpLink));
+	if (link == NULL) return -3;
+
+	link->kcp = kcp;
+	link->udp = udp;
+	link->user = kcp->user;
+	link->output = kcp->output;
+	link->fec = NULL;
+	memcpy(link->remote.data, remote, addrlen);
+	link->addrlen = addrlen;
+	itimer_node_init(&link->timer, async_udp_on_timer, link, udp);
+	iqueue_init(&link->dirty);
+
+	if (idict_add_ip(udp->convs, (ilong)kcp->conv, link) < 0) {
+		ikmem_free(link);
+		return -3;
+	}
+
+	iqueue_add_tail(&link->node, &udp->links);
+	async_udp_dirty(udp, link);
+	udp->count++;
+
+	kcp->user = link;
+	kcp->output = async_udp_output;
+
+	return 0;
+}
+
+ikcpcb* async_udp_detach(CAsyncUdp *udp, IUINT32 conv)
+{
+	CAsyncUdpLink *link;
+	ikcpcb *kcp;
+	void *ptr;
+
+	if (idict_search_ip(udp->convs, (ilong)conv, &ptr) != 0) return NULL;
+	link = (CAsyncUdpLink*)ptr;
+
+	// queued datagrams refer to the link
+	if (udp->npackets > 0) {
+		async_udp_flush(udp);
+	}
+
+	kcp = link->kcp;
+
+	if (link->fec) {
+		ikcp_fec_delete(link->fec);
+		link->fec = NULL;
+	}
+
+	kcp->user = link->user;
+	kcp->output = link->output;
+
+	if (udp->started) {
+		itimer_node_del(&udp->wheel, &link->timer);
+	}
+
+	idict_del_i(udp->convs, (ilong)conv);
+	iqueue_del(&link->node);
+	iqueue_del(&link->dirty);
+	udp->count--;
+	ikmem_free(link);
+
+	return kcp;
+}
+
+ikcpcb* async_udp_find(CAsyncUdp *udp, IUINT32 conv)
+{
+	void *ptr;
+	if (idict_search_ip(udp->convs, (ilong)conv, &ptr) != 0) return NULL;
+	return ((CAsyncUdpLink*)ptr)->kcp;
+}
+
+void async_udp_touch(CAsyncUdp *udp, IUINT32 conv)
+{
+	void *ptr;
+	if (idict_search_ip(udp->convs, (ilong)conv, &ptr) == 0) {
+		async_udp_dirty(udp, (CAsyncUdpLink*)ptr);
+	}
+}
+
+void* async_udp_user(const ikcpcb *kcp)
+{
+	if (kcp->output == async_udp_output) 
+		return ((const CAsyncUdpLink*)kcp->user)->user;
+	if (ikcp_fec_get(kcp, async_udp_output) != NULL) 
+		return ((const CAsyncUdpLink*)ikcp_fec_user(kcp))->user;
+	return kcp->user;
+}
+
+
+//---------------------------------------------------------------------
+// fec stage: created above the link, so it sends to async_udp_output
+//---------------------------------------------------------------------
+ikcpfec* async_udp_fec(CAsyncUdp *udp, IUINT32 conv, int datashards,
+	int parityshards)
+{
+	CAsyncUdpLink *link;
+	void *ptr;
+
+	if (idict_search_ip(udp->convs, (ilong)conv, &ptr) != 0) return NULL;
+	link = (CAsyncUdpLink*)ptr;
+
+	if (datashards == 0) {
+		if (link->fec) {
+			ikcp_fec_delete(link->fec);
+			link->fec = NULL;
+		}
+		return NULL;
+	}
+
+	if (link->fec) {
+		if (ikcp_fec_shards(link->fec, datashards, parityshards) != 0)
+			return NULL;
+		return link->fec;
+	}
+
+	if (link->kcp->output != async_udp_output) return NULL;
+
+	link->fec = ikcp_fec_new(link->kcp, datashards, parityshards);
+
+	return link->fec;
+}
+
+void async_udp_unknown(CAsyncUdp *udp, CAsyncUdpUnknown handler,
+	void *user)
+{
+	udp->unknown = handler;
+	udp->user = user;
+}
+
+void async_udp_notify(CAsyncUdp *udp, CAsyncUdpNotify handler,
+	void *user)
+{
+	udp->notify = handler;
+	udp->nuser = user;
+}
+
+
+//---------------------------------------------------------------------
+// steer by conv: classic bpf on the reuseport group, conv is read as
+// little endian (bpf loads are big endian) and the result indexes the
+// sockets in the order they were bound
+//---------------------------------------------------------------------
+int async_udp_steer(CAsyncUdp *udp, int count)
+{
+#ifdef IHAVE_MMSG
+	struct sock_filter code[] = {
+		{ BPF_LD | BPF_B | BPF_ABS, 0, 0, 3 },
+		{ BPF_ALU | BPF_LSH | BPF_K, 0, 0, 8 },
+		{ BPF_MISC | BPF_TAX, 0, 0, 0 },
+		{ BPF_LD | BPF_B | BPF_ABS, 0, 0, 2 },
+		{ BPF_ALU | BPF_OR | BPF_X, 0, 0, 0 },
+		{ BPF_ALU | BPF_LSH | BPF_K, 0, 0, 8 },
+		{ BPF_MISC | BPF_TAX, 0, 0, 0 },
+		{ BPF_LD | BPF_B | BPF_ABS, 0, 0, 1 },
+		{ BPF_ALU | BPF_OR | BPF_X, 0, 0, 0 },
+		{ BPF_ALU | BPF_LSH | BPF_K, 0, 0, 8 },
+		{ BPF_MISC | BPF_TAX, 0, 0, 0 },
+		{ BPF_LD | BPF_B | BPF_ABS, 0, 0, 0 },
+		{ BPF_ALU | BPF_OR | BPF_X, 0, 0, 0 },
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, 0 },
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog prog;
+	if (count < 1) return -1;
+	code[13].k = (IUINT32)count;
+	prog.len = sizeof(code) / sizeof(code[0]);
+	prog.filter = code;
+	if (isetsockopt(udp->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+		(const char*)&prog, sizeof(prog)) != 0) {
+		return -1;
+	}
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+
+//---------------------------------------------------------------------
+// demultiplex one datagram by conv
+//---------------------------------------------------------------------
+static void async_udp_input(CAsyncUdp *udp, const char *data, long size,
+	const struct sockaddr *remote, int addrlen)
+{
+	IUINT32 conv;
+	void *ptr;
+
+	if (size < 24) return;
+
+	idecode32u_lsb(data, &conv);
+
+	if (idict_search_ip(udp->convs, (ilong)conv, &ptr) == 0) {
+		CAsyncUdpLink *link = (CAsyncUdpLink*)ptr;
+		if (link->fec) {
+			ikcp_fec_input(link->fec, data, size);
+		}	else {
+			ikcp_input(link->kcp, data, size);
+		}
+		async_udp_dirty(udp, link);
+		if (udp->notify) {
+			udp->notify(udp, link->kcp, ASYNC_UDP_EVT_INPUT, udp->nuser);
+		}
+	}
+	else if (udp->unknown) {
+		udp->unknown(udp, conv, data, size, remote, addrlen, udp->user);
+	}
+}
+
+
+#ifdef IHAVE_MMSG
+//---------------------------------------------------------------------
+// recvmmsg: returns datagram count, 0 for EAGAIN, -1 for error,
+// *full is set when every slot is used
+//---------------------------------------------------------------------
+union CAsyncUdpCtrl
+{
+	struct cmsghdr align;
+	char data[64];
+};
+
+static int async_udp_recv_batch(CAsyncUdp *udp, int *full)
+{
+	struct mmsghdr msgs[ASYNC_UDP_BATCH];
+	struct iovec iovs[ASYNC_UDP_BATCH];
+	union CAsyncUdpAddr addrs[ASYNC_UDP_BATCH];
+	union CAsyncUdpCtrl ctrls[ASYNC_UDP_BATCH];
+	int count = udp->rcvcount;
+	int total = 0;
+	int i, n;
+
+	for (i = 0; i < count; i++) {
+		struct msghdr *hdr = &msgs[i].msg_hdr;
+		memset(hdr, 0, sizeof(struct msghdr));
+		iovs[i].iov_base = udp->rcvbuf + udp->rcvslot * i;
+		iovs[i].iov_len = udp->rcvslot;
+		hdr->msg_name = &addrs[i];
+		hdr->msg_namelen = sizeof(union CAsyncUdpAddr);
+		hdr->msg_iov = &iovs[i];
+		hdr->msg_iovlen = 1;
+		if (udp->flags & ASYNC_UDP_GRO) {
+			hdr->msg_control = ctrls[i].data;
+			hdr->msg_controllen = sizeof(ctrls[i].data);
+		}
+	}
+
+	full[0] = 0;
+
+	while (1) {
+		n = recvmmsg(udp->fd, msgs, count, 0, NULL);
+		if (n >= 0) break;
+		if (errno == EINTR) continue;
+		if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+		udp->error = errno;
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct msghdr *hdr = &msgs[i].msg_hdr;
+		const char *data = (const char*)iovs[i].iov_base;
+		long size = (long)msgs[i].msg_len;
+		long segment = size;
+		long pos;
+		if (hdr->msg_flags & MSG_TRUNC) continue;
+		if (udp->flags & ASYNC_UDP_GRO) {
+			struct cmsghdr *cm;
+			for (cm = CMSG_FIRSTHDR(hdr); cm; cm = CMSG_NXTHDR(hdr, cm)) {
+				if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+					int value;
+					memcpy(&value, CMSG_DATA(cm), sizeof(value));
+					if (value > 0) segment = value;
+				}
+			}
+		}
+		for (pos = 0; pos < size; pos += segment) {
+			long canread = size - pos;
+			if (canread > segment) canread = segment;
+			async_udp_input(udp, data + pos, canread, &addrs[i].sa,
+				(int)hdr->msg_namelen);
+			total++;
+		}
+	}
+
+	full[0] = (n == count)? 1 : 0;
+
+	return total;
+}
+
+
+//---------------------------------------------------------------------
+// sendmmsg packets[first...], consecutive same-size datagrams to the
+// same link are coalesced into one GSO message
+//---------------------------------------------------------------------
+static int async_udp_send_batch(CAsyncUdp *udp, int first)
+{
+	struct mmsghdr msgs[ASYNC_UDP_BATCH];
+	struct iovec iovs[ASYNC_UDP_BATCH];
+	union CAsyncUdpCtrl ctrls[ASYNC_UDP_BATCH];
+	int heads[ASYNC_UDP_BATCH];
+	int segs[ASYNC_UDP_BATCH];
+	int gso = udp->flags & ASYNC_UDP_GSO;
+	int count = 0, sent = 0, start = 0;
+	int i, j;
+
+	for (i = first; i < udp->npackets; i = j) {
+		CAsyncUdpPacket *packet = &udp->packets[i];
+		struct msghdr *hdr = &msgs[count].msg_hdr;
+		long total = packet->size;
+		for (j = i + 1; gso && j < udp->npackets; j++) {
+			CAsyncUdpPacket *next = &udp->packets[j];
+			if (next->link != packet->link) break;
+			if (next->size > packet->size) break;
+			if (total + next->size > ASYNC_UDP_GSO_SIZE) break;
+			total += next->size;
+			if (next->size < packet->size) { j++; break; }
+		}
+		memset(hdr, 0, sizeof(struct msghdr));
+		iovs[count].iov_base = udp->sndbuf.data + packet->offset;
+		iovs[count].iov_len = total;
+		hdr->msg_name = &packet->link->remote;
+		hdr->msg_namelen = packet->link->addrlen;
+		hdr->msg_iov = &iovs[count];
+		hdr->msg_iovlen = 1;
+		if (j - i > 1) {
+			struct cmsghdr *cm;
+			IUINT16 segment = (IUINT16)packet->size;
+			hdr->msg_control = ctrls[count].data;
+			hdr->msg_controllen = CMSG_SPACE(sizeof(segment));
+			cm = CMSG_FIRSTHDR(hdr);
+			cm->cmsg_level = SOL_UDP;
+			cm->cmsg_type = UDP_SEGMENT;
+			cm->cmsg_len = CMSG_LEN(sizeof(segment));
+			memcpy(CMSG_DATA(cm), &segment, sizeof(segment));
+		}
+		heads[count] = i;
+		segs[count] = j - i;
+		count++;
+	}
+
+	while (start < count) {
+		int n = sendmmsg(udp->fd, msgs + start, count - start, 0);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (gso && (errno == EIO || errno == EINVAL)) {
+				// no checksum offload on this route: send one by one
+				udp->flags &= ~ASYNC_UDP_GSO;
+				return sent + async_udp_send_batch(udp, heads[start]);
+			}
+			// drop the rest, kcp will retransmit them
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				udp->error = errno;
+				if (sent == 0) return -1;
+			}
+			break;
+		}
+		for (i = 0; i < n; i++) sent += segs[start + i];
+		start += n;
+	}
+
+	return sent;
+}
+#endif
+
+
+//---------------------------------------------------------------------
+// receive pending datagrams
+//---------------------------------------------------------------------
+int async_udp_recv(CAsyncUdp *udp)
+{
+	int total = 0;
+#ifdef IHAVE_MMSG
+	while (1) {
+		int full = 0;
+		int hr = async_udp_recv_batch(udp, &full);
+		if (hr < 0) return (total > 0)? total : -1;
+		total += hr;
+		if (full == 0) break;
+	}
+#else
+	while (1) {
+		union CAsyncUdpAddr remote;
+		int addrlen = sizeof(remote);
+		long hr = irecvfrom(udp->fd, udp->rcvbuf, udp->rcvslot, 0,
+			&remote.sa, &addrlen);
+		if (hr < 0) {
+			int code = ierrno();
+			if (code == IEAGAIN || code == 0) break;
+			udp->error = code;
+			return (total > 0)? total : -1;
+		}
+		async_udp_input(udp, udp->rcvbuf, hr, &remote.sa, addrlen);
+		total++;
+	}
+#endif
+	return total;
+}
+
+
+//---------------------------------------------------------------------
+// send queued datagrams
+//---------------------------------------------------------------------
+int async_udp_flush(CAsyncUdp *udp)
+{
+	int sent = 0;
+	if (udp->npackets == 0) return 0;
+#ifdef IHAVE_MMSG
+	sent = async_udp_send_batch(udp, 0);
+#else
+	{
+		int i;
+		for (i = 0; i < udp->npackets; i++) {
+			CAsyncUdpPacket *packet = &udp->packets[i];
+			long hr = isendto(udp->fd, udp->sndbuf.data + packet->offset,
+				packet->size, 0, &packet->link->remote.sa,
+				packet->link->addrlen);
+			if (hr < 0) {
+				int code = ierrno();
+				if (code != IEAGAIN && code != 0) udp->error = code;
+				break;
+			}
+			sent++;
+		}
+	}
+#endif
+	udp->npackets = 0;
+	udp->sndsize = 0;
+	return sent;
+}
+
+
+//---------------------------------------------------------------------
+// update due kcps, their output of this tick is sent together
+//---------------------------------------------------------------------
+void async_udp_update(CAsyncUdp *udp, IUINT32 current)
+{
+	if (udp->started == 0) {
+		itimer_wheel_init(&udp->wheel, current);
+		udp->started = 1;
+	}
+	udp->current = current;
+	while (!iqueue_is_empty(&udp->dirty)) {
+		CAsyncUdpLink *link;
+		link = iqueue_entry(udp->dirty.next, CAsyncUdpLink, dirty);
+		iqueue_del_init(&link->dirty);
+		async_udp_schedule(udp, link);
+	}
+	itimer_wheel_run(&udp->wheel, current);
+	async_udp_flush(udp);
+}
+
+//---------------------------------------------------------------------
+// millisec until async_udp_update is needed, -1 for all idle
+//---------------------------------------------------------------------
+long async_udp_check(const CAsyncUdp *udp, IUINT32 current)
+{
+	if (udp->started == 0 || !iqueue_is_empty(&udp->dirty)) return 0;
+	if (udp->npackets > 0) return 0;
+	return itimer_wheel_next(&udp->wheel, current);
+}
+
+
+//=====================================================================
+// CAsyncKcp
+//=====================================================================
+#define ASYNC_KCP_TIMEOUT_DEF	30000
+
+#define ASYNC_KCP_S_OPEN		0	// idle timer armed (if enabled)
+#define ASYNC_KCP_S_FRESH		1	// created before the timer is armed
+#define ASYNC_KCP_S_CLOSING		2	// released in next update
+
+
+//---------------------------------------------------------------------
+// CAsyncKcpSession: kcp->user of a session
+//---------------------------------------------------------------------
+struct CAsyncKcpSession
+{
+	struct IQUEUEHEAD node;		// all sessions
+	struct IQUEUEHEAD ready;	// received data, not returned yet
+	struct IQUEUEHEAD entry;	// fresh or closing list
+	CAsyncKcp *server;
+	ikcpcb *kcp;
+	itimer_node timer;			// idle timeout
+	IUINT32 active;				// time of last input
+	int state;
+	int reason;
+	void *user;
+};
+
+
+//---------------------------------------------------------------------
+// CAsyncKcp
+//---------------------------------------------------------------------
+struct CAsyncKcp
+{
+	CAsyncUdp *udp;
+	struct IQUEUEHEAD sessions;
+	struct IQUEUEHEAD ready;
+	struct IQUEUEHEAD fresh;
+	struct IQUEUEHEAD closing;
+	itimer_wheel wheel;			// idle timeout of sessions
+	int started;
+	int count;
+	IUINT32 current;
+	IUINT32 timeout;
+	int datashards;				// fec group sizes, 0 for plain kcp
+	int parityshards;
+	CAsyncKcpAccept accept;
+	CAsyncKcpClose close;
+	void *user;
+};
+
+typedef struct CAsyncKcpSession CAsyncKcpSession;
+
+
+//---------------------------------------------------------------------
+// session state
+//---------------------------------------------------------------------
+static void async_kcp_closing(CAsyncKcpSession *session, int reason)
+{
+	CAsyncKcp *server = session->server;
+	if (session->state == ASYNC_KCP_S_CLOSING) return;
+	if (session->state == ASYNC_KCP_S_FRESH) {
+		iqueue_del(&session->entry);
+	}
+	if (server->started) {
+		itimer_node_del(&server->wheel, &session->timer);
+	}
+	session->state = ASYNC_KCP_S_CLOSING;
+	session->reason = reason;
+	iqueue_add_tail(&session->entry, &server->closing);
+	iqueue_del_init(&session->ready);
+}
+
+static void async_kcp_release(CAsyncKcp *server, CAsyncKcpSession *session)
+{
+	ikcpcb *kcp = session->kcp;
+	if (server->close) {
+		server->close(server, kcp, session->reason, server->user);
+	}
+	if (session->state != ASYNC_KCP_S_OPEN) {
+		iqueue_del(&session->entry);
+	}
+	if (server->started) {
+		itimer_node_del(&server->wheel, &session->timer);
+	}
+	iqueue_del(&session->node);
+	iqueue_del(&session->ready);
+	async_udp_detach(server->udp, kcp->conv);
+	ikcp_release(kcp);
+	ikmem_free(session);
+	server->count--;
+}
+
+static void async_kcp_on_timer(void *data, void *user)
+{
+	CAsyncKcpSession *session = (CAsyncKcpSession*)data;
+	CAsyncKcp *server = (CAsyncKcp*)user;
+	IUINT32 expires = session->active + server->timeout;
+	if (server->timeout == 0) return;
+	if (itimediff(server->current, expires) >= 0) {
+		async_kcp_closing(session, ASYNC_KCP_TIMEOUT);
+	}	else {
+		itimer_node_add(&server->wheel, &session->timer, expires);
+	}
+}
+
+
+//---------------------------------------------------------------------
+// events from CAsyncUdp
+//---------------------------------------------------------------------
+static void async_kcp_notify(CAsyncUdp *udp, ikcpcb *kcp, int event,
+	void *user)
+{
+	CAsyncKcp *server = (CAsyncKcp*)user;
+	CAsyncKcpSession *session = (CAsyncKcpSession*)async_udp_user(kcp);
+	if (session->state == ASYNC_KCP_S_CLOSING) return;
+	if (event == ASYNC_UDP_EVT_INPUT) {
+		session->active = server->current;
+		if (kcp->nrcv_que > 0 && iqueue_is_empty(&session->ready)) {
+			iqueue_add_tail(&session->ready, &server->ready);
+		}
+	}
+	else if (event == ASYNC_UDP_EVT_DEAD) {
+		async_kcp_closing(session, ASYNC_KCP_DEAD);
+	}
+}
+
+static void async_kcp_unknown(CAsyncUdp *udp, IUINT32 conv,
+	const char *data, long size, const struct sockaddr *remote,
+	int addrlen, void *user)
+{
+	CAsyncKcp *server = (CAsyncKcp*)user;
+	CAsyncKcpSession *session;
+	unsigned char cmd = (unsigned char)data[4];
+	ikcpfec *fec = NULL;
+	ikcpcb *kcp;
+	int framed;
+
+	// fec is probed first: byte 4 of it is the low byte of group id
+	framed = (server->datashards > 0 && ikcp_fec_probe(data, size));
+
+	// only datagrams starting with a kcp segment (cmd 81 - 85)
+	if (server->accept == NULL || (!framed && (cmd < 81 || cmd > 85)))
+		return;
+
+	session = (CAsyncKcpSession*)ikmem_malloc(sizeof(CAsyncKcpSession));
+	if (session == NULL) return;
+
+	kcp = ikcp_create(conv, session);
+	if (kcp == NULL) {
+		ikmem_free(session);
+		return;
+	}
+
+	session->server = server;
+	session->kcp = kcp;
+	session->active = server->current;
+	session->state = ASYNC_KCP_S_FRESH;
+	session->reason = ASYNC_KCP_CLOSE;
+	session->user = NULL;
+	iqueue_init(&session->ready);
+	itimer_node_init(&session->timer, async_kcp_on_timer, session, server);
+
+	if (server->accept(server, kcp, remote, addrlen, server->user) != 0 ||
+		async_udp_attach(udp, kcp, remote, addrlen) != 0) {
+		ikcp_release(kcp);
+		ikmem_free(session);
+		return;
+	}
+
+	if (framed) {
+		fec = async_udp_fec(udp, conv, server->datashards, 
+			server->parityshards);
+		if (fec == NULL) {
+			async_udp_detach(udp, conv);
+			ikcp_release(kcp);
+			ikmem_free(session);
+			return;
+		}
+	}
+
+	iqueue_add_tail(&session->node, &server->sessions);
+	iqueue_add_tail(&session->entry, &server->fresh);
+	server->count++;
+
+	if (fec) {
+		ikcp_fec_input(fec, data, size);
+	}	else {
+		ikcp_input(kcp, data, size);
+	}
+	async_kcp_notify(udp, kcp, ASYNC_UDP_EVT_INPUT, server);
+}
+
+
+//---------------------------------------------------------------------
+// create / delete
+//---------------------------------------------------------------------
+CAsyncKcp* async_kcp_new(const struct sockaddr *addr, int addrlen,
+	int flags)
+{
+	CAsyncKcp *server;
+
+	server = (CAsyncKcp*)ikmem_malloc(sizeof(CAsyncKcp));
+	if (server == NULL) return NULL;
+
+	server->udp = async_udp_new(addr, addrlen, flags);
+	if (server->udp == NULL) {
+		ikmem_free(server);
+		return NULL;
+	}
+
+	iqueue_init(&server->sessions);
+	iqueue_init(&server->ready);
+	iqueue_init(&server->fresh);
+	iqueue_init(&server->closing);
+	server->started = 0;
+	server->count = 0;
+	server->current = 0;
+	server->timeout = ASYNC_KCP_TIMEOUT_DEF;
+	server->datashards = 0;
+	server->parityshards = 0;
+	server->accept = NULL;
+	server->close = NULL;
+	server->user = NULL;
+
+	async_udp_unknown(server->udp, async_kcp_unknown, server);
+	async_udp_notify(server->udp, async_kcp_notify, server);
+
+	return server;
+}
+
+int async_kcp_shards(CAsyncKcp **shards, int count, 
+	const struct sockaddr *addr, int addrlen, int flags)
+{
+	union CAsyncUdpAddr local;
+	int size = sizeof(local);
+	int i;
+
+	if (count < 1 || addrlen > (int)sizeof(local)) return -1;
+
+	if (count > 1) flags |= ASYNC_UDP_REUSEPORT;
+
+	for (i = 0; i < count; i++) {
+		shards[i] = async_kcp_new(addr, addrlen, flags);
+		if (shards[i] == NULL) {
+			while (i > 0) async_kcp_delete(shards[--i]);
+			return -1;
+		}
+		// bind the rest to the port chosen for the first one
+		if (i == 0) {
+			if (isockname(async_udp_fd(shards[0]->udp), &local.sa,
+				&size) != 0) {
+				async_kcp_delete(shards[0]);
+				return -1;
+			}
+			addr = &local.sa;
+			addrlen = size;
+		}
+	}
+
+	if (count > 1 && async_udp_steer(shards[0]->udp, count) != 0) 
+		return -2;
+
+	return 0;
+}
+
+void async_kcp_delete(CAsyncKcp *server)
+{
+	assert(server);
+	while (!iqueue_is_empty(&server->sessions)) {
+		CAsyncKcpSession *session;
+		session = iqueue_entry(server->sessions.next, 
+			CAsyncKcpSession, node);
+		if (session->state != ASYNC_KCP_S_CLOSING) {
+			session->reason = ASYNC_KCP_CLOSE;
+		}
+		async_kcp_release(server, session);
+	}
+	async_udp_delete(server->udp);
+	if (server->started) itimer_wheel_destroy(&server->wheel);
+	ikmem_free(server);
+}
+
+void async_kcp_handler(CAsyncKcp *server, CAsyncKcpAccept accept,
+	CAsyncKcpClose close, void *user)
+{
+	server->accept = accept;
+	server->close = close;
+	server->user = user;
+}
+
+void async_kcp_timeout(CAsyncKcp *server, IUINT32 timeout)
+{
+	struct IQUEUEHEAD *p;
+	IUINT32 previous = server->timeout;
+	server->timeout = timeout;
+	if (previous != 0 || timeout == 0 || server->started == 0) return;
+	// timers stopped while disabled
+	for (p = server->sessions.next; p != &server->sessions; p = p->next) {
+		CAsyncKcpSession *session = iqueue_entry(p, CAsyncKcpSession, node);
+		if (session->state == ASYNC_KCP_S_OPEN) {
+			itimer_node_add(&server->wheel, &session->timer, 
+				session->active + timeout);
+		}
+	}
+}
+
+
+void async_kcp_fec(CAsyncKcp *server, int datashards, int parityshards)
+{
+	server->datashards = datashards;
+	server->parityshards = parityshards;
+}
+
+
+//---------------------------------------------------------------------
+// io
+//---------------------------------------------------------------------
+CAsyncUdp* async_kcp_udp(CAsyncKcp *server)
+{
+	return server->udp;
+}
+
+int async_kcp_recv(CAsyncKcp *server)
+{
+	return async_udp_recv(server->udp);
+}
+
+ikcpcb* async_kcp_next(CAsyncKcp *server)
+{
+	CAsyncKcpSession *session;
+	if (iqueue_is_empty(&server->ready)) return NULL;
+	session = iqueue_entry(server->ready.next, CAsyncKcpSession, ready);
+	iqueue_del_init(&session->ready);
+	return session->kcp;
+}
+
+void async_kcp_close(CAsyncKcp *server, IUINT32 conv)
+{
+	ikcpcb *kcp = async_udp_find(server->udp, conv);
+	if (kcp) {
+		async_kcp_closing((CAsyncKcpSession*)async_udp_user(kcp),
+			ASYNC_KCP_CLOSE);
+	}
+}
+
+void async_kcp_update(CAsyncKcp *server, IUINT32 current)
+{
+	struct IQUEUEHEAD *p;
+
+	if (server->started == 0) {
+		itimer_wheel_init(&server->wheel, current);
+		server->started = 1;
+		for (p = server->fresh.next; p != &server->fresh; p = p->next) {
+			iqueue_entry(p, CAsyncKcpSession, entry)->active = current;
+		}
+	}
+
+	server->current = current;
+
+	while (!iqueue_is_empty(&server->fresh)) {
+		CAsyncKcpSession *session;
+		session = iqueue_entry(server->fresh.next, CAsyncKcpSession, entry);
+		iqueue_del(&session->entry);
+		session->state = ASYNC_KCP_S_OPEN;
+		if (server->timeout > 0) {
+			itimer_node_add(&server->wheel, &session->timer,
+				session->active + server->timeout);
+		}
+	}
+
+	async_udp_update(server->udp, current);
+	itimer_wheel_run(&server->wheel, current);
+
+	while (!iqueue_is_empty(&server->closing)) {
+		CAsyncKcpSession *session;
+		session = iqueue_entry(server->closing.next, CAsyncKcpSession, 
+			entry);
+		async_kcp_release(server, session);
+	}
+}
+
+long async_kcp_check(const CAsyncKcp *server, IUINT32 current)
+{
+	long udp, idle;
+	if (server->started == 0) return 0;
+	if (!iqueue_is_empty(&server->fresh)) return 0;
+	if (!iqueue_is_empty(&server->closing)) return 0;
+	udp = async_udp_check(server->udp, current);
+	idle = itimer_wheel_next(&server->wheel, current);
+	if (udp < 0) return idle;
+	if (idle < 0) return udp;
+	return (udp < idle)? udp : idle;
+}
+
+ikcpcb* async_kcp_find(CAsyncKcp *server, IUINT32 conv)
+{
+	return async_udp_find(server->udp, conv);
+}
+
+int async_kcp_count(const CAsyncKcp *server)
+{
+	return server->count;
+}
+
+void* async_kcp_get(const ikcpcb *kcp)
+{
+	return ((const CAsyncKcpSession*)async_udp_user(kcp))->user;
+}
+
+void async_kcp_set(ikcpcb *kcp, void *user)
+{
+	((CAsyncKcpSession*)async_udp_user(kcp))->user = user;
+}
+
@@ -0,0 +1,214 @@
+//=====================================================================
+//
+// inetudp.h - batched UDP transport for KCP
+//
+// NOTE:
+// for more information, please see the readme file.
+//
+//=====================================================================
+#ifndef __INETUDP_H__
+#define __INETUDP_H__
+
+#include "inetbase.h"
+#include "imemdata.h"
+#include "inetkcp.h"
+#include "inetfec.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+//=====================================================================
+// CAsyncUdp
+//=====================================================================
+struct CAsyncUdp;
+typedef struct CAsyncUdp CAsyncUdp;
+
+#define ASYNC_UDP_GSO		1	// coalesce datagrams with UDP_SEGMENT
+#define ASYNC_UDP_GRO		2	// receive coalesced datagrams (UDP_GRO)
+#define ASYNC_UDP_REUSEPORT	4	// more sockets on one address (shards)
+
+#define ASYNC_UDP_BATCH		64	// datagrams per recvmmsg/sendmmsg
+
+// called for datagrams whose conv is not attached
+typedef void (*CAsyncUdpUnknown)(CAsyncUdp *udp, IUINT32 conv,
+	const char *data, long size, const struct sockaddr *remote,
+	int addrlen, void *user);
+
+#define ASYNC_UDP_EVT_INPUT	1	// datagram input to an attached kcp
+#define ASYNC_UDP_EVT_DEAD	2	// kcp->state is dead after ikcp_update
+
+// called for attached kcps, don't attach/detach inside
+typedef void (*CAsyncUdpNotify)(CAsyncUdp *udp, ikcpcb *kcp, int event,
+	void *user);
+
+
+//=====================================================================
+// interfaces
+//=====================================================================
+
+// create a non-blocking udp socket bound to addr, NULL for error.
+// flags: ASYNC_UDP_GSO / ASYNC_UDP_GRO, ignored if not supported
+CAsyncUdp* async_udp_new(const struct sockaddr *addr, int addrlen,
+	int flags);
+
+// delete transport, attached kcps are detached but not released
+void async_udp_delete(CAsyncUdp *udp);
+
+// get socket fd, wait IPOLL_IN on it and call async_udp_recv
+int async_udp_fd(const CAsyncUdp *udp);
+
+// attach kcp: datagrams are routed by kcp->conv, output goes to remote.
+// kcp->output and kcp->user are taken over until detached, the old
+// user can be obtained by async_udp_user. returns 0 for success,
+// -1 for conv already attached, -2 for bad address, -4 if kcp output
+// is taken by a fec stage (attach first, then add it by async_udp_fec)
+int async_udp_attach(CAsyncUdp *udp, ikcpcb *kcp,
+	const struct sockaddr *remote, int addrlen);
+
+// detach kcp by conv and restore its output/user, its fec stage is
+// deleted. returns kcp or NULL
+ikcpcb* async_udp_detach(CAsyncUdp *udp, IUINT32 conv);
+
+// put a fec stage (inetfec.h) between an attached kcp and the socket:
+// output is encoded and datagrams of conv go to ikcp_fec_input. group
+// sizes are changed if it has one, 0 datashards deletes it. the stage
+// belongs to the link, don't create one on an attached kcp by
+// ikcp_fec_new. returns the stage, NULL for error or deleted
+ikcpfec* async_udp_fec(CAsyncUdp *udp, IUINT32 conv, int datashards,
+	int parityshards);
+
+// find attached kcp by conv
+ikcpcb* async_udp_find(CAsyncUdp *udp, IUINT32 conv);
+
+// get the original user of an attached kcp
+void* async_udp_user(const ikcpcb *kcp);
+
+// set handler for datagrams with unknown conv
+void async_udp_unknown(CAsyncUdp *udp, CAsyncUdpUnknown handler,
+	void *user);
+
+// set handler for events of attached kcps
+void async_udp_notify(CAsyncUdp *udp, CAsyncUdpNotify handler,
+	void *user);
+
+// steer datagrams of a SO_REUSEPORT group by conv: the socket bound
+// i-th in the group (from 0) gets datagrams of (conv % count == i).
+// linux only, returns 0 for success, -1 for error
+int async_udp_steer(CAsyncUdp *udp, int count);
+
+// receive pending datagrams and feed them to ikcp_input,
+// returns datagram count, -1 for socket error
+int async_udp_recv(CAsyncUdp *udp);
+
+// send datagrams queued by kcp output in one sendmmsg,
+// returns datagram count sent, -1 for socket error
+int async_udp_flush(CAsyncUdp *udp);
+
+// call it after ikcp_send/ikcp_recv on an attached kcp, so it will be
+// rescheduled by next async_udp_update
+void async_udp_touch(CAsyncUdp *udp, IUINT32 conv);
+
+// update due kcps only (timing wheel driven by ikcp_check, idle kcps
+// are not visited) and flush all output of this tick
+void async_udp_update(CAsyncUdp *udp, IUINT32 current);
+
+// millisec until next async_udp_update is needed, -1 if all kcps are
+// idle, use it as the timeout of ipoll_wait/async_core_wait
+long async_udp_check(const CAsyncUdp *udp, IUINT32 current);
+
+// attached kcp count
+int async_udp_count(const CAsyncUdp *udp);
+
+
+//=====================================================================
+// CAsyncKcp: kcp server, owns the sessions of one CAsyncUdp
+//
+// a session is created when a datagram of an unknown conv arrives and
+// the accept handler takes it, and is released after it is closed by
+// dead link, idle timeout or async_kcp_close. to use more threads,
+// create shards by async_kcp_shards and drive each one in its thread:
+// the kernel steers a conv to the same shard, so shards share nothing.
+//=====================================================================
+struct CAsyncKcp;
+typedef struct CAsyncKcp CAsyncKcp;
+
+#define ASYNC_KCP_CLOSE		0	// closed by async_kcp_close/delete
+#define ASYNC_KCP_DEAD		1	// dead link: too many retransmissions
+#define ASYNC_KCP_TIMEOUT	2	// nothing received in timeout
+
+// new conv from remote: setup kcp (nodelay, wndsize, ...) and return
+// zero to accept it, nonzero to drop the datagram
+typedef int (*CAsyncKcpAccept)(CAsyncKcp *server, ikcpcb *kcp,
+	const struct sockaddr *remote, int addrlen, void *user);
+
+// session closed for reason ASYNC_KCP_*, kcp is released after return
+typedef void (*CAsyncKcpClose)(CAsyncKcp *server, ikcpcb *kcp,
+	int reason, void *user);
+
+// create server on a new CAsyncUdp, NULL for error
+CAsyncKcp* async_kcp_new(const struct sockaddr *addr, int addrlen,
+	int flags);
+
+// create 'count' servers on one address, conv goes to shards[conv %
+// count]. returns 0 for success, -1 for error, -2 if steering is not 
+// supported (the kernel spreads remote addresses over shards instead)
+int async_kcp_shards(CAsyncKcp **shards, int count, 
+	const struct sockaddr *addr, int addrlen, int flags);
+
+// delete server, sessions are closed (ASYNC_KCP_CLOSE) and released
+void async_kcp_delete(CAsyncKcp *server);
+
+// set handlers, sessions are only created with an accept handler
+void async_kcp_handler(CAsyncKcp *server, CAsyncKcpAccept accept,
+	CAsyncKcpClose close, void *user);
+
+// idle timeout in millisec, 0 to disable, default is 30000
+void async_kcp_timeout(CAsyncKcp *server, IUINT32 timeout);
+
+// accept fec framed conversations too: a session whose first datagram
+// is a data shard (ikcp_fec_probe) gets a fec stage by async_udp_fec
+// with these group sizes after the accept handler. 0 datashards (the
+// default) accepts plain kcp only, existing sessions are not changed
+void async_kcp_fec(CAsyncKcp *server, int datashards, int parityshards);
+
+// underlying transport: fd, flush, touch after ikcp_send/ikcp_recv
+CAsyncUdp* async_kcp_udp(CAsyncKcp *server);
+
+// receive pending datagrams, returns datagram count, -1 for error
+int async_kcp_recv(CAsyncKcp *server);
+
+// next session which has received data since it was returned last
+// time, NULL for none. read it by ikcp_recv until it returns below 0
+ikcpcb* async_kcp_next(CAsyncKcp *server);
+
+// close session in next async_kcp_update
+void async_kcp_close(CAsyncKcp *server, IUINT32 conv);
+
+// update sessions, expire and release closed ones
+void async_kcp_update(CAsyncKcp *server, IUINT32 current);
+
+// millisec until next async_kcp_update is needed, -1 for idle
+long async_kcp_check(const CAsyncKcp *server, IUINT32 current);
+
+// find session by conv
+ikcpcb* async_kcp_find(CAsyncKcp *server, IUINT32 conv);
+
+// session count
+int async_kcp_count(const CAsyncKcp *server);
+
+// user data of a session
+void* async_kcp_get(const ikcpcb *kcp);
+void async_kcp_set(ikcpcb *kcp, void *user);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
+
+
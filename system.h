@@ -426,6 +426,11 @@ public:
 		return iposix_thread_get_name(_thread);
 	}
 
+	// Ƿǵǰ߳
+	bool is_current() const {
+		return iposix_thread_current() == _thread;
+	}
+
 	// Ϊ߳ڲõľ̬Ա
 
 	// ȡõǰ߳
@@ -606,6 +611,11 @@ public:
 		return (retval == 0)? true : false;
 	}
 
+	// ȡ¼ count ȡĸΪ 0 ʱû¼
+	int event_batch(IPOLLEVENT *events, int count) {
+		return ipoll_event_batch(_ipoll_desc, events, count);
+	}
+
 protected:
 	ipolld _ipoll_desc;
 };
@@ -1018,6 +1028,12 @@ public:
 		async_core_notify(_core);
 	}
 
+	// ̴߳ź sig (0-31) wait  ASYNC_CORE_EVT_SIGNAL
+	// Ϣ´ wait ֮ǰĶδϲһϢ
+	int signal(int sig) {
+		return async_core_signal(_core, sig);
+	}
+
 	// ȡϢϢ 
 	// ûϢ-1
 	// eventֵΪ ASYNC_CORE_EVT_NEW/LEAVE/ESTAB/DATA
@@ -1026,11 +1042,19 @@ public:
 	// event=ASYNC_CORE_EVT_ESTAB: ӳɹ wparam=hid, lparam=tag ( new_connect)
 	// event=ASYNC_CORE_EVT_DATA:  յ wparam=hid, lparam=tag
 	// event=ASYNC_CORE_EVT_PROGRESS: ɹ wparam=hid, lparam=tag
+	// event=ASYNC_CORE_EVT_SIGNAL: signal  wparam=sig
 	// ͨ÷ѭãûϢɶʱһwaitȥ
 	long read(int *event, long *wparam, long *lparam, void *data, long maxsize) {
 		return async_core_read(_core, event, wparam, lparam, data, maxsize);
 	}
 
+	// ȡϢһμȡ count Ϣδ buffer 
+	//  events[i].data/size ָ򣬷ضϢûϢ 0
+	// һϢŲ buffer ʱ -2
+	int read(CAsyncEvent *events, int count, void *buffer, long size) {
+		return async_core_read_batch(_core, events, count, buffer, size);
+	}
+
 	// ĳӷݣhidΪӱʶ
 	long send(long hid, const void *data, long size) {
 		return async_core_send(_core, hid, data, size);
@@ -1292,8 +1316,9 @@ protected:
 class Queue
 {
 public:
-	Queue(iulong maxsize = 0) {
-		_queue = queue_safe_new(maxsize);
+	// flags: QUEUE_SAFE_SP/QUEUE_SAFE_SC/QUEUE_SAFE_SPSC/QUEUE_SAFE_MPSC
+	Queue(iulong maxsize = 0, int flags = 0) {
+		_queue = queue_safe_new_ex(maxsize, flags);
 		if (_queue == NULL) 
 			SYSTEM_THROW("can not create Queue", 10008);
 	}
@@ -1839,12 +1864,25 @@ class TaskPool
 {
 public:
 
-	// ʼ趨Լ߳
-	TaskPool(const char *name, int nthreads, int slap = 50) {
+	// ȼȼִ
+	enum TaskPriority
+	{
+		PriorityLow = 0,
+		PriorityNormal = 1,
+		PriorityHigh = 2,
+	};
+
+	// ʼ趨Լ߳slap  wait ˯ʱ
+	TaskPool(const char *name, int nthreads, int slap = 50): 
+		_queue_out(0, QUEUE_SAFE_MPSC) {
 		_name = name;
 		if (nthreads < 1) {
 			SYSTEM_THROW("nthreads must great than zero", 10009);
 		}
+		_sched = task_sched_new(nthreads, PriorityHigh + 1, 1024);
+		if (_sched == NULL) {
+			SYSTEM_THROW("can not create scheduler for TaskPool", 10014);
+		}
 		_threads.resize(nthreads);
 		for (int i = 0; i < nthreads; i++) {
 			std::string text = name;
@@ -1862,6 +1900,8 @@ public:
 		_start = false;
 		_slap = slap;
 		_nthreads = nthreads;
+		_core = NULL;
+		_signal = 0;
 	}
 
 	// ̳߳زɾδɵ
@@ -1881,18 +1921,21 @@ public:
 			delete node;
 		}
 		while (1) {
-			if (_queue_in.get(&obj, 0) == 0) break;
+			if (task_sched_pop(_sched, 0, &obj, 0) == 0) break;
 			node = (TaskNode*)obj;
 			delete node->task;
 			node->task = NULL;
 			delete node;
 		}
+		task_sched_delete(_sched);
+		_sched = NULL;
 	}
 
 	// ʼ߳
 	inline bool start() {
 		if (_start) return true;
 		_stop = false;
+		task_sched_stop(_sched, 0);
 		for (int i = 0; i < _nthreads; i++) {
 			_threads[i]->set_signal(i);
 			_threads[i]->start();
@@ -1907,20 +1950,44 @@ public:
 		_stop = true;
 		for (int i = 0; i < _nthreads; i++) {
 			_threads[i]->set_notalive();
+		}
+		task_sched_stop(_sched, 1);
+		for (int i = 0; i < _nthreads; i++) {
 			_threads[i]->join();
 		}
 		_start = false;
 	}
 
-	// 
-	inline bool push(TaskInt *task) {
+	// affinity ΪϣִеḺ́߳ţ-1 Ϊ⣩ֻ
+	// ʾ߳æʱᱻ߳͵ߡ run ʱ
+	// 뵱ǰ߳ԼĶУȳ̻߳ᱻ
+	inline bool push(TaskInt *task, int priority = PriorityNormal, 
+		int affinity = -1) {
 		if (_stop) return false;
 		TaskNode *node = new TaskNode;
 		node->task = task;
-		if (_queue_in.put(node, 0) == 0) return false;
+		if (task_sched_push(_sched, node, priority, __current(), 
+			affinity) == 0) {
+			delete node;
+			return false;
+		}
 		return true;
 	}
 
+	// 󶨵 AsyncCoreʱ core  sig źţ߳յ
+	// ASYNC_CORE_EVT_SIGNAL (wparam=sig) ʱ update ɣҪѯ
+	// ʼ֮߳ǰãcore Ϊ NULL ʱ
+	inline void bind(AsyncCore *core, int sig = 0) {
+		_core = core;
+		_signal = sig;
+	}
+
+	// ù߳е cpuǿʼ̺߳
+	inline bool set_affinity(int index, unsigned int cpumask) {
+		if (index < 0 || index >= _nthreads) return false;
+		return _threads[index]->set_affinity(cpumask);
+	}
+
 	// £̴߳Ľ done/error/finalѭ
 	inline void update() {
 		while (1) {
@@ -1949,16 +2016,18 @@ public:
 	// ȡδִɵ
 	inline int size() {
 		int x1, x2;
-		x1 = (int)_queue_in.size();
+		x1 = (int)task_sched_size(_sched);
 		x2 = (int)_queue_out.size();
 		return x1 + x2;
 	}
 
-	// ȴ
+	// ȴʱȴ slap 
 	inline void wait() {
-		while (size() > 0) {
+		while (1) {
+			void *obj;
 			update();
-			isleep(_slap);
+			if (size() == 0) break;
+			_queue_out.peek(&obj, _slap);
 		}
 	}
 
@@ -1971,23 +2040,24 @@ protected:
 		try { node->task->run(); }
 		catch (...) { node->ok = false; }
 		_queue_out.put(node, IEVENT_INFINITE);
+		task_sched_done(_sched);
+		if (_core) _core->signal(_signal);
+	}
+
+	// ǰ̱߳ţǹ̷߳ -1
+	inline int __current() const {
+		int index = Thread::CurrentSignal();
+		if (index < 0 || index >= _nthreads) return -1;
+		if (_threads[index]->is_current() == false) return -1;
+		return index;
 	}
 
-	// ̵߳ε
+	// ̵߳εڣûʱ˯ߣ stop ʱ
 	inline int __run() {
 		if (_stop) return 0;
-		if (_nthreads > 1) {
-			void *obj;
-			int hr = _queue_in.get(&obj, (IUINT32)_slap);
-			if (hr == 0) return 1;
+		void *obj;
+		if (task_sched_pop(_sched, __current(), &obj, IEVENT_INFINITE)) {
 			__task_invoke((TaskNode*)obj);
-		}	else {
-			void *objs[16];
-			int hr = _queue_in.get_many(objs, 16, (IUINT32)_slap);
-			if (hr == 0) return 1;
-			for (int i = 0; i < hr; i++) {
-				__task_invoke((TaskNode*)objs[i]);
-			}
 		}
 		return 1;
 	}
@@ -2004,7 +2074,9 @@ protected:
 	bool _start;
 	int _nthreads;
 	int _slap;
-	Queue _queue_in;
+	int _signal;
+	AsyncCore *_core;
+	iTaskSched *_sched;
 	Queue _queue_out;
 	std::string _name;
 	std::vector<Thread*> _threads;